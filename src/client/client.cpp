@@ -110,6 +110,7 @@ Client::Client(QObject *parent)
     _coreAccountModel(new CoreAccountModel(this)),
     _coreConnection(new CoreConnection(this)),
     _connected(false),
+    _sessionSuspended(false),
     _debugLog(&_debugLogBuffer)
 {
     _signalProxy->synchronize(_ircListHelper);
@@ -137,6 +138,7 @@ void Client::init()
     SignalProxy *p = signalProxy();
 
     p->attachSlot(SIGNAL(displayMsg(const Message &)), this, SLOT(recvMessage(const Message &)));
+    p->attachSlot(SIGNAL(displayMessages(const QVariantList &)), this, SLOT(recvMessages(const QVariantList &)));
     p->attachSlot(SIGNAL(displayStatusMsg(QString, QString)), this, SLOT(recvStatusMsg(QString, QString)));
 
     p->attachSlot(SIGNAL(bufferInfoUpdated(BufferInfo)), _networkModel, SLOT(bufferUpdated(BufferInfo)));
@@ -363,9 +365,22 @@ void Client::connectionStateChanged(CoreConnection::ConnectionState state)
 {
     switch (state) {
     case CoreConnection::Disconnected:
+        if (_sessionSuspended)
+            break;
+        if (_connected && coreConnection()->canResume()) {
+            // Keep everything as it is, the core replays what we miss until we reconnect
+            _connected = false;
+            _sessionSuspended = true;
+            break;
+        }
         setDisconnectedFromCore();
         break;
     case CoreConnection::Synchronized:
+        if (_sessionSuspended) {
+            _sessionSuspended = false;
+            _connected = true;
+            break;
+        }
         setSyncedToCore();
         break;
     default:
@@ -444,13 +459,26 @@ void Client::requestInitialBacklog()
 
 void Client::disconnectFromCore()
 {
-    if (!coreConnection()->isConnected())
+    if (!coreConnection()->isConnected() && !_sessionSuspended)
         return;
 
     coreConnection()->disconnectFromCore();
 }
 
 
+void Client::endSuspendedSession()
+{
+    if (!_sessionSuspended)
+        return;
+
+    // The core features have already been negotiated for the new connection at this point
+    Quassel::Features features = _coreFeatures;
+    _sessionSuspended = false;
+    setDisconnectedFromCore();
+    _coreFeatures = features;
+}
+
+
 void Client::setDisconnectedFromCore()
 {
     _connected = false;
@@ -555,6 +583,16 @@ void Client::recvMessage(const Message &msg)
 }
 
 
+void Client::recvMessages(const QVariantList &messages)
+{
+    QList<Message> msglist;
+    foreach(const QVariant &v, messages) {
+        msglist << v.value<Message>();
+    }
+    messageProcessor()->process(msglist);
+}
+
+
 void Client::setBufferLastSeenMsg(BufferId id, const MsgId &msgId)
 {
     if (bufferSyncer())
@@ -131,6 +131,9 @@ public:
     static bool isConnected();
     static bool internalCore();
 
+    //! Whether we lost our core connection, but keep its state around for resuming it
+    static inline bool isSessionSuspended() { return instance()->_sessionSuspended; }
+
     static void userInput(const BufferInfo &bufferInfo, const QString &message);
 
     static void setBufferLastSeenMsg(BufferId id, const MsgId &msgId); // this is synced to core and other clients
@@ -209,9 +212,11 @@ public slots:
 private slots:
     void setSyncedToCore();
     void setDisconnectedFromCore();
+    void endSuspendedSession();
     void connectionStateChanged(CoreConnection::ConnectionState);
 
     void recvMessage(const Message &message);
+    void recvMessages(const QVariantList &messages);
     void recvStatusMsg(QString network, QString message);
 
     void networkDestroyed();
@@ -263,6 +268,7 @@ private:
     QHash<IdentityId, Identity *> _identities;
 
     bool _connected;
+    bool _sessionSuspended;
     static Quassel::Features _coreFeatures;
 
     QString _debugLogBuffer;
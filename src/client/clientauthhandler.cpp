@@ -46,7 +46,8 @@ ClientAuthHandler::ClientAuthHandler(CoreAccount account, QObject *parent)
     _account(account),
     _probing(false),
     _legacy(false),
-    _connectionFeatures(0)
+    _connectionFeatures(0),
+    _resumeCount(0)
 {
 
 }
@@ -288,7 +289,7 @@ void ClientAuthHandler::startRegistration()
     useSsl = _account.useSsl();
 #endif
 
-    _peer->dispatch(RegisterClient(Quassel::buildInfo().fancyVersionString, Quassel::buildInfo().buildDate, useSsl));
+    _peer->dispatch(RegisterClient(Quassel::buildInfo().fancyVersionString, Quassel::buildInfo().buildDate, useSsl, Quassel::features()));
 }
 
 
@@ -369,7 +370,7 @@ void ClientAuthHandler::login(const QString &previousError)
         }
     }
 
-    _peer->dispatch(Login(_account.user(), _account.password()));
+    _peer->dispatch(Login(_account.user(), _account.password(), _resumeToken, _resumeCount));
 }
 
 
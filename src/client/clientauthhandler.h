@@ -42,6 +42,9 @@ public:
         Latest=Sha2_512
     };
 
+    //! Ask the core to resume the connection identified by token, having received count messages on it
+    inline void setResumeRequest(const QByteArray &token, quint64 count) { _resumeToken = token; _resumeCount = count; }
+
 public slots:
     void connectToCore();
 
@@ -117,6 +120,8 @@ private:
     bool _probing;
     bool _legacy;
     quint8 _connectionFeatures;
+    QByteArray _resumeToken;
+    quint64 _resumeCount;
 };
 
 #endif
@@ -87,6 +87,21 @@ void ClientBacklogManager::receiveBacklogAll(MsgId first, MsgId last, int limit,
 }
 
 
+void ClientBacklogManager::receiveBacklogSearch(QString query, QVariantList bufferIds, QDateTime start, QDateTime end, int limit, MsgId last, QVariantList msgs)
+{
+    Q_UNUSED(bufferIds) Q_UNUSED(start) Q_UNUSED(end) Q_UNUSED(limit)
+
+    MessageList msglist;
+    foreach(QVariant v, msgs) {
+        Message msg = v.value<Message>();
+        msg.setFlags(msg.flags() | Message::Backlog);
+        msglist << msg;
+    }
+
+    emit backlogSearchResults(query, last, msglist);
+}
+
+
 void ClientBacklogManager::requestInitialBacklog()
 {
     if (_initBacklogRequested) {
@@ -43,6 +43,7 @@ public slots:
     virtual QVariantList requestBacklog(BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
     virtual void receiveBacklog(BufferId bufferId, MsgId first, MsgId last, int limit, int additional, QVariantList msgs);
     virtual void receiveBacklogAll(MsgId first, MsgId last, int limit, int additional, QVariantList msgs);
+    virtual void receiveBacklogSearch(QString query, QVariantList bufferIds, QDateTime start, QDateTime end, int limit, MsgId last, QVariantList msgs);
 
     void requestInitialBacklog();
 
@@ -56,6 +57,9 @@ signals:
 
     void updateProgress(int, int);
 
+    //! Results of requestBacklogSearch(), newest first. They are not added to the message model.
+    void backlogSearchResults(const QString &query, MsgId last, const MessageList &msgs);
+
 private:
     bool isBuffering();
     BufferIdList filterNewBufferIds(const BufferIdList &bufferIds);
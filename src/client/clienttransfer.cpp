@@ -21,11 +21,17 @@
 #include <QFile>
 
 #include "clienttransfer.h"
+#include "client.h"
+
+const quint32 fetchChunkSize = 256 * 1024;
+const int fetchChunksInFlight = 4;          // keeps the connection busy while we write
 
 INIT_SYNCABLE_OBJECT(ClientTransfer)
 ClientTransfer::ClientTransfer(const QUuid &uuid, QObject *parent)
     : Transfer(uuid, parent),
-    _file(0)
+    _file(0),
+    _received(0),
+    _requested(0)
 {
     connect(this, SIGNAL(stateChanged(State)), SLOT(onStateChanged(State)));
 }
@@ -64,6 +70,68 @@ void ClientTransfer::reject() const
 }
 
 
+void ClientTransfer::acceptOnCore() const
+{
+    PeerPtr ptr = 0;
+    REQUEST_OTHER(requestAcceptedOnCore, ARG(ptr));
+    emit accepted();
+}
+
+
+void ClientTransfer::fetchFromCore(const QString &savePath)
+{
+    if (!storedOnCore() || _file)
+        return;
+
+    _savePath = savePath;
+    _file = new QFile(_savePath, this);
+    if (!_file->open(QFile::WriteOnly|QFile::Truncate)) {
+        qWarning() << Q_FUNC_INFO << "Could not open file:" << _file->errorString();
+        cleanUp();
+        return;
+    }
+
+    _received = 0;
+    _requested = 0;
+    for (int i = 0; i < fetchChunksInFlight; ++i)
+        requestNextChunk();
+}
+
+
+void ClientTransfer::requestNextChunk()
+{
+    if (_requested >= fileSize())
+        return;
+
+    PeerPtr ptr = 0;
+    quint32 size = fetchChunkSize;
+    REQUEST_OTHER(requestFileChunk, ARG(ptr), ARG(_requested), ARG(size));
+    _requested += size;
+}
+
+
+void ClientTransfer::fileChunkReceived(PeerPtr, quint64 offset, const QByteArray &data)
+{
+    // chunks arrive in the order we requested them
+    if (!_file || offset != _received)
+        return;
+
+    if (_file->write(data) != data.size()) {
+        qWarning() << Q_FUNC_INFO << "Could not write to file:" << _file->errorString();
+        cleanUp();
+        return;
+    }
+    _received += data.size();
+
+    if (data.isEmpty() || _received >= fileSize()) {
+        cleanUp();
+        emit fetchFinished();
+        return;
+    }
+    requestNextChunk();
+}
+
+
 void ClientTransfer::dataReceived(PeerPtr, const QByteArray &data)
 {
     // TODO: proper error handling (relay to core)
@@ -82,6 +150,13 @@ void ClientTransfer::dataReceived(PeerPtr, const QByteArray &data)
         qWarning() << Q_FUNC_INFO << "Could not write to file:" << _file->errorString();
         return;
     }
+
+    // let the core know it can send more
+    _received += data.size();
+    if (Client::coreFeatures() & Quassel::TransferFlowControl) {
+        PeerPtr ptr = 0;
+        REQUEST_OTHER(requestDataAcknowledged, ARG(ptr), ARG(_received));
+    }
 }
 
 
@@ -42,16 +42,29 @@ public slots:
     void accept(const QString &savePath) const;
     void reject() const;
 
+    //! Let the core receive the file into its download directory, no client needs to stay connected
+    void acceptOnCore() const;
+
+    //! Download a file the core has stored (see storedOnCore()) to savePath
+    void fetchFromCore(const QString &savePath);
+
+signals:
+    void fetchFinished();
+
 private slots:
     void dataReceived(PeerPtr peer, const QByteArray &data);
+    void fileChunkReceived(PeerPtr peer, quint64 offset, const QByteArray &data);
     void onStateChanged(State state);
 
 private:
     virtual void cleanUp();
+    void requestNextChunk();
 
     mutable QString _savePath;
 
     QFile *_file;
+    quint64 _received;
+    quint64 _requested; // offset of the next chunk to fetch from the core
 };
 
 #endif
@@ -43,9 +43,11 @@ CoreConnection::CoreConnection(QObject *parent)
     _progressMinimum(0),
     _progressMaximum(-1),
     _progressValue(-1),
+    _loginTime(0),
     _resetting(false)
 {
     qRegisterMetaType<ConnectionState>("CoreConnection::ConnectionState");
+    _loginTimer.invalidate();
 }
 
 
@@ -211,6 +213,17 @@ void CoreConnection::onConnectionReady()
 }
 
 
+void CoreConnection::logLoginPhase(const QString &phase)
+{
+    if (!_loginTimer.isValid())
+        return;
+
+    qint64 elapsed = _loginTimer.restart();
+    _loginTime += elapsed;
+    qDebug() << qPrintable(QString("Login: %1 took %2 ms (%3 ms in total)").arg(phase).arg(elapsed).arg(_loginTime));
+}
+
+
 void CoreConnection::setState(ConnectionState state)
 {
     if (state != _state) {
@@ -256,6 +269,11 @@ void CoreConnection::disconnectFromCore(const QString &errorString, bool wantRec
     _wantReconnect = wantReconnect; // store if disconnect was requested
     _wasReconnect = false;
 
+    if (!wantReconnect) {
+        _resumeToken.clear();
+        Client::instance()->endSuspendedSession();
+    }
+
     if (_authHandler)
         _authHandler->close();
     else if(_peer)
@@ -311,6 +329,13 @@ void CoreConnection::resetConnection(bool wantReconnect)
 }
 
 
+bool CoreConnection::canResume() const
+{
+    CoreConnectionSettings s;
+    return !_resumeToken.isEmpty() && _wantReconnect && s.autoReconnect();
+}
+
+
 void CoreConnection::reconnectToCore()
 {
     if (currentAccount().isValid()) {
@@ -354,6 +379,9 @@ bool CoreConnection::connectToCore(AccountId accId)
         }
     }
 
+    if (accId != s.lastAccount())
+        _resumeToken.clear();
+
     s.setLastAccount(accId);
     connectToCurrentAccount();
     return true;
@@ -384,6 +412,8 @@ void CoreConnection::connectToCurrentAccount()
     }
 
     _authHandler = new ClientAuthHandler(currentAccount(), this);
+    if (Client::isSessionSuspended() && !_resumeToken.isEmpty())
+        _authHandler->setResumeRequest(_resumeToken, Client::signalProxy()->receivedMessageCount());
 
     connect(_authHandler, SIGNAL(disconnected()), SLOT(coreSocketDisconnected()));
     connect(_authHandler, SIGNAL(connectionReady()), SLOT(onConnectionReady()));
@@ -409,6 +439,8 @@ void CoreConnection::connectToCurrentAccount()
     connect(_authHandler, SIGNAL(handshakeComplete(RemotePeer*,Protocol::SessionState)), SLOT(onHandshakeComplete(RemotePeer*,Protocol::SessionState)));
 
     setState(Connecting);
+    _loginTimer.start();
+    _loginTime = 0;
     _authHandler->connectToCore();
 }
 
@@ -435,6 +467,7 @@ void CoreConnection::onLoginSuccessful(const CoreAccount &account)
 
     _reconnectTimer.stop();
 
+    logLoginPhase("connecting and authenticating");
     setProgressText(tr("Receiving session state"));
     setState(Synchronizing);
     emit connectionMsg(tr("Synchronizing to %1...").arg(account.accountName()));
@@ -454,8 +487,16 @@ void CoreConnection::onHandshakeComplete(RemotePeer *peer, const Protocol::Sessi
     connect(peer, SIGNAL(statusMessage(QString)), SIGNAL(connectionMsg(QString)));
     connect(peer, SIGNAL(socketError(QAbstractSocket::SocketError,QString)), SLOT(coreSocketError(QAbstractSocket::SocketError,QString)));
 
+    _resumeToken = sessionState.resumeToken;
+    if (!sessionState.resumed) {
+        // The core couldn't resume our previous session, so start over
+        Client::instance()->endSuspendedSession();
+        Client::signalProxy()->resetReceivedMessageCount();
+    }
+
     Client::signalProxy()->addPeer(_peer);  // sigproxy takes ownership of the peer!
 
+    logLoginPhase("receiving the session state");
     syncToCore(sessionState);
 }
 
@@ -466,6 +507,8 @@ void CoreConnection::internalSessionStateReceived(const Protocol::SessionState &
 
     Client::setCoreFeatures(Quassel::features()); // mono connection...
 
+    _loginTimer.start();
+    _loginTime = 0;
     setState(Synchronizing);
     syncToCore(sessionState);
 }
@@ -473,6 +516,13 @@ void CoreConnection::internalSessionStateReceived(const Protocol::SessionState &
 
 void CoreConnection::syncToCore(const Protocol::SessionState &sessionState)
 {
+    if (sessionState.resumed) {
+        // All our objects are still around, and the core replays the messages we missed
+        logLoginPhase("resuming the session");
+        checkSyncState();
+        return;
+    }
+
     setProgressText(tr("Receiving network states"));
     updateProgress(0, 100);
 
@@ -504,6 +554,7 @@ void CoreConnection::syncToCore(const Protocol::SessionState &sessionState)
         connect(net, SIGNAL(destroyed()), SLOT(networkInitDone()));
         Client::addNetwork(net);
     }
+    logLoginPhase("setting up identities, buffers and networks");
     checkSyncState();
 }
 
@@ -524,6 +575,10 @@ void CoreConnection::checkSyncState()
 {
     if (_netsToSync.isEmpty() && state() >= Synchronizing) {
         setState(Synchronized);
+        if (_loginTimer.isValid()) {
+            logLoginPhase(QString("synchronizing %1 network(s)").arg(_numNetsToSync));
+            _loginTimer.invalidate();
+        }
         setProgressText(tr("Synchronized to %1").arg(currentAccount().accountName()));
         setProgressMaximum(-1);
         emit synchronized();
@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include <QElapsedTimer>
 #include <QNetworkConfigurationManager>
 #include <QPointer>
 #include <QTimer>
@@ -75,6 +76,9 @@ public:
 
     QPointer<Peer> peer() { return _peer; }
 
+    //! Whether the session can be resumed after losing the connection, instead of synchronizing from scratch
+    bool canResume() const;
+
 public slots:
     bool connectToCore(AccountId = 0);
     void reconnectToCore();
@@ -140,6 +144,7 @@ private slots:
     void setProgressMaximum(int maximum);
 
     void setState(ConnectionState state);
+    void logLoginPhase(const QString &phase);
 
     void networkDetectionModeChanged(const QVariant &mode);
     void pingTimeoutIntervalChanged(const QVariant &interval);
@@ -162,8 +167,14 @@ private:
     int _progressMinimum, _progressMaximum, _progressValue;
     QString _progressText;
 
+    // for measuring how long the individual phases of a login take
+    QElapsedTimer _loginTimer;
+    qint64 _loginTime;
+
     bool _resetting;
 
+    QByteArray _resumeToken;
+
     CoreAccount _account;
     CoreAccountModel *accountModel() const;
 
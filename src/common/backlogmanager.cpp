@@ -33,3 +33,10 @@ QVariantList BacklogManager::requestBacklogAll(MsgId first, MsgId last, int limi
     REQUEST(ARG(first), ARG(last), ARG(limit), ARG(additional))
     return QVariantList();
 }
+
+
+QVariantList BacklogManager::requestBacklogSearch(QString query, QVariantList bufferIds, QDateTime start, QDateTime end, int limit, MsgId last)
+{
+    REQUEST(ARG(query), ARG(bufferIds), ARG(start), ARG(end), ARG(limit), ARG(last))
+    return QVariantList();
+}
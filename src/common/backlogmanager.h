@@ -21,6 +21,8 @@
 #ifndef BACKLOGMANAGER_H
 #define BACKLOGMANAGER_H
 
+#include <QDateTime>
+
 #include "syncableobject.h"
 #include "types.h"
 
@@ -40,6 +42,19 @@ public slots:
     virtual QVariantList requestBacklogAll(MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
     inline virtual void receiveBacklogAll(MsgId, MsgId, int, int, QVariantList) {};
 
+    //! Search the backlog stored in the core (\sa Quassel::BacklogSearch)
+    /** \param query      The words to search for
+     *  \param bufferIds  The BufferIds to search, or an empty list for all buffers
+     *  \param start      if valid, only return messages sent at or after this time
+     *  \param end        if valid, only return messages sent before this time
+     *  \param limit      if != -1 limit the result to a max of \limit messages
+     *  \param last       if != -1 only return messages with a MsgId < last. To continue a search, pass
+     *                    the oldest MsgId of the previous results.
+     *  \return The matching messages, newest first
+     */
+    virtual QVariantList requestBacklogSearch(QString query, QVariantList bufferIds, QDateTime start, QDateTime end, int limit = -1, MsgId last = -1);
+    inline virtual void receiveBacklogSearch(QString, QVariantList, QDateTime, QDateTime, int, MsgId, QVariantList) {};
+
 signals:
     void backlogRequested(BufferId, MsgId, MsgId, int, int);
     void backlogAllRequested(MsgId, MsgId, int, int);
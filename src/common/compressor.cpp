@@ -37,6 +37,8 @@ Compressor::Compressor(QTcpSocket *socket, Compressor::CompressionLevel level, Q
     : QObject(parent),
     _socket(socket),
     _level(level),
+    _readPos(0),
+    _readScheduled(false),
     _inflater(0),
     _deflater(0)
 {
@@ -113,29 +115,55 @@ bool Compressor::initStreams()
 
 qint64 Compressor::bytesAvailable() const
 {
-    return _readBuffer.size();
+    return _readBuffer.size() - _readPos;
 }
 
 
 qint64 Compressor::read(char *data, qint64 maxSize)
 {
     if (maxSize <= 0)
-        maxSize = _readBuffer.size();
+        maxSize = bytesAvailable();
 
-    qint64 n = qMin(maxSize, (qint64)_readBuffer.size());
-    memcpy(data, _readBuffer.constData(), n);
+    qint64 n = qMin(maxSize, bytesAvailable());
+    memcpy(data, _readBuffer.constData() + _readPos, n);
+    consume(n);
+
+    return n;
+}
+
+
+QByteArray Compressor::read(qint64 size)
+{
+    if (size <= 0 || size > bytesAvailable())
+        return QByteArray();
+
+    QByteArray data = _readBuffer.mid(_readPos, size);
+    consume(size);
+
+    return data;
+}
 
-    // TODO: don't copy for every read
-    if (n == _readBuffer.size())
-        _readBuffer.clear();
-    else
-        _readBuffer = _readBuffer.mid(n);
+
+void Compressor::consume(qint64 size)
+{
+    // Rather than moving the remaining data to the front after every read, we only advance the read position.
+    // The consumed data is dropped once it makes up at least half of the buffer, so every byte is moved
+    // at most once on average, even when a multi-megabyte buffer is read message by message.
+    _readPos += size;
+    if (_readPos == _readBuffer.size()) {
+        _readBuffer.resize(0);
+        _readPos = 0;
+    }
+    else if (_readPos >= _readBuffer.size() / 2) {
+        _readBuffer.remove(0, _readPos);
+        _readPos = 0;
+    }
 
     // If there's still data left in the socket buffer, make sure to schedule a read
-    if (_socket->bytesAvailable())
+    if (!_readScheduled && _socket->bytesAvailable()) {
+        _readScheduled = true;
         QTimer::singleShot(0, this, SLOT(readData()));
-
-    return n;
+    }
 }
 
 
@@ -157,15 +185,17 @@ qint64 Compressor::write(const char *data, qint64 count, WriteBufferHint flush)
 
 void Compressor::readData()
 {
+    _readScheduled = false;
+
     // don't try to read more data if we're already closing
     if (_socket->state() !=  QAbstractSocket::ConnectedState)
         return;
 
-    if (!_socket->bytesAvailable() || _readBuffer.size() >= maxBufferSize)
+    if (!_socket->bytesAvailable() || bytesAvailable() >= maxBufferSize)
         return;
 
     if (compressionLevel() == NoCompression) {
-        _readBuffer.append(_socket->read(maxBufferSize - _readBuffer.size()));
+        _readBuffer.append(_socket->read(maxBufferSize - bytesAvailable()));
         emit readyRead();
         return;
     }
@@ -176,7 +206,7 @@ void Compressor::readData()
     // considering that otherwise (using an intermediate buffer) we'd copy around data for every single message.
     // TODO: Benchmark if it would still make sense to squeeze the buffer from time to time (e.g. after initial sync)!
 
-    while (_socket->bytesAvailable() && _readBuffer.size() + ioBufferSize < maxBufferSize && _inputBuffer.size() < ioBufferSize) {
+    while (_socket->bytesAvailable() && bytesAvailable() + ioBufferSize < maxBufferSize && _inputBuffer.size() < ioBufferSize) {
         _readBuffer.resize(_readBuffer.size() + ioBufferSize);
         _inputBuffer.append(_socket->read(ioBufferSize - _inputBuffer.size()));
 
@@ -62,6 +62,11 @@ public:
     qint64 bytesAvailable() const;
 
     qint64 read(char *data, qint64 maxSize);
+
+    //! Read a block of exactly the given size
+    /** \return The data, or a null QByteArray if not enough data is available yet
+     */
+    QByteArray read(qint64 size);
     qint64 write(const char *data, qint64 count, WriteBufferHint flush = Flush);
 
     void flush();
@@ -76,12 +81,15 @@ private slots:
 private:
     bool initStreams();
     void writeData();
+    void consume(qint64 size);
 
 private:
     QTcpSocket *_socket;
     CompressionLevel _level;
 
     QByteArray _readBuffer;
+    int _readPos; // start of the data in _readBuffer that has not been read yet
+    bool _readScheduled;
     QByteArray _writeBuffer;
 
     QByteArray _inputBuffer;
@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include <QTextCodec>
+#include <QTimer>
 
 #include "network.h"
 
@@ -247,8 +248,12 @@ IrcUser *Network::newIrcUser(const QString &hostmask, const QVariantMap &initDat
 IrcUser *Network::ircUser(QString nickname) const
 {
     nickname = nickname.toLower();
-    if (_ircUsers.contains(nickname))
-        return _ircUsers[nickname];
+    if (_ircUsers.contains(nickname)) {
+        IrcUser *ircuser = _ircUsers[nickname];
+        if (ircuser->hasDeferredInitData())
+            ircuser->applyDeferredInitData();
+        return ircuser;
+    }
     else
         return 0;
 }
@@ -769,13 +774,32 @@ void Network::initSetIrcUsersAndChannels(const QVariantMap &usersAndChannels)
         }
     }
 
+    // In a client, we only set up the IrcUsers with their hostmask for now, which is enough for showing
+    // channels and nick lists. The rest of their state is applied bit by bit afterwards, or as soon as
+    // they're needed, so we don't block the UI for seconds when joined to lots of big channels.
+    bool deferUserData = proxy()->proxyMode() == SignalProxy::Client;
+
     // now create the individual IrcUsers
     for(int i = 0; i < count; i++) {
         QVariantMap map;
         foreach(const QString &key, users.keys())
             map[key] = users[key].toList().at(i);
-        newIrcUser(map["nick"].toString(), map); // newIrcUser() properly handles the hostmask being just the nick
+        if (!deferUserData) {
+            newIrcUser(map["nick"].toString(), map); // newIrcUser() properly handles the hostmask being just the nick
+            continue;
+        }
+
+        QVariantMap hostmask;
+        foreach(const QString &key, QStringList() << "nick" << "user" << "host") {
+            if (map.contains(key))
+                hostmask[key] = map.take(key);
+        }
+        IrcUser *ircuser = newIrcUser(hostmask["nick"].toString(), hostmask);
+        ircuser->setDeferredInitData(map);
+        _deferredIrcUsers << ircuser;
     }
+    if (!_deferredIrcUsers.isEmpty())
+        QTimer::singleShot(0, this, SLOT(applyDeferredIrcUserData()));
 
     // same thing for IrcChannels
     const QVariantMap &channels = usersAndChannels["Channels"].toMap();
@@ -798,6 +822,22 @@ void Network::initSetIrcUsersAndChannels(const QVariantMap &usersAndChannels)
 }
 
 
+void Network::applyDeferredIrcUserData()
+{
+    // Do a limited number of users at a time, so the event loop gets a chance to run in between
+    int count = 0;
+    while (!_deferredIrcUsers.isEmpty() && count < 200) {
+        QPointer<IrcUser> ircuser = _deferredIrcUsers.takeFirst();
+        if (ircuser && ircuser->hasDeferredInitData()) {
+            ircuser->applyDeferredInitData();
+            count++;
+        }
+    }
+    if (!_deferredIrcUsers.isEmpty())
+        QTimer::singleShot(0, this, SLOT(applyDeferredIrcUserData()));
+}
+
+
 void Network::initSetSupports(const QVariantMap &supports)
 {
     QMapIterator<QString, QVariant> iter(supports);
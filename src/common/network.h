@@ -270,6 +270,8 @@ public slots:
     void emitConnectionError(const QString &);
 
 protected slots:
+    void applyDeferredIrcUserData();
+
     virtual void removeIrcUser(IrcUser *ircuser);
     virtual void removeIrcChannel(IrcChannel *ircChannel);
     virtual void removeChansAndUsers();
@@ -337,6 +339,7 @@ private:
     mutable QString _prefixModes;
 
     QHash<QString, IrcUser *> _ircUsers; // stores all known nicks for the server
+    QList<QPointer<IrcUser> > _deferredIrcUsers; // IrcUsers whose init data still needs to be applied
     QHash<QString, IrcChannel *> _ircChannels; // stores all known channels
     QHash<QString, QString> _supports; // stores results from RPL_ISUPPORT
 
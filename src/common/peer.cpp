@@ -23,6 +23,8 @@
 Peer::Peer(AuthHandler *authHandler, QObject *parent)
     : QObject(parent)
     , _authHandler(authHandler)
+    , _features(0)
+    , _resumeCount(0)
 {
 
 }
@@ -27,6 +27,7 @@
 
 #include "authhandler.h"
 #include "protocol.h"
+#include "quassel.h"
 #include "signalproxy.h"
 
 class Peer : public QObject
@@ -50,6 +51,30 @@ public:
 
     virtual int lag() const = 0;
 
+    //! The optional features supported by the other side of this connection
+    inline Quassel::Features features() const { return _features; }
+    inline void setFeatures(Quassel::Features features) { _features = features; }
+
+    //! The connection a reconnecting client wants to continue, as given in its login
+    inline QByteArray resumeToken() const { return _resumeToken; }
+    inline quint64 resumeCount() const { return _resumeCount; }
+    inline void setResumeRequest(const QByteArray &token, quint64 count) { _resumeToken = token; _resumeCount = count; }
+
+    //! Identifies the wire format this peer uses for sigproxy messages
+    /** Most sigproxy messages go out to all peers of a session. Peers returning the same non-empty key
+     *  serialize messages identically, so SignalProxy serializes a message only once for all of them,
+     *  using serialize(), and hands the result to dispatchSerialized(). Peers returning an empty key
+     *  (the default) get their messages through dispatch() instead.
+     */
+    virtual QByteArray serializationKey() const { return QByteArray(); }
+
+    virtual QByteArray serialize(const Protocol::SyncMessage &) const { return QByteArray(); }
+    virtual QByteArray serialize(const Protocol::RpcCall &) const { return QByteArray(); }
+    virtual QByteArray serialize(const Protocol::InitRequest &) const { return QByteArray(); }
+
+    //! Send a message previously serialized by a peer with the same serializationKey()
+    virtual void dispatchSerialized(const QByteArray &) {}
+
 public slots:
     /* Handshake messages */
     virtual void dispatch(const Protocol::RegisterClient &) = 0;
@@ -82,6 +107,9 @@ protected:
 
 private:
     QPointer<AuthHandler> _authHandler;
+    Quassel::Features _features;
+    QByteArray _resumeToken;
+    quint64 _resumeCount;
 };
 
 // We need to special-case Peer* in attached signals/slots, so typedef it for the meta type system
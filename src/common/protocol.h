@@ -57,16 +57,19 @@ struct HandshakeMessage {
 
 struct RegisterClient : public HandshakeMessage
 {
-    inline RegisterClient(const QString &clientVersion, const QString &buildDate, bool sslSupported = false)
+    inline RegisterClient(const QString &clientVersion, const QString &buildDate, bool sslSupported = false, quint32 clientFeatures = 0)
     : clientVersion(clientVersion)
     , buildDate(buildDate)
-    , sslSupported(sslSupported) {}
+    , sslSupported(sslSupported)
+    , clientFeatures(clientFeatures) {}
 
     QString clientVersion;
     QString buildDate;
 
     // this is only used by the LegacyProtocol in compat mode
     bool sslSupported;
+
+    quint32 clientFeatures;
 };
 
 
@@ -128,11 +131,15 @@ struct SetupDone : public HandshakeMessage
 
 struct Login : public HandshakeMessage
 {
-    inline Login(const QString &user, const QString &password)
-    : user(user), password(password) {}
+    inline Login(const QString &user, const QString &password, const QByteArray &resumeToken = QByteArray(), quint64 resumeCount = 0)
+    : user(user), password(password), resumeToken(resumeToken), resumeCount(resumeCount) {}
 
     QString user;
     QString password;
+
+    // only used by clients that want to resume a previous connection (cf. Quassel::ResumableSessions)
+    QByteArray resumeToken;
+    quint64 resumeCount;
 };
 
 
@@ -154,13 +161,18 @@ struct LoginSuccess : public HandshakeMessage
 // TODO: more generic format
 struct SessionState : public HandshakeMessage
 {
-    inline SessionState() {} // needed for QMetaType (for the mono client)
+    inline SessionState() : resumed(false) {} // needed for QMetaType (for the mono client)
     inline SessionState(const QVariantList &identities, const QVariantList &bufferInfos, const QVariantList &networkIds)
-    : identities(identities), bufferInfos(bufferInfos), networkIds(networkIds) {}
+    : identities(identities), bufferInfos(bufferInfos), networkIds(networkIds), resumed(false) {}
 
     QVariantList identities;
     QVariantList bufferInfos;
     QVariantList networkIds;
+
+    // Token for resuming this session later. If resumed is set, the client continues its previous
+    // connection, and the lists above are empty.
+    QByteArray resumeToken;
+    bool resumed;
 };
 
 /*** handled by SignalProxy ***/
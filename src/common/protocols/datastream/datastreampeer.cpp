@@ -86,13 +86,19 @@ void DataStreamPeer::writeMessage(const QVariantMap &handshakeMsg)
 
 
 void DataStreamPeer::writeMessage(const QVariantList &sigProxyMsg)
+{
+    writeMessage(serializeMessage(sigProxyMsg));
+}
+
+
+QByteArray DataStreamPeer::serializeMessage(const QVariantList &sigProxyMsg)
 {
     QByteArray data;
     QDataStream msgStream(&data, QIODevice::WriteOnly);
     msgStream.setVersion(QDataStream::Qt_4_2);
     msgStream << sigProxyMsg;
 
-    writeMessage(data);
+    return data;
 }
 
 
@@ -116,7 +122,7 @@ void DataStreamPeer::handleHandshakeMessage(const QVariantList &mapData)
     }
 
     if (msgType == "ClientInit") {
-        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), false)); // UseSsl obsolete
+        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), false, m["ClientFeatures"].toUInt())); // UseSsl obsolete
     }
 
     else if (msgType == "ClientInitReject") {
@@ -141,7 +147,7 @@ void DataStreamPeer::handleHandshakeMessage(const QVariantList &mapData)
     }
 
     else if (msgType == "ClientLogin") {
-        handle(Login(m["User"].toString(), m["Password"].toString()));
+        handle(Login(m["User"].toString(), m["Password"].toString(), m["ResumeToken"].toByteArray(), m["ResumeCount"].toULongLong()));
     }
 
     else if (msgType == "ClientLoginReject") {
@@ -154,7 +160,10 @@ void DataStreamPeer::handleHandshakeMessage(const QVariantList &mapData)
 
     else if (msgType == "SessionInit") {
         QVariantMap map = m["SessionState"].toMap();
-        handle(SessionState(map["Identities"].toList(), map["BufferInfos"].toList(), map["NetworkIds"].toList()));
+        SessionState sessionState(map["Identities"].toList(), map["BufferInfos"].toList(), map["NetworkIds"].toList());
+        sessionState.resumeToken = map["ResumeToken"].toByteArray();
+        sessionState.resumed = map["Resumed"].toBool();
+        handle(sessionState);
     }
 
     else {
@@ -168,6 +177,7 @@ void DataStreamPeer::dispatch(const RegisterClient &msg) {
     m["MsgType"] = "ClientInit";
     m["ClientVersion"] = msg.clientVersion;
     m["ClientDate"] = msg.buildDate;
+    m["ClientFeatures"] = msg.clientFeatures;
 
     writeMessage(m);
 }
@@ -236,6 +246,10 @@ void DataStreamPeer::dispatch(const Login &msg)
     m["MsgType"] = "ClientLogin";
     m["User"] = msg.user;
     m["Password"] = msg.password;
+    if (!msg.resumeToken.isEmpty()) {
+        m["ResumeToken"] = msg.resumeToken;
+        m["ResumeCount"] = (qulonglong)msg.resumeCount;
+    }
 
     writeMessage(m);
 }
@@ -271,6 +285,10 @@ void DataStreamPeer::dispatch(const SessionState &msg)
     map["BufferInfos"] = msg.bufferInfos;
     map["NetworkIds"] = msg.networkIds;
     map["Identities"] = msg.identities;
+    if (!msg.resumeToken.isEmpty()) {
+        map["ResumeToken"] = msg.resumeToken;
+        map["Resumed"] = msg.resumed;
+    }
     m["SessionState"] = map;
 
     writeMessage(m);
@@ -359,19 +377,19 @@ void DataStreamPeer::handlePackedFunc(const QVariantList &packedFunc)
 
 void DataStreamPeer::dispatch(const Protocol::SyncMessage &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)Sync << msg.className << msg.objectName.toUtf8() << msg.slotName << msg.params);
+    writeMessage(serialize(msg));
 }
 
 
 void DataStreamPeer::dispatch(const Protocol::RpcCall &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params);
+    writeMessage(serialize(msg));
 }
 
 
 void DataStreamPeer::dispatch(const Protocol::InitRequest &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName.toUtf8());
+    writeMessage(serialize(msg));
 }
 
 
@@ -403,3 +421,21 @@ void DataStreamPeer::dispatchPackedFunc(const QVariantList &packedFunc)
 {
     writeMessage(packedFunc);
 }
+
+
+QByteArray DataStreamPeer::serialize(const Protocol::SyncMessage &msg) const
+{
+    return serializeMessage(QVariantList() << (qint16)Sync << msg.className << msg.objectName.toUtf8() << msg.slotName << msg.params);
+}
+
+
+QByteArray DataStreamPeer::serialize(const Protocol::RpcCall &msg) const
+{
+    return serializeMessage(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params);
+}
+
+
+QByteArray DataStreamPeer::serialize(const Protocol::InitRequest &msg) const
+{
+    return serializeMessage(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName.toUtf8());
+}
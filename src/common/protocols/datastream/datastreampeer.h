@@ -48,6 +48,11 @@ public:
     static bool acceptsFeatures(quint16 peerFeatures);
     quint16 enabledFeatures() const;
 
+    QByteArray serializationKey() const { return "DataStream"; }
+    QByteArray serialize(const Protocol::SyncMessage &msg) const;
+    QByteArray serialize(const Protocol::RpcCall &msg) const;
+    QByteArray serialize(const Protocol::InitRequest &msg) const;
+
     void dispatch(const Protocol::RegisterClient &msg);
     void dispatch(const Protocol::ClientDenied &msg);
     void dispatch(const Protocol::ClientRegistered &msg);
@@ -74,6 +79,7 @@ private:
     using RemotePeer::writeMessage;
     void writeMessage(const QVariantMap &handshakeMsg);
     void writeMessage(const QVariantList &sigProxyMsg);
+    static QByteArray serializeMessage(const QVariantList &sigProxyMsg);
     void processMessage(const QByteArray &msg);
 
     void handleHandshakeMessage(const QVariantList &mapData);
@@ -97,6 +97,12 @@ void LegacyPeer::processMessage(const QByteArray &msg)
 
 
 void LegacyPeer::writeMessage(const QVariant &item)
+{
+    writeMessage(serializeMessage(item));
+}
+
+
+QByteArray LegacyPeer::serializeMessage(const QVariant &item) const
 {
     QByteArray block;
     QDataStream out(&block, QIODevice::WriteOnly);
@@ -116,7 +122,7 @@ void LegacyPeer::writeMessage(const QVariant &item)
         out << item;
     }
 
-    writeMessage(block);
+    return block;
 }
 
 
@@ -151,7 +157,7 @@ void LegacyPeer::handleHandshakeMessage(const QVariant &msg)
             socket()->setProperty("UseCompression", true);
         }
 #endif
-        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), m["UseSsl"].toBool()));
+        handle(RegisterClient(m["ClientVersion"].toString(), m["ClientDate"].toString(), m["UseSsl"].toBool(), m["ClientFeatures"].toUInt()));
     }
 
     else if (msgType == "ClientInitReject") {
@@ -187,7 +193,7 @@ void LegacyPeer::handleHandshakeMessage(const QVariant &msg)
     }
 
     else if (msgType == "ClientLogin") {
-        handle(Login(m["User"].toString(), m["Password"].toString()));
+        handle(Login(m["User"].toString(), m["Password"].toString(), m["ResumeToken"].toByteArray(), m["ResumeCount"].toULongLong()));
     }
 
     else if (msgType == "ClientLoginReject") {
@@ -200,7 +206,10 @@ void LegacyPeer::handleHandshakeMessage(const QVariant &msg)
 
     else if (msgType == "SessionInit") {
         QVariantMap map = m["SessionState"].toMap();
-        handle(SessionState(map["Identities"].toList(), map["BufferInfos"].toList(), map["NetworkIds"].toList()));
+        SessionState sessionState(map["Identities"].toList(), map["BufferInfos"].toList(), map["NetworkIds"].toList());
+        sessionState.resumeToken = map["ResumeToken"].toByteArray();
+        sessionState.resumed = map["Resumed"].toBool();
+        handle(sessionState);
     }
 
     else {
@@ -214,6 +223,7 @@ void LegacyPeer::dispatch(const RegisterClient &msg) {
     m["MsgType"] = "ClientInit";
     m["ClientVersion"] = msg.clientVersion;
     m["ClientDate"] = msg.buildDate;
+    m["ClientFeatures"] = msg.clientFeatures;
 
     // FIXME only in compat mode
     m["ProtocolVersion"] = protocolVersion;
@@ -299,6 +309,10 @@ void LegacyPeer::dispatch(const Login &msg)
     m["MsgType"] = "ClientLogin";
     m["User"] = msg.user;
     m["Password"] = msg.password;
+    if (!msg.resumeToken.isEmpty()) {
+        m["ResumeToken"] = msg.resumeToken;
+        m["ResumeCount"] = (qulonglong)msg.resumeCount;
+    }
 
     writeMessage(m);
 }
@@ -334,6 +348,10 @@ void LegacyPeer::dispatch(const SessionState &msg)
     map["BufferInfos"] = msg.bufferInfos;
     map["NetworkIds"] = msg.networkIds;
     map["Identities"] = msg.identities;
+    if (!msg.resumeToken.isEmpty()) {
+        map["ResumeToken"] = msg.resumeToken;
+        map["Resumed"] = msg.resumed;
+    }
     m["SessionState"] = map;
 
     writeMessage(m);
@@ -430,19 +448,19 @@ void LegacyPeer::handlePackedFunc(const QVariant &packedFunc)
 
 void LegacyPeer::dispatch(const Protocol::SyncMessage &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)Sync << msg.className << msg.objectName << msg.slotName << msg.params);
+    writeMessage(serialize(msg));
 }
 
 
 void LegacyPeer::dispatch(const Protocol::RpcCall &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params);
+    writeMessage(serialize(msg));
 }
 
 
 void LegacyPeer::dispatch(const Protocol::InitRequest &msg)
 {
-    dispatchPackedFunc(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName);
+    writeMessage(serialize(msg));
 }
 
 
@@ -477,6 +495,24 @@ void LegacyPeer::dispatchPackedFunc(const QVariantList &packedFunc)
 }
 
 
+QByteArray LegacyPeer::serialize(const Protocol::SyncMessage &msg) const
+{
+    return serializeMessage(QVariant(QVariantList() << (qint16)Sync << msg.className << msg.objectName << msg.slotName << msg.params));
+}
+
+
+QByteArray LegacyPeer::serialize(const Protocol::RpcCall &msg) const
+{
+    return serializeMessage(QVariant(QVariantList() << (qint16)RpcCall << msg.slotName << msg.params));
+}
+
+
+QByteArray LegacyPeer::serialize(const Protocol::InitRequest &msg) const
+{
+    return serializeMessage(QVariant(QVariantList() << (qint16)InitRequest << msg.className << msg.objectName));
+}
+
+
 // Handle the changed format for Network's initData
 // cf. Network::initIrcUsersAndChannels()
 void LegacyPeer::fromLegacyIrcUsersAndChannels(QVariantMap &initData)
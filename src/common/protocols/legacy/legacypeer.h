@@ -44,6 +44,12 @@ public:
 
     void setSignalProxy(SignalProxy *proxy);
 
+    // compressed and uncompressed peers can't share serialized messages
+    QByteArray serializationKey() const { return _useCompression ? "Legacy/Compressed" : "Legacy"; }
+    QByteArray serialize(const Protocol::SyncMessage &msg) const;
+    QByteArray serialize(const Protocol::RpcCall &msg) const;
+    QByteArray serialize(const Protocol::InitRequest &msg) const;
+
     void dispatch(const Protocol::RegisterClient &msg);
     void dispatch(const Protocol::ClientDenied &msg);
     void dispatch(const Protocol::ClientRegistered &msg);
@@ -72,6 +78,7 @@ signals:
 private:
     using RemotePeer::writeMessage;
     void writeMessage(const QVariant &item);
+    QByteArray serializeMessage(const QVariant &item) const;
     void processMessage(const QByteArray &msg);
 
     void handleHandshakeMessage(const QVariant &msg);
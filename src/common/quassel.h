@@ -72,8 +72,12 @@ public:
         SaslExternal = 0x0004,
         HideInactiveNetworks = 0x0008,
         PasswordChange = 0x0010,
+        BacklogSearch = 0x0020,
+        BatchedMessages = 0x0040,
+        ResumableSessions = 0x0080,
+        TransferFlowControl = 0x0100,
 
-        NumFeatures = 0x0010
+        NumFeatures = 0x0100
     };
     Q_DECLARE_FLAGS(Features, Feature);
 
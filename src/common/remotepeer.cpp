@@ -223,9 +223,8 @@ bool RemotePeer::readMessage(QByteArray &msg)
 
     emit transferProgress(_msgSize, _msgSize);
 
-    msg.resize(_msgSize);
-    qint64 bytesRead = _compressor->read(msg.data(), _msgSize);
-    if (bytesRead != _msgSize) {
+    msg = _compressor->read(_msgSize);
+    if ((quint32)msg.size() != _msgSize) {
         close("Premature end of data stream!");
         return false;
     }
@@ -60,6 +60,8 @@ public:
 
     QTcpSocket *socket() const;
 
+    inline void dispatchSerialized(const QByteArray &msg) { writeMessage(msg); }
+
 public slots:
     void close(const QString &reason = QString());
 
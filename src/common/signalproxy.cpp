@@ -19,9 +19,11 @@
  ***************************************************************************/
 
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QHostAddress>
 #include <QMetaMethod>
 #include <QMetaProperty>
+#include <QQueue>
 #include <QThread>
 
 #ifdef HAVE_SSL
@@ -46,6 +48,82 @@ public:
 };
 
 
+// ==================================================
+//  MessageLog
+// ==================================================
+//! The most recent messages sent to a peer, numbered in the order they were sent
+class SignalProxy::MessageLog
+{
+public:
+    MessageLog(const QByteArray &token, Quassel::Features features) : token(token), features(features), count(0) {}
+
+    inline void append(const SyncMessage &msg) { append(Entry(Entry::SyncType, msg.className, msg.objectName, msg.slotName, msg.params)); }
+    inline void append(const RpcCall &msg) { append(Entry(Entry::RpcType, QByteArray(), QString(), msg.slotName, msg.params)); }
+    inline void append(const InitRequest &msg) { append(Entry(Entry::InitRequestType, msg.className, msg.objectName)); }
+    inline void append(const InitData &msg) { append(Entry(Entry::InitDataType, msg.className, msg.objectName, QByteArray(), QVariantList(), msg.initData)); }
+
+    //! Whether all messages following the first received ones are still in the log
+    inline bool covers(quint64 received) const { return received <= count && count - received <= (quint64)entries.count(); }
+
+    //! Send the messages following the first received ones to peer again
+    void replay(Peer *peer, quint64 received) const
+    {
+        for (int i = entries.count() - (int)(count - received); i < entries.count(); ++i) {
+            const Entry &entry = entries.at(i);
+            switch (entry.type) {
+            case Entry::SyncType:
+                peer->dispatch(SyncMessage(entry.className, entry.objectName, entry.slotName, entry.params));
+                break;
+            case Entry::RpcType:
+                peer->dispatch(RpcCall(entry.slotName, entry.params));
+                break;
+            case Entry::InitRequestType:
+                peer->dispatch(InitRequest(entry.className, entry.objectName));
+                break;
+            case Entry::InitDataType:
+                peer->dispatch(InitData(entry.className, entry.objectName, entry.initData));
+                break;
+            }
+        }
+    }
+
+    static const int maxEntries = 20000;
+    static const int maxDetachedSecs = 30*60;
+
+    QByteArray token;
+    Quassel::Features features; // of the peer, as the messages are logged in the format it gets them in
+    quint64 count;
+    QDateTime detachTime;
+
+private:
+    struct Entry
+    {
+        enum Type { SyncType, RpcType, InitRequestType, InitDataType };
+
+        Entry(Type type, const QByteArray &className, const QString &objectName, const QByteArray &slotName = QByteArray(),
+              const QVariantList &params = QVariantList(), const QVariantMap &initData = QVariantMap())
+        : type(type), className(className), objectName(objectName), slotName(slotName), params(params), initData(initData) {}
+
+        Type type;
+        QByteArray className;
+        QString objectName;
+        QByteArray slotName;
+        QVariantList params;
+        QVariantMap initData;
+    };
+
+    void append(const Entry &entry)
+    {
+        entries.enqueue(entry);
+        if (entries.count() > maxEntries)
+            entries.dequeue();
+        count++;
+    }
+
+    QQueue<Entry> entries;
+};
+
+
 // ==================================================
 //  SignalRelay
 // ==================================================
@@ -202,6 +280,9 @@ SignalProxy::~SignalProxy()
     _syncSlave.clear();
 
     removeAllPeers();
+
+    qDeleteAll(_detachedLogs);
+    _detachedLogs.clear();
 }
 
 
@@ -228,6 +309,8 @@ void SignalProxy::init()
     setHeartBeatInterval(30);
     setMaxHeartBeatCount(2);
     _secure = false;
+    _restrictMessageTarget = false;
+    _receivedMessages = 0;
     updateSecureState();
 }
 
@@ -332,6 +415,15 @@ void SignalProxy::removePeer(Peer *peer)
     peer->setSignalProxy(0);
 
     _peers.remove(peer);
+
+    // Keep the peer's message log around, so the client can resume its connection
+    MessageLog *log = _messageLogs.take(peer);
+    if (log) {
+        expireMessageLogs();
+        log->detachTime = QDateTime::currentDateTimeUtc();
+        _detachedLogs.append(log);
+    }
+
     emit peerRemoved(peer);
 
     if (peer->parent() == this)
@@ -350,6 +442,95 @@ void SignalProxy::removePeerBySender()
 }
 
 
+bool SignalProxy::canResume(const QByteArray &token, quint64 count, Quassel::Features features) const
+{
+    if (token.isEmpty())
+        return false;
+
+    foreach (const MessageLog *log, _detachedLogs) {
+        if (log->token == token)
+            return log->features == features && log->covers(count)
+                && log->detachTime.secsTo(QDateTime::currentDateTimeUtc()) < MessageLog::maxDetachedSecs;
+    }
+    // The client may reconnect before we noticed that its previous connection is gone
+    foreach (const MessageLog *log, _messageLogs) {
+        if (log->token == token)
+            return log->features == features && log->covers(count);
+    }
+    return false;
+}
+
+
+void SignalProxy::startMessageLog(Peer *peer, const QByteArray &token, quint64 count)
+{
+    expireMessageLogs();
+
+    MessageLog *log = takeMessageLog(token);
+    if (log && log->features == peer->features() && log->covers(count)) {
+        qDebug() << "Resuming connection, replaying" << log->count - count << "messages";
+        log->replay(peer, count);
+    }
+    else {
+        delete log;
+        log = new MessageLog(token, peer->features());
+    }
+    log->detachTime = QDateTime();
+    delete _messageLogs.take(peer);
+    _messageLogs[peer] = log;
+}
+
+
+SignalProxy::MessageLog *SignalProxy::takeMessageLog(const QByteArray &token)
+{
+    for (int i = 0; i < _detachedLogs.count(); ++i) {
+        if (_detachedLogs.at(i)->token == token)
+            return _detachedLogs.takeAt(i);
+    }
+    QHash<Peer *, MessageLog *>::iterator iter = _messageLogs.begin();
+    while (iter != _messageLogs.end()) {
+        if (iter.value()->token == token) {
+            MessageLog *log = iter.value();
+            _messageLogs.erase(iter);
+            return log;
+        }
+        ++iter;
+    }
+    return 0;
+}
+
+
+// Sets up the targets for restrictTargetFeature(), returns whether there are any
+bool SignalProxy::selectTargetsByFeature(Quassel::Feature feature, bool supported)
+{
+    _restrictedTargets.clear();
+    foreach (Peer *peer, _peers) {
+        if (bool(peer->features() & feature) == supported)
+            _restrictedTargets << peer;
+    }
+    _restrictedLogs.clear();
+    foreach (MessageLog *log, _detachedLogs) {
+        if (bool(log->features & feature) == supported)
+            _restrictedLogs << log;
+    }
+    return !_restrictedTargets.isEmpty() || !_restrictedLogs.isEmpty();
+}
+
+
+void SignalProxy::expireMessageLogs()
+{
+    QDateTime now = QDateTime::currentDateTimeUtc();
+    QList<MessageLog *>::iterator iter = _detachedLogs.begin();
+    while (iter != _detachedLogs.end()) {
+        if ((*iter)->detachTime.secsTo(now) >= MessageLog::maxDetachedSecs) {
+            delete *iter;
+            iter = _detachedLogs.erase(iter);
+        }
+        else
+            ++iter;
+    }
+}
+
+
 void SignalProxy::renameObject(const SyncableObject *obj, const QString &newname, const QString &oldname)
 {
     if (proxyMode() == Client)
@@ -506,11 +687,41 @@ void SignalProxy::stopSynchronize(SyncableObject *obj)
 template<class T>
 void SignalProxy::dispatch(const T &protoMessage)
 {
+    // Messages for everyone are kept for disconnected clients that may resume later
+    foreach (MessageLog *log, _detachedLogs) {
+        if (!_restrictMessageTarget || _restrictedLogs.contains(log))
+            log->append(protoMessage);
+    }
+
+    if (_peers.count() == 1 && !_restrictMessageTarget) {
+        dispatch(*_peers.begin(), protoMessage);
+        return;
+    }
+
+    // Serialize the message once per wire format rather than once per peer
+    QHash<QByteArray, QByteArray> serialized;
     foreach (Peer *peer, _peers) {
-        if (peer->isOpen())
-            peer->dispatch(protoMessage);
-        else
+        if (_restrictMessageTarget && !_restrictedTargets.contains(peer))
+            continue;
+
+        MessageLog *log = _messageLogs.value(peer);
+        if (log)
+            log->append(protoMessage);
+
+        if (!peer->isOpen()) {
             QCoreApplication::postEvent(this, new ::RemovePeerEvent(peer));
+            continue;
+        }
+
+        const QByteArray key = peer->serializationKey();
+        if (key.isEmpty()) {
+            peer->dispatch(protoMessage);
+            continue;
+        }
+        QHash<QByteArray, QByteArray>::const_iterator iter = serialized.constFind(key);
+        if (iter == serialized.constEnd())
+            iter = serialized.insert(key, peer->serialize(protoMessage));
+        peer->dispatchSerialized(iter.value());
     }
 }
 
@@ -518,6 +729,10 @@ void SignalProxy::dispatch(const T &protoMessage)
 template<class T>
 void SignalProxy::dispatch(Peer *peer, const T &protoMessage)
 {
+    MessageLog *log = _messageLogs.value(peer);
+    if (log)
+        log->append(protoMessage);
+
     if (peer && peer->isOpen())
         peer->dispatch(protoMessage);
     else
@@ -527,6 +742,8 @@ void SignalProxy::dispatch(Peer *peer, const T &protoMessage)
 
 void SignalProxy::handle(Peer *peer, const SyncMessage &syncMessage)
 {
+    _receivedMessages++;
+
     if (!_syncSlave.contains(syncMessage.className) || !_syncSlave[syncMessage.className].contains(syncMessage.objectName)) {
         qWarning() << QString("no registered receiver for sync call: %1::%2 (objectName=\"%3\"). Params are:").arg(syncMessage.className, syncMessage.slotName, syncMessage.objectName)
                    << syncMessage.params;
@@ -547,6 +764,9 @@ void SignalProxy::handle(Peer *peer, const SyncMessage &syncMessage)
         return;
     }
 
+    if (receiver->hasDeferredInitData())
+        receiver->applyDeferredInitData();
+
     // We can no longer construct a QVariant from QMetaType::Void
     QVariant returnValue;
     int returnType = eMeta->returnType(slotId);
@@ -564,7 +784,7 @@ void SignalProxy::handle(Peer *peer, const SyncMessage &syncMessage)
         if (eMeta->argTypes(receiverId).count() > 1)
             returnParams << syncMessage.params;
         returnParams << returnValue;
-        peer->dispatch(SyncMessage(syncMessage.className, syncMessage.objectName, eMeta->methodName(receiverId), returnParams));
+        dispatch(peer, SyncMessage(syncMessage.className, syncMessage.objectName, eMeta->methodName(receiverId), returnParams));
     }
 
     // send emit update signal
@@ -574,6 +794,8 @@ void SignalProxy::handle(Peer *peer, const SyncMessage &syncMessage)
 
 void SignalProxy::handle(Peer *peer, const InitRequest &initRequest)
 {
+    _receivedMessages++;
+
    if (!_syncSlave.contains(initRequest.className)) {
         qWarning() << "SignalProxy::handleInitRequest() received initRequest for unregistered Class:"
                    << initRequest.className;
@@ -587,7 +809,7 @@ void SignalProxy::handle(Peer *peer, const InitRequest &initRequest)
     }
 
     SyncableObject *obj = _syncSlave[initRequest.className][initRequest.objectName];
-    peer->dispatch(InitData(initRequest.className, initRequest.objectName, initData(obj)));
+    dispatch(peer, InitData(initRequest.className, initRequest.objectName, initData(obj)));
 }
 
 
@@ -595,6 +817,8 @@ void SignalProxy::handle(Peer *peer, const InitData &initData)
 {
     Q_UNUSED(peer)
 
+    _receivedMessages++;
+
     if (!_syncSlave.contains(initData.className)) {
         qWarning() << "SignalProxy::handleInitData() received initData for unregistered Class:"
                    << initData.className;
@@ -614,6 +838,8 @@ void SignalProxy::handle(Peer *peer, const InitData &initData)
 
 void SignalProxy::handle(Peer *peer, const RpcCall &rpcCall)
 {
+    _receivedMessages++;
+
     QObject *receiver;
     int methodId;
     SlotHash::const_iterator slot = _attachedSlots.constFind(rpcCall.slotName);
@@ -25,6 +25,7 @@
 #include <QSet>
 
 #include "protocol.h"
+#include "quassel.h"
 
 struct QMetaObject;
 class QIODevice;
@@ -78,6 +79,40 @@ public:
     void dumpProxyStats();
     void dumpSyncMap(SyncableObject *object);
     inline int peerCount() const { return _peers.size(); }
+    inline QSet<Peer *> peers() const { return _peers; }
+
+    //! Only send messages to the given peers while calling closure
+    /** Signals emitted and syncs done by closure are dispatched to those of the given peers that are
+     *  still connected to this proxy, instead of to all peers.
+     */
+    template<typename Closure>
+    void restrictTargetPeers(const QSet<Peer *> &peers, Closure closure);
+
+    //! Only send messages to the peers that do (or don't) support feature while calling closure
+    /** Unlike restrictTargetPeers(), this also covers the message logs of disconnected peers that may still
+     *  resume, according to the features of the peer they belong to. closure isn't called at all if there is
+     *  no such peer or log.
+     */
+    template<typename Closure>
+    void restrictTargetFeature(Quassel::Feature feature, bool supported, Closure closure);
+
+    //! Check if a client presenting the given resume token and message count can continue its previous connection
+    /** This is the case if the messages the client has missed since are still available in the message log
+     *  of its previous connection, and the client still has the same features, as they determine the format
+     *  the messages were logged in.
+     */
+    bool canResume(const QByteArray &token, quint64 count, Quassel::Features features) const;
+
+    //! Log the messages sent to peer under the given token, so that its connection can be resumed later
+    /** If the messages following count are still available in an earlier log with the same token, they are
+     *  replayed to peer, and that log is continued. Otherwise, a fresh log is started. Must be called before
+     *  the peer is added to the proxy.
+     */
+    void startMessageLog(Peer *peer, const QByteArray &token, quint64 count);
+
+    //! The number of messages this proxy has received, used by clients for resuming their connection
+    inline quint64 receivedMessageCount() const { return _receivedMessages; }
+    inline void resetReceivedMessageCount() { _receivedMessages = 0; }
 
 public slots:
     void detachObject(QObject *obj);
@@ -108,6 +143,8 @@ private:
     template<class T>
     class PeerMessageEvent;
 
+    class MessageLog;
+
     void init();
     void initServer();
     void initClient();
@@ -122,6 +159,10 @@ private:
     template<class T>
     void dispatch(Peer *peer, const T &protoMessage);
 
+    MessageLog *takeMessageLog(const QByteArray &token);
+    bool selectTargetsByFeature(Quassel::Feature feature, bool supported);
+    void expireMessageLogs();
+
     void handle(Peer *peer, const Protocol::SyncMessage &syncMessage);
     void handle(Peer *peer, const Protocol::RpcCall &rpcCall);
     void handle(Peer *peer, const Protocol::InitRequest &initRequest);
@@ -162,12 +203,56 @@ private:
 
     bool _secure; // determines if all connections are in a secured state (using ssl or internal connections)
 
+    bool _restrictMessageTarget;
+    QSet<Peer *> _restrictedTargets;
+    QSet<MessageLog *> _restrictedLogs;
+
+    // logs of the messages sent to each peer, and those of disconnected peers that may still resume
+    QHash<Peer *, MessageLog *> _messageLogs;
+    QList<MessageLog *> _detachedLogs;
+    quint64 _receivedMessages;
+
     friend class SignalRelay;
     friend class SyncableObject;
     friend class Peer;
 };
 
 
+template<typename Closure>
+void SignalProxy::restrictTargetPeers(const QSet<Peer *> &peers, Closure closure)
+{
+    bool previousRestrict = _restrictMessageTarget;
+    QSet<Peer *> previousTargets = _restrictedTargets;
+    QSet<MessageLog *> previousLogs = _restrictedLogs;
+    _restrictMessageTarget = true;
+    _restrictedTargets = peers;
+    _restrictedLogs.clear();
+
+    closure();
+
+    _restrictMessageTarget = previousRestrict;
+    _restrictedTargets = previousTargets;
+    _restrictedLogs = previousLogs;
+}
+
+
+template<typename Closure>
+void SignalProxy::restrictTargetFeature(Quassel::Feature feature, bool supported, Closure closure)
+{
+    bool previousRestrict = _restrictMessageTarget;
+    QSet<Peer *> previousTargets = _restrictedTargets;
+    QSet<MessageLog *> previousLogs = _restrictedLogs;
+    _restrictMessageTarget = true;
+
+    if (selectTargetsByFeature(feature, supported))
+        closure();
+
+    _restrictMessageTarget = previousRestrict;
+    _restrictedTargets = previousTargets;
+    _restrictedLogs = previousLogs;
+}
+
+
 // ==================================================
 //  ExtendedMetaObject
 // ==================================================
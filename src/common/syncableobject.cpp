@@ -88,6 +88,14 @@ void SyncableObject::setInitialized()
 }
 
 
+void SyncableObject::applyDeferredInitData()
+{
+    QVariantMap properties = _deferredInitData;
+    _deferredInitData.clear();
+    fromVariantMap(properties);
+}
+
+
 QVariantMap SyncableObject::toVariantMap()
 {
     QVariantMap properties;
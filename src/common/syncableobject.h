@@ -76,6 +76,15 @@ public:
 
     virtual bool isInitialized() const;
 
+    //! Keep init data around to be applied later, when the object is actually needed
+    /** This allows for getting a large number of objects up quickly with only the most
+     *  important part of their state. SignalProxy applies the deferred data before delivering
+     *  a sync call to the object, so later updates are never overwritten by stale init data.
+     */
+    inline void setDeferredInitData(const QVariantMap &properties) { _deferredInitData = properties; }
+    inline bool hasDeferredInitData() const { return !_deferredInitData.isEmpty(); }
+    void applyDeferredInitData();
+
     virtual const QMetaObject *syncMetaObject() const { return metaObject(); }
 
     inline void setAllowClientUpdates(bool allow) { _allowClientUpdates = allow; }
@@ -105,6 +114,7 @@ private:
 
     bool _initialized;
     bool _allowClientUpdates;
+    QVariantMap _deferredInitData;
 
     QList<SignalProxy *> _signalProxies;
 
@@ -27,7 +27,8 @@ Transfer::Transfer(const QUuid &uuid, QObject *parent)
     _direction(Receive),
     _port(0),
     _fileSize(0),
-    _uuid(uuid)
+    _uuid(uuid),
+    _storedOnCore(false)
 {
     init();
 }
@@ -41,7 +42,8 @@ Transfer::Transfer(Direction direction, const QString &nick, const QString &file
     _port(port),
     _fileSize(fileSize),
     _nick(nick),
-    _uuid(QUuid::createUuid())
+    _uuid(QUuid::createUuid()),
+    _storedOnCore(false)
 {
     init();
 }
@@ -173,6 +175,22 @@ void Transfer::setNick(const QString &nick)
 }
 
 
+bool Transfer::storedOnCore() const
+{
+    return _storedOnCore;
+}
+
+
+void Transfer::setStoredOnCore(bool storedOnCore)
+{
+    if (_storedOnCore != storedOnCore) {
+        _storedOnCore = storedOnCore;
+        SYNC(ARG(storedOnCore));
+        emit storedOnCoreChanged(storedOnCore);
+    }
+}
+
+
 void Transfer::setError(const QString &errorString)
 {
     qWarning() << Q_FUNC_INFO << errorString;
@@ -40,6 +40,7 @@ class Transfer : public SyncableObject
     Q_PROPERTY(QString fileName READ fileName WRITE setFileName NOTIFY fileNameChanged);
     Q_PROPERTY(quint64 fileSize READ fileSize WRITE setFileSize NOTIFY fileSizeChanged);
     Q_PROPERTY(QString nick READ nick WRITE setNick NOTIFY nickChanged);
+    Q_PROPERTY(bool storedOnCore READ storedOnCore WRITE setStoredOnCore NOTIFY storedOnCoreChanged);
 
 public:
     enum State {
@@ -73,6 +74,9 @@ public:
     quint64 fileSize() const;
     QString nick() const;
 
+    //! Whether the core has received the file into its download directory, so clients can fetch it from there
+    bool storedOnCore() const;
+
 public slots:
     // called on the client side
     virtual void accept(const QString &savePath) const { Q_UNUSED(savePath); }
@@ -81,6 +85,12 @@ public slots:
     // called on the core side through sync calls
     virtual void requestAccepted(PeerPtr peer) { Q_UNUSED(peer); }
     virtual void requestRejected(PeerPtr peer) { Q_UNUSED(peer); }
+    //! The client has written the first pos bytes of a received file (cf. Quassel::TransferFlowControl)
+    virtual void requestDataAcknowledged(PeerPtr peer, quint64 pos) { Q_UNUSED(peer); Q_UNUSED(pos); }
+    //! Accept the transfer into the core's download directory, instead of relaying it to the client
+    virtual void requestAcceptedOnCore(PeerPtr peer) { Q_UNUSED(peer); }
+    //! Ask for size bytes of a file stored on the core, starting at offset; answered with fileChunkReceived()
+    virtual void requestFileChunk(PeerPtr peer, quint64 offset, quint32 size) { Q_UNUSED(peer); Q_UNUSED(offset); Q_UNUSED(size); }
 
 signals:
     void stateChanged(State state);
@@ -90,6 +100,7 @@ signals:
     void fileNameChanged(const QString &fileName);
     void fileSizeChanged(quint64 fileSize);
     void nickChanged(const QString &nick);
+    void storedOnCoreChanged(bool storedOnCore);
 
     void error(const QString &errorString);
 
@@ -99,9 +110,11 @@ signals:
 protected slots:
     void setState(State state);
     void setError(const QString &errorString);
+    void setStoredOnCore(bool storedOnCore);
 
     // called on the client side through sync calls
     virtual void dataReceived(PeerPtr, const QByteArray &data) { Q_UNUSED(data); }
+    virtual void fileChunkReceived(PeerPtr, quint64 offset, const QByteArray &data) { Q_UNUSED(offset); Q_UNUSED(data); }
 
     virtual void cleanUp() = 0;
 
@@ -124,6 +137,7 @@ private:
     quint64 _fileSize;
     QString _nick;
     QUuid _uuid;
+    bool _storedOnCore;
 };
 
 #endif
@@ -0,0 +1,17 @@
+CREATE OR REPLACE FUNCTION backlog_partition_sync() RETURNS trigger AS $$
+BEGIN
+    IF TG_OP = 'INSERT' THEN
+        INSERT INTO backlog_partitioned (messageid, time, bufferid, type, flags, senderid, message, messagetsv)
+        VALUES (NEW.messageid, NEW.time, NEW.bufferid, NEW.type, NEW.flags, NEW.senderid, NEW.message, NEW.messagetsv)
+        ON CONFLICT (messageid) DO NOTHING;
+    ELSIF TG_OP = 'UPDATE' THEN
+        UPDATE backlog_partitioned
+        SET time = NEW.time, bufferid = NEW.bufferid, type = NEW.type, flags = NEW.flags,
+            senderid = NEW.senderid, message = NEW.message, messagetsv = NEW.messagetsv
+        WHERE messageid = OLD.messageid;
+    ELSE
+        DELETE FROM backlog_partitioned WHERE messageid = OLD.messageid;
+    END IF;
+    RETURN NULL;
+END
+$$ LANGUAGE plpgsql
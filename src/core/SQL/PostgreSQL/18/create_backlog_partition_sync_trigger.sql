@@ -0,0 +1,3 @@
+CREATE TRIGGER backlog_partition_sync
+AFTER INSERT OR UPDATE OR DELETE ON backlog
+FOR EACH ROW EXECUTE PROCEDURE backlog_partition_sync()
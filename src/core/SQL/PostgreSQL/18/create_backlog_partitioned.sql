@@ -0,0 +1,11 @@
+CREATE TABLE backlog_partitioned (
+	messageid integer NOT NULL DEFAULT nextval('backlog_messageid_seq'),
+	time timestamp NOT NULL,
+	bufferid integer NOT NULL REFERENCES buffer (bufferid) ON DELETE CASCADE,
+	type integer NOT NULL,
+	flags integer NOT NULL,
+	senderid integer NOT NULL REFERENCES sender (senderid) ON DELETE SET NULL,
+	message TEXT,
+	messagetsv tsvector,
+	PRIMARY KEY (messageid)
+) PARTITION BY RANGE (messageid)
@@ -0,0 +1 @@
+CREATE INDEX backlog_partitioned_bufferid_idx ON backlog_partitioned(bufferid, messageid DESC)
@@ -0,0 +1 @@
+CREATE INDEX backlog_partitioned_messagetsv_idx ON backlog_partitioned USING gin(messagetsv)
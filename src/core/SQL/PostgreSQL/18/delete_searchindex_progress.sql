@@ -0,0 +1 @@
+DELETE FROM coreinfo WHERE key = 'searchindexmsgid'
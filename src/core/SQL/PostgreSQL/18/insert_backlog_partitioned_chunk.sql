@@ -0,0 +1,6 @@
+INSERT INTO backlog_partitioned (messageid, time, bufferid, type, flags, senderid, message, messagetsv)
+SELECT messageid, time, bufferid, type, flags, senderid, message, messagetsv
+FROM backlog
+WHERE messageid > :firstmsg AND messageid <= :lastmsg
+FOR SHARE
+ON CONFLICT (messageid) DO NOTHING
@@ -1,3 +1,3 @@
-INSERT INTO backlog (time, bufferid, type, flags, senderid, message)
-VALUES ($1, $2, $3, $4, $5, $6)
+INSERT INTO backlog (time, bufferid, type, flags, senderid, message, messagetsv)
+VALUES ($1, $2, $3, $4, $5, $6, to_tsvector('simple', $6))
 RETURNING messageid
@@ -0,0 +1,4 @@
+INSERT INTO backlog (messageid, time, bufferid, type, flags, senderid, message, messagetsv)
+SELECT messageid, time, bufferid, type, flags, senderid, message, to_tsvector('simple', message)
+FROM unnest($1::integer[], $2::timestamp[], $3::integer[], $4::integer[], $5::integer[], $6::integer[], $7::text[])
+    AS batch (messageid, time, bufferid, type, flags, senderid, message)
@@ -0,0 +1 @@
+INSERT INTO coreinfo (key, value) VALUES ('migrationmsgid', :msgid)
@@ -0,0 +1 @@
+INSERT INTO coreinfo (key, value) VALUES ('partitionmsgid', :msgid), ('partitionendmsgid', :endmsgid)
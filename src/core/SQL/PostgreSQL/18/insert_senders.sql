@@ -0,0 +1,4 @@
+INSERT INTO sender (sender)
+SELECT DISTINCT unnest($1::text[])
+ON CONFLICT (sender) DO UPDATE SET sender = EXCLUDED.sender
+RETURNING senderid, sender
@@ -0,0 +1,7 @@
+INSERT INTO buffer (bufferid, userid, groupid, networkid, buffername, buffercname, buffertype, lastseenmsgid, markerlinemsgid, key, joined)
+VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+ON CONFLICT (bufferid) DO UPDATE
+SET userid = EXCLUDED.userid, groupid = EXCLUDED.groupid, networkid = EXCLUDED.networkid,
+    buffername = EXCLUDED.buffername, buffercname = EXCLUDED.buffercname, buffertype = EXCLUDED.buffertype,
+    lastseenmsgid = EXCLUDED.lastseenmsgid, markerlinemsgid = EXCLUDED.markerlinemsgid, key = EXCLUDED.key,
+    joined = EXCLUDED.joined
@@ -0,0 +1,12 @@
+INSERT INTO identity (identityid, userid, identityname, realname, awaynick, awaynickenabled, awayreason, awayreasonenabled, autoawayenabled, autoawaytime, autoawayreason, autoawayreasonenabled, detachawayenabled, detachawayreason, detachawayreasonenabled, ident, kickreason, partreason, quitreason, sslcert, sslkey)
+VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+ON CONFLICT (identityid) DO UPDATE
+SET userid = EXCLUDED.userid, identityname = EXCLUDED.identityname, realname = EXCLUDED.realname,
+    awaynick = EXCLUDED.awaynick, awaynickenabled = EXCLUDED.awaynickenabled,
+    awayreason = EXCLUDED.awayreason, awayreasonenabled = EXCLUDED.awayreasonenabled,
+    autoawayenabled = EXCLUDED.autoawayenabled, autoawaytime = EXCLUDED.autoawaytime,
+    autoawayreason = EXCLUDED.autoawayreason, autoawayreasonenabled = EXCLUDED.autoawayreasonenabled,
+    detachawayenabled = EXCLUDED.detachawayenabled, detachawayreason = EXCLUDED.detachawayreason,
+    detachawayreasonenabled = EXCLUDED.detachawayreasonenabled, ident = EXCLUDED.ident,
+    kickreason = EXCLUDED.kickreason, partreason = EXCLUDED.partreason, quitreason = EXCLUDED.quitreason,
+    sslcert = EXCLUDED.sslcert, sslkey = EXCLUDED.sslkey
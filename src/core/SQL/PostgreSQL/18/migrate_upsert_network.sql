@@ -0,0 +1,14 @@
+INSERT INTO network (networkid, userid, networkname, identityid, encodingcodec, decodingcodec, servercodec, userandomserver, perform, useautoidentify, autoidentifyservice, autoidentifypassword, useautoreconnect, autoreconnectinterval, autoreconnectretries, unlimitedconnectretries, rejoinchannels, connected, usermode, awaymessage, attachperform, detachperform, usesasl, saslaccount, saslpassword)
+VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+ON CONFLICT (networkid) DO UPDATE
+SET userid = EXCLUDED.userid, networkname = EXCLUDED.networkname, identityid = EXCLUDED.identityid,
+    encodingcodec = EXCLUDED.encodingcodec, decodingcodec = EXCLUDED.decodingcodec,
+    servercodec = EXCLUDED.servercodec, userandomserver = EXCLUDED.userandomserver,
+    perform = EXCLUDED.perform, useautoidentify = EXCLUDED.useautoidentify,
+    autoidentifyservice = EXCLUDED.autoidentifyservice, autoidentifypassword = EXCLUDED.autoidentifypassword,
+    useautoreconnect = EXCLUDED.useautoreconnect, autoreconnectinterval = EXCLUDED.autoreconnectinterval,
+    autoreconnectretries = EXCLUDED.autoreconnectretries,
+    unlimitedconnectretries = EXCLUDED.unlimitedconnectretries, rejoinchannels = EXCLUDED.rejoinchannels,
+    connected = EXCLUDED.connected, usermode = EXCLUDED.usermode, awaymessage = EXCLUDED.awaymessage,
+    attachperform = EXCLUDED.attachperform, detachperform = EXCLUDED.detachperform,
+    usesasl = EXCLUDED.usesasl, saslaccount = EXCLUDED.saslaccount, saslpassword = EXCLUDED.saslpassword
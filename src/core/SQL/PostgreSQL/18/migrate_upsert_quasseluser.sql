@@ -0,0 +1,4 @@
+INSERT INTO quasseluser (userid, username, password, hashversion)
+VALUES (?, ?, ?, ?)
+ON CONFLICT (userid) DO UPDATE
+SET username = EXCLUDED.username, password = EXCLUDED.password, hashversion = EXCLUDED.hashversion
@@ -0,0 +1,4 @@
+INSERT INTO sender (senderid, sender)
+VALUES (?, ?)
+ON CONFLICT (senderid) DO UPDATE
+SET sender = EXCLUDED.sender
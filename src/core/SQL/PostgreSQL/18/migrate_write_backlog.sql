@@ -0,0 +1,2 @@
+INSERT INTO backlog (messageid, time, bufferid, type, flags, senderid, message, messagetsv)
+VALUES (?, ?, ?, ?, ?, ?, ?, to_tsvector('simple', ?))
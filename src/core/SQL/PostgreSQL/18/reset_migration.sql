@@ -0,0 +1 @@
+TRUNCATE quasseluser, sender CASCADE
@@ -0,0 +1,2 @@
+SELECT greatest(max(messageid), (SELECT last_value FROM backlog_messageid_seq))
+FROM backlog
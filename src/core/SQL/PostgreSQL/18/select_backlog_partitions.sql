@@ -0,0 +1,4 @@
+SELECT c.relname
+FROM pg_inherits
+JOIN pg_class c ON c.oid = pg_inherits.inhrelid
+WHERE pg_inherits.inhparent = CAST(:parent AS regclass)
@@ -0,0 +1 @@
+SELECT value FROM coreinfo WHERE key = 'migrationmsgid'
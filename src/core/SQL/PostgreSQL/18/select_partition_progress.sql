@@ -0,0 +1 @@
+SELECT key, value FROM coreinfo WHERE key IN ('partitionmsgid', 'partitionendmsgid')
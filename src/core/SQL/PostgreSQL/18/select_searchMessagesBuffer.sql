@@ -0,0 +1,10 @@
+SELECT messageid, bufferid, time, type, flags, sender, message
+FROM backlog
+LEFT JOIN sender ON backlog.senderid = sender.senderid
+WHERE messagetsv @@ plainto_tsquery('simple', $1)
+    AND bufferid = $2
+    AND ($3::integer IS NULL OR messageid < $3)
+    AND ($4::timestamp IS NULL OR time >= $4)
+    AND ($5::timestamp IS NULL OR time < $5)
+ORDER BY messageid DESC
+LIMIT $6
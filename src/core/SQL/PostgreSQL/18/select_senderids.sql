@@ -0,0 +1,3 @@
+SELECT senderid, sender
+FROM sender
+WHERE sender = ANY($1::text[])
@@ -0,0 +1 @@
+CREATE INDEX backlog_messagetsv_idx ON backlog USING gin(messagetsv)
@@ -0,0 +1,4 @@
+UPDATE buffer
+SET lastseenmsgid = batch.msgid
+FROM unnest($2::integer[], $3::integer[]) AS batch(bufferid, msgid)
+WHERE buffer.userid = $1 AND buffer.bufferid = batch.bufferid
@@ -0,0 +1,2 @@
+UPDATE backlog SET messagetsv = to_tsvector('simple', message)
+WHERE messageid > :firstmsg AND messageid <= :lastmsg
@@ -0,0 +1,2 @@
+ALTER TABLE backlog
+ADD COLUMN messagetsv tsvector
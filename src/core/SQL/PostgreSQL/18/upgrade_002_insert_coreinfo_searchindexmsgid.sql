@@ -0,0 +1,2 @@
+INSERT INTO coreinfo (key, value)
+SELECT 'searchindexmsgid', CAST(COALESCE(MAX(messageid), 0) AS text) FROM backlog
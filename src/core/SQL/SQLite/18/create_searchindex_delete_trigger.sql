@@ -0,0 +1,5 @@
+CREATE TRIGGER backlog_fts_delete AFTER DELETE ON backlog
+WHEN old.messageid > COALESCE((SELECT CAST(value AS INTEGER) FROM coreinfo WHERE key = 'searchindexmsgid'), 0)
+BEGIN
+	INSERT INTO backlog_fts (backlog_fts, rowid, message) VALUES ('delete', old.messageid, old.message);
+END
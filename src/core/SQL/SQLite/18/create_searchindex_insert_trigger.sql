@@ -0,0 +1,3 @@
+CREATE TRIGGER backlog_fts_insert AFTER INSERT ON backlog BEGIN
+	INSERT INTO backlog_fts (rowid, message) VALUES (new.messageid, new.message);
+END
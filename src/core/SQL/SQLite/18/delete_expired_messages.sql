@@ -0,0 +1,7 @@
+DELETE FROM backlog
+WHERE messageid IN (SELECT messageid
+                    FROM backlog
+                    WHERE bufferid = :bufferid
+                        AND messageid < :before
+                    ORDER BY messageid ASC
+                    LIMIT :limit)
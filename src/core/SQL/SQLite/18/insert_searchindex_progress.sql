@@ -0,0 +1,2 @@
+INSERT INTO coreinfo (key, value)
+SELECT 'searchindexmsgid', COALESCE(MAX(messageid), 0) FROM backlog
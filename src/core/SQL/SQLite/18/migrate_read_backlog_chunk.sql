@@ -0,0 +1,5 @@
+SELECT messageid, time, bufferid, type, flags, senderid, message
+FROM backlog
+WHERE messageid > :after
+ORDER BY messageid ASC
+LIMIT :limit
@@ -0,0 +1,2 @@
+SELECT bufferid, networkid, buffertype, groupid, buffername
+FROM buffer
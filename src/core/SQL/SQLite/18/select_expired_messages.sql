@@ -0,0 +1,7 @@
+SELECT messageid, time, type, flags, sender, message
+FROM backlog
+JOIN sender ON backlog.senderid = sender.senderid
+WHERE bufferid = :bufferid
+    AND backlog.messageid < :before
+ORDER BY messageid ASC
+LIMIT :limit
@@ -0,0 +1,3 @@
+SELECT coalesce(min(CASE WHEN time >= :keepsince THEN messageid END), max(messageid) + 1)
+FROM backlog
+WHERE bufferid = :bufferid
@@ -0,0 +1,11 @@
+SELECT backlog.messageid, backlog.bufferid, backlog.time, backlog.type, backlog.flags, sender.sender, backlog.message
+FROM backlog_fts
+JOIN backlog ON backlog.messageid = backlog_fts.rowid
+JOIN sender ON backlog.senderid = sender.senderid
+WHERE backlog_fts MATCH :query
+    AND backlog.bufferid = :bufferid
+    AND backlog.messageid < :lastmsg
+    AND backlog.time >= :starttime
+    AND backlog.time < :endtime
+ORDER BY backlog.messageid DESC
+LIMIT :limit
@@ -0,0 +1,10 @@
+SELECT messageid, bufferid, time, type, flags, sender, message
+FROM backlog
+JOIN sender ON backlog.senderid = sender.senderid
+WHERE backlog.message LIKE :query ESCAPE '\'
+    AND backlog.bufferid IN (SELECT bufferid FROM buffer WHERE userid = :userid)
+    AND backlog.messageid < :lastmsg
+    AND backlog.time >= :starttime
+    AND backlog.time < :endtime
+ORDER BY messageid DESC
+LIMIT :limit
@@ -0,0 +1,3 @@
+INSERT INTO backlog_fts (rowid, message)
+SELECT messageid, message FROM backlog
+WHERE messageid > :firstmsg AND messageid <= :lastmsg
@@ -0,0 +1 @@
+UPDATE coreinfo SET value = :msgid WHERE key = 'searchindexmsgid'
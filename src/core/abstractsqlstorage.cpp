@@ -23,11 +23,15 @@
 
 #include "logger.h"
 
+#include <QElapsedTimer>
 #include <QMutexLocker>
+#include <QQueue>
 #include <QSqlDriver>
 #include <QSqlError>
 #include <QSqlField>
 #include <QSqlQuery>
+#include <QThread>
+#include <QWaitCondition>
 
 int AbstractSqlStorage::_nextConnectionId = 0;
 AbstractSqlStorage::AbstractSqlStorage(QObject *parent)
@@ -42,6 +46,7 @@ AbstractSqlStorage::~AbstractSqlStorage()
     // disconnect the connections, so their deletion is no longer interessting for us
     QHash<QThread *, Connection *>::iterator conIter;
     for (conIter = _connectionPool.begin(); conIter != _connectionPool.end(); ++conIter) {
+        conIter.value()->clearQueryCache();
         QSqlDatabase::removeDatabase(conIter.value()->name());
         disconnect(conIter.value(), 0, this, 0);
     }
@@ -57,6 +62,8 @@ QSqlDatabase AbstractSqlStorage::logDb()
 
     if (!db.isOpen()) {
         qWarning() << "Database connection" << displayName() << "for thread" << QThread::currentThread() << "was lost, attempting to reconnect...";
+        // prepared statements don't survive the connection
+        _connectionPool[QThread::currentThread()]->clearQueryCache();
         dbConnect(db);
     }
 
@@ -64,6 +71,22 @@ QSqlDatabase AbstractSqlStorage::logDb()
 }
 
 
+void AbstractSqlStorage::releaseConnection()
+{
+    Connection *connection = 0;
+    {
+        QMutexLocker locker(&_connectionPoolMutex);
+        connection = _connectionPool.take(QThread::currentThread());
+    }
+    if (!connection)
+        return;
+
+    // the pool entry is gone already, and connectionDestroyed() couldn't resolve the thread of a deleted sender anyway
+    disconnect(connection, SIGNAL(destroyed()), this, SLOT(connectionDestroyed()));
+    delete connection;
+}
+
+
 void AbstractSqlStorage::addConnectionToPool()
 {
     QMutexLocker locker(&_connectionPoolMutex);
@@ -122,6 +145,11 @@ Storage::State AbstractSqlStorage::init(const QVariantMap &settings)
 
     _debug = Quassel::isOptionSet("debug");
 
+    {
+        QMutexLocker locker(&_queryRegistryMutex);
+        loadQueries(schemaVersion());
+    }
+
     QSqlDatabase db = logDb();
     if (!db.isValid() || !db.isOpen())
         return NotAvailable;
@@ -144,6 +172,9 @@ Storage::State AbstractSqlStorage::init(const QVariantMap &settings)
         }
     }
 
+    if (initSearchIndex() && !buildSearchIndex())
+        qWarning() << qPrintable(tr("Building the backlog search index failed, it will be continued on the next start."));
+
     quInfo() << qPrintable(displayName()) << "Storage Backend is ready. Quassel Schema Version:" << installedSchemaVersion();
     return IsReady;
 }
@@ -154,19 +185,95 @@ QString AbstractSqlStorage::queryString(const QString &queryName, int version)
     if (version == 0)
         version = schemaVersion();
 
-    QFileInfo queryInfo(QString(":/SQL/%1/%2/%3.sql").arg(displayName()).arg(version).arg(queryName));
-    if (!queryInfo.exists() || !queryInfo.isFile() || !queryInfo.isReadable()) {
+    QMutexLocker locker(&_queryRegistryMutex);
+    if (!_queryRegistry.contains(version))
+        loadQueries(version);
+
+    const QHash<QString, QString> &queries = _queryRegistry[version];
+    QHash<QString, QString>::const_iterator iter = queries.constFind(queryName);
+    if (iter == queries.constEnd()) {
         qCritical() << "Unable to read SQL-Query" << queryName << "for engine" << displayName();
         return QString();
     }
+    return iter.value();
+}
+
+
+// Reads all query texts of a schema version into the registry. The caller must hold _queryRegistryMutex.
+void AbstractSqlStorage::loadQueries(int version)
+{
+    QHash<QString, QString> &queries = _queryRegistry[version];
+    if (!queries.isEmpty())
+        return;
+
+    QDir dir = QDir(QString(":/SQL/%1/%2/").arg(displayName()).arg(version));
+    foreach(QFileInfo queryInfo, dir.entryInfoList(QStringList() << "*.sql", QDir::Files | QDir::Readable)) {
+        QFile queryFile(queryInfo.filePath());
+        if (!queryFile.open(QIODevice::ReadOnly | QIODevice::Text))
+            continue;
+        queries[queryInfo.baseName()] = QTextStream(&queryFile).readAll().trimmed();
+        queryFile.close();
+    }
+}
+
+
+QSqlQuery AbstractSqlStorage::cachedQuery(const QString &queryName, QSqlDatabase &db)
+{
+    Connection *connection = currentConnection();
+    Q_ASSERT(connection);
+
+    QHash<QString, QSqlQuery>::iterator iter = connection->queryCache().find(queryName);
+    if (iter != connection->queryCache().end()) {
+        iter.value().finish();
+        return iter.value();
+    }
+
+    QSqlQuery query(db);
+    if (query.prepare(queryString(queryName))) {
+        connection->countPrepare();
+        connection->queryCache()[queryName] = query;
+    }
+    return query;
+}
 
-    QFile queryFile(queryInfo.filePath());
-    if (!queryFile.open(QIODevice::ReadOnly | QIODevice::Text))
-        return QString();
-    QString query = QTextStream(&queryFile).readAll();
-    queryFile.close();
 
-    return query.trimmed();
+bool AbstractSqlStorage::isPreparedStatement(const QString &queryName) const
+{
+    Connection *connection = currentConnection();
+    return connection && connection->preparedStatements().contains(queryName);
+}
+
+
+void AbstractSqlStorage::setPreparedStatement(const QString &queryName, bool prepared)
+{
+    Connection *connection = currentConnection();
+    if (!connection)
+        return;
+
+    if (prepared)
+        connection->preparedStatements() << queryName;
+    else
+        connection->preparedStatements().remove(queryName);
+}
+
+
+void AbstractSqlStorage::queryPrepared()
+{
+    Connection *connection = currentConnection();
+    if (connection)
+        connection->countPrepare();
+}
+
+
+void AbstractSqlStorage::queryExecuted()
+{
+    Connection *connection = currentConnection();
+    if (!connection)
+        return;
+
+    connection->countExec();
+    if (_debug && connection->execCount() % 10000 == 0)
+        qDebug() << "Database connection" << connection->name() << "prepared" << connection->prepareCount() << "statements for" << connection->execCount() << "queries";
 }
 
 
@@ -239,6 +346,62 @@ bool AbstractSqlStorage::upgradeDb()
 }
 
 
+bool AbstractSqlStorage::buildSearchIndex()
+{
+    QSqlDatabase db = logDb();
+
+    // the stored msgid is the newest message that still has to be indexed
+    QSqlQuery progressQuery(db);
+    progressQuery.prepare(queryString("select_searchindex_progress"));
+    progressQuery.exec();
+    if (!watchQuery(progressQuery))
+        return false;
+    if (!progressQuery.first())
+        return true; // nothing left to do
+
+    int lastMsgId = progressQuery.value(0).toInt();
+    progressQuery.finish();
+    const int totalMsgIds = lastMsgId;
+    if (lastMsgId > 0)
+        quInfo() << qPrintable(tr("Building the backlog search index, this may take a while..."));
+
+    int batches = 0;
+    while (lastMsgId > 0) {
+        int firstMsgId = qMax(0, lastMsgId - _searchIndexBatchSize);
+
+        db.transaction();
+        QSqlQuery batchQuery(db);
+        batchQuery.prepare(queryString("update_searchindex"));
+        batchQuery.bindValue(":firstmsg", firstMsgId);
+        batchQuery.bindValue(":lastmsg", lastMsgId);
+        batchQuery.exec();
+        if (!watchQuery(batchQuery)) {
+            db.rollback();
+            return false;
+        }
+
+        QSqlQuery updateProgressQuery(db);
+        updateProgressQuery.prepare(queryString("update_searchindex_progress"));
+        updateProgressQuery.bindValue(":msgid", QString::number(firstMsgId));
+        updateProgressQuery.exec();
+        if (!watchQuery(updateProgressQuery)) {
+            db.rollback();
+            return false;
+        }
+        db.commit();
+
+        lastMsgId = firstMsgId;
+        if (++batches % 20 == 0)
+            quInfo() << qPrintable(tr("Backlog search index: %1% done").arg(100 - (100 * (qint64)lastMsgId / totalMsgIds)));
+    }
+
+    QSqlQuery doneQuery(db);
+    doneQuery.prepare(queryString("delete_searchindex_progress"));
+    doneQuery.exec();
+    return watchQuery(doneQuery);
+}
+
+
 int AbstractSqlStorage::schemaVersion()
 {
     // returns the newest Schema Version!
@@ -325,13 +488,19 @@ void AbstractSqlStorage::connectionDestroyed()
 // ========================================
 AbstractSqlStorage::Connection::Connection(const QString &name, QObject *parent)
     : QObject(parent),
-    _name(name.toLatin1())
+    _name(name.toLatin1()),
+    _prepareCount(0),
+    _execCount(0)
 {
 }
 
 
 AbstractSqlStorage::Connection::~Connection()
 {
+    if (Quassel::isOptionSet("debug"))
+        qDebug() << "Database connection" << name() << "prepared" << _prepareCount << "statements for" << _execCount << "queries";
+
+    clearQueryCache();
     {
         QSqlDatabase db = QSqlDatabase::database(name(), false);
         if (db.isOpen()) {
@@ -343,6 +512,13 @@ AbstractSqlStorage::Connection::~Connection()
 }
 
 
+void AbstractSqlStorage::Connection::clearQueryCache()
+{
+    _queryCache.clear();
+    _preparedStatements.clear();
+}
+
+
 // ========================================
 //  AbstractSqlMigrator
 // ========================================
@@ -440,58 +616,104 @@ AbstractSqlMigrationReader::AbstractSqlMigrationReader()
 
 bool AbstractSqlMigrationReader::migrateTo(AbstractSqlMigrationWriter *writer)
 {
-    if (!transaction()) {
-        qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start reader's transaction!";
-        return false;
-    }
-    if (!writer->transaction()) {
-        qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start writer's transaction!";
-        rollback(); // close the reader transaction;
-        return false;
+    _writer = writer;
+
+    int progress = _writer->migrationProgress();
+    if (progress >= 0) {
+        // The current backend stayed in use since the migration was interrupted, so everything but the
+        // backlog is brought up to date before the backlog transfer continues
+        if (!_writer->supportsResync() || !resyncMigration()) {
+            qWarning() << "Unable to update the data migrated so far, starting over...";
+            _writer = writer;
+            if (!_writer->transaction()) {
+                qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start writer's transaction!";
+                return false;
+            }
+            if (!_writer->resetMigration() || !_writer->clearMigrationProgress() || !_writer->commit()) {
+                qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to reset the interrupted migration!";
+                _writer->rollback();
+                return false;
+            }
+            progress = -1;
+        }
+        else {
+            qDebug() << qPrintable(QString("Resuming the migration after message %1...").arg(progress));
+        }
     }
 
-    _writer = writer;
+    if (progress < 0) {
+        if (!transaction()) {
+            qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start reader's transaction!";
+            return false;
+        }
+        if (!writer->transaction()) {
+            qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start writer's transaction!";
+            rollback(); // close the reader transaction;
+            return false;
+        }
 
-    // due to the incompatibility across Migration objects we can't run this in a loop... :/
-    QuasselUserMO quasselUserMo;
-    if (!transferMo(QuasselUser, quasselUserMo))
-        return false;
+        // due to the incompatibility across Migration objects we can't run this in a loop... :/
+        QuasselUserMO quasselUserMo;
+        if (!transferMo(QuasselUser, quasselUserMo))
+            return false;
 
-    IdentityMO identityMo;
-    if (!transferMo(Identity, identityMo))
-        return false;
+        IdentityMO identityMo;
+        if (!transferMo(Identity, identityMo))
+            return false;
 
-    IdentityNickMO identityNickMo;
-    if (!transferMo(IdentityNick, identityNickMo))
-        return false;
+        IdentityNickMO identityNickMo;
+        if (!transferMo(IdentityNick, identityNickMo))
+            return false;
 
-    NetworkMO networkMo;
-    if (!transferMo(Network, networkMo))
-        return false;
+        NetworkMO networkMo;
+        if (!transferMo(Network, networkMo))
+            return false;
 
-    BufferMO bufferMo;
-    if (!transferMo(Buffer, bufferMo))
-        return false;
+        BufferMO bufferMo;
+        if (!transferMo(Buffer, bufferMo))
+            return false;
 
-    SenderMO senderMo;
-    if (!transferMo(Sender, senderMo))
-        return false;
+        SenderMO senderMo;
+        if (!transferMo(Sender, senderMo))
+            return false;
 
-    BacklogMO backlogMo;
-    if (!transferMo(Backlog, backlogMo))
-        return false;
+        IrcServerMO ircServerMo;
+        if (!transferMo(IrcServer, ircServerMo))
+            return false;
 
-    IrcServerMO ircServerMo;
-    if (!transferMo(IrcServer, ircServerMo))
-        return false;
+        UserSettingMO userSettingMo;
+        if (!transferMo(UserSetting, userSettingMo))
+            return false;
 
-    UserSettingMO userSettingMo;
-    if (!transferMo(UserSetting, userSettingMo))
+        // everything but the backlog is in place now, and we can start over from here
+        progress = 0;
+        if (!_writer->setMigrationProgress(progress)) {
+            abortMigration("AbstractSqlMigrationReader::migrateTo(): unable to store the migration progress!");
+            return false;
+        }
+        if (!finalizeMigration())
+            return false;
+        _writer = writer;
+    }
+
+    // The backlog is by far the largest part, so it's committed in chunks as it goes
+    if (!transferBacklog(progress))
         return false;
 
-    if (!_writer->postProcess())
-        abortMigration();
-    return finalizeMigration();
+    if (!writer->transaction()) {
+        qWarning() << "AbstractSqlMigrationReader::migrateTo(): unable to start writer's transaction!";
+        return false;
+    }
+    if (!_writer->postProcess() || !_writer->clearMigrationProgress()) {
+        _writer->rollback();
+        _writer = 0;
+        return false;
+    }
+    resetQuery();
+    _writer->resetQuery();
+    bool success = _writer->commit();
+    _writer = 0;
+    return success;
 }
 
 
@@ -532,6 +754,120 @@ bool AbstractSqlMigrationReader::finalizeMigration()
 }
 
 
+// Transfers everything but the backlog again, on top of what an interrupted migration left behind
+bool AbstractSqlMigrationReader::resyncMigration()
+{
+    AbstractSqlMigrationWriter *writer = _writer;
+    if (!transaction()) {
+        qWarning() << "AbstractSqlMigrationReader::resyncMigration(): unable to start reader's transaction!";
+        return false;
+    }
+    if (!writer->transaction()) {
+        qWarning() << "AbstractSqlMigrationReader::resyncMigration(): unable to start writer's transaction!";
+        rollback();
+        return false;
+    }
+
+    writer->setResyncing(true);
+    bool success = resyncMos() && finalizeMigration();
+    writer->setResyncing(false);
+    _writer = writer;
+    return success;
+}
+
+
+/* Objects that others depend on are updated in place, after deleting those that are gone from the source
+ * (and with them, whatever depends on them, e.g. the backlog of a removed buffer). Senders only ever get
+ * added. The remaining objects are simply deleted and written again.
+ */
+bool AbstractSqlMigrationReader::resyncMos()
+{
+    QuasselUserMO quasselUserMo;
+    if (!resyncMo(QuasselUser, quasselUserMo))
+        return false;
+
+    IdentityMO identityMo;
+    if (!resyncMo(Identity, identityMo))
+        return false;
+
+    IdentityNickMO identityNickMo;
+    if (!_writer->removeStaleMos(IdentityNick, QVariantList()) || !transferMo(IdentityNick, identityNickMo))
+        return false;
+
+    NetworkMO networkMo;
+    if (!resyncMo(Network, networkMo))
+        return false;
+
+    BufferMO bufferMo;
+    if (!resyncMo(Buffer, bufferMo))
+        return false;
+
+    SenderMO senderMo;
+    if (!transferMo(Sender, senderMo))
+        return false;
+
+    IrcServerMO ircServerMo;
+    if (!_writer->removeStaleMos(IrcServer, QVariantList()) || !transferMo(IrcServer, ircServerMo))
+        return false;
+
+    UserSettingMO userSettingMo;
+    if (!_writer->removeStaleMos(UserSetting, QVariantList()) || !transferMo(UserSetting, userSettingMo))
+        return false;
+
+    return true;
+}
+
+
+namespace {
+
+inline int migrationObjectId(const AbstractSqlMigrator::QuasselUserMO &mo) { return mo.id.toInt(); }
+inline int migrationObjectId(const AbstractSqlMigrator::IdentityMO &mo) { return mo.id.toInt(); }
+inline int migrationObjectId(const AbstractSqlMigrator::NetworkMO &mo) { return mo.networkid.toInt(); }
+inline int migrationObjectId(const AbstractSqlMigrator::BufferMO &mo) { return mo.bufferid.toInt(); }
+
+}
+
+
+template<typename T>
+bool AbstractSqlMigrationReader::resyncMo(MigrationObject moType, T &mo)
+{
+    resetQuery();
+    _writer->resetQuery();
+
+    if (!prepareQuery(moType)) {
+        abortMigration(QString("AbstractSqlMigrationReader::resyncMo(): unable to prepare reader query of type %1!").arg(AbstractSqlMigrator::migrationObject(moType)));
+        return false;
+    }
+
+    qDebug() << qPrintable(QString("Updating %1...").arg(AbstractSqlMigrator::migrationObject(moType)));
+    // these are few enough to keep them in memory while the stale ones are deleted
+    QList<T> mos;
+    QVariantList ids;
+    while (readMo(mo)) {
+        mos << mo;
+        ids << migrationObjectId(mo);
+    }
+
+    if (!_writer->removeStaleMos(moType, ids)) {
+        abortMigration(QString("AbstractSqlMigrationReader::resyncMo(): unable to remove stale Migratable Objects of type %1!").arg(AbstractSqlMigrator::migrationObject(moType)));
+        return false;
+    }
+    if (!_writer->prepareQuery(moType)) {
+        abortMigration(QString("AbstractSqlMigrationReader::resyncMo(): unable to prepare writer query of type %1!").arg(AbstractSqlMigrator::migrationObject(moType)));
+        return false;
+    }
+    foreach(const T &resyncedMo, mos) {
+        if (!_writer->writeMo(resyncedMo)) {
+            abortMigration(QString("AbstractSqlMigrationReader::resyncMo(): unable to update Migratable Object of type %1!").arg(AbstractSqlMigrator::migrationObject(moType)));
+            return false;
+        }
+    }
+
+    qDebug() << "Done.";
+    return true;
+}
+
+
 template<typename T>
 bool AbstractSqlMigrationReader::transferMo(MigrationObject moType, T &mo)
 {
@@ -571,3 +907,157 @@ bool AbstractSqlMigrationReader::transferMo(MigrationObject moType, T &mo)
     qDebug() << "Done.";
     return true;
 }
+
+
+namespace {
+
+// Reads the backlog ahead on its own thread, so reading from one database overlaps with writing to the other
+class BacklogChunkReader : public QThread
+{
+public:
+    BacklogChunkReader(AbstractSqlMigrationReader *reader, const MsgId &after, int chunkSize, int maxQueued)
+        : _reader(reader), _after(after), _chunkSize(chunkSize), _maxQueued(maxQueued), _done(false), _failed(false), _aborted(false) {}
+
+    // Blocks until the next chunk is available. Returns false once all chunks have been taken or reading failed.
+    bool takeChunk(QList<AbstractSqlMigrator::BacklogMO> &chunk)
+    {
+        QMutexLocker locker(&_mutex);
+        while (_chunks.isEmpty() && !_done)
+            _chunkAvailable.wait(&_mutex);
+        if (_chunks.isEmpty())
+            return false;
+        chunk = _chunks.dequeue();
+        _spaceAvailable.wakeOne();
+        return true;
+    }
+
+    void abort()
+    {
+        QMutexLocker locker(&_mutex);
+        _aborted = true;
+        _spaceAvailable.wakeOne();
+    }
+
+    bool failed()
+    {
+        QMutexLocker locker(&_mutex);
+        return _failed;
+    }
+
+protected:
+    void run()
+    {
+        forever {
+            QList<AbstractSqlMigrator::BacklogMO> chunk;
+            bool ok = _reader->readBacklogChunk(_after, _chunkSize, chunk);
+
+            QMutexLocker locker(&_mutex);
+            if (!ok || chunk.isEmpty()) {
+                _failed = !ok;
+                break;
+            }
+            while (_chunks.count() >= _maxQueued && !_aborted)
+                _spaceAvailable.wait(&_mutex);
+            if (_aborted)
+                break;
+            _after = chunk.last().messageid;
+            _chunks.enqueue(chunk);
+            _chunkAvailable.wakeOne();
+        }
+        _reader->backlogReaderFinished();
+
+        QMutexLocker locker(&_mutex);
+        _done = true;
+        _chunkAvailable.wakeOne();
+    }
+
+private:
+    AbstractSqlMigrationReader *_reader;
+    MsgId _after;
+    const int _chunkSize;
+    const int _maxQueued;
+
+    QMutex _mutex;
+    QWaitCondition _chunkAvailable;
+    QWaitCondition _spaceAvailable;
+    QQueue<QList<AbstractSqlMigrator::BacklogMO> > _chunks;
+    bool _done;
+    bool _failed;
+    bool _aborted;
+};
+
+}
+
+
+bool AbstractSqlMigrationReader::transferBacklog(const MsgId &after)
+{
+    qDebug() << qPrintable(QString("Transferring %1...").arg(AbstractSqlMigrator::migrationObject(Backlog)));
+
+    qint64 total = backlogCount(after);
+    qint64 transferred = 0;
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lastReport = 0;
+
+    BacklogChunkReader chunkReader(this, after, _backlogChunkSize, _maxQueuedChunks);
+    chunkReader.start();
+
+    bool success = true;
+    QList<BacklogMO> chunk;
+    while (chunkReader.takeChunk(chunk)) {
+        // every chunk is committed along with the progress, so an interrupted migration can resume right after it
+        if (!_writer->transaction()) {
+            qWarning() << "AbstractSqlMigrationReader::transferBacklog(): unable to start writer's transaction!";
+            success = false;
+            break;
+        }
+        if (!_writer->writeBacklogChunk(chunk) || !_writer->setMigrationProgress(chunk.last().messageid)) {
+            qWarning() << "AbstractSqlMigrationReader::transferBacklog(): unable to transfer Migratable Object of type Backlog!";
+            if (_writer->lastError().isValid())
+                _writer->dumpStatus();
+            _writer->rollback();
+            success = false;
+            break;
+        }
+        if (!_writer->commit()) {
+            qWarning() << "AbstractSqlMigrationReader::transferBacklog(): unable to commit writer's transaction!";
+            success = false;
+            break;
+        }
+
+        transferred += chunk.count();
+        qint64 elapsed = timer.elapsed();
+        if (elapsed - lastReport >= 10000 || transferred >= total) {
+            lastReport = elapsed;
+            qint64 rate = elapsed > 0 ? transferred * 1000 / elapsed : 0;
+            QString eta = rate > 0 ? QString("%1 min").arg((total - transferred) / rate / 60) : QString("unknown");
+            qDebug() << qPrintable(QString("%1 of %2 messages (%3%), %4 messages/s, time left: %5")
+                                   .arg(transferred).arg(total).arg(total > 0 ? 100 * transferred / total : 100)
+                                   .arg(rate).arg(eta));
+        }
+    }
+
+    if (!success)
+        chunkReader.abort();
+    chunkReader.wait();
+    if (chunkReader.failed()) {
+        qWarning() << "AbstractSqlMigrationReader::transferBacklog(): unable to read the backlog!";
+        success = false;
+    }
+
+    if (success)
+        qDebug() << "Done.";
+    else
+        _writer = 0;
+    return success;
+}
+
+
+// ========================================
+//  AbstractSqlMigrationWriter
+// ========================================
+AbstractSqlMigrationWriter::AbstractSqlMigrationWriter()
+    : AbstractSqlMigrator(),
+    _resyncing(false)
+{
+}
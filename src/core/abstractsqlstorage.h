@@ -50,14 +50,49 @@ protected:
 
     QSqlDatabase logDb();
 
+    //! Close and drop the current thread's pooled connection
+    /** Pooled connections are otherwise only released along with their thread's QThread object, so
+     *  short-lived worker threads have to call this before they finish.
+     */
+    void releaseConnection();
+
     QString queryString(const QString &queryName, int version);
     inline QString queryString(const QString &queryName) { return queryString(queryName, 0); }
 
+    //! Get the query queryName, prepared for the current thread's connection
+    /** Statements are prepared once per connection and reused afterwards. The returned object shares its
+     *  statement with the cache, so it must only be used for the current operation, and should be finish()ed
+     *  before the transaction is committed.
+     */
+    QSqlQuery cachedQuery(const QString &queryName, QSqlDatabase &db);
+
+    //! Server side prepared statements (PREPARE name AS ...) known to exist on the current connection
+    bool isPreparedStatement(const QString &queryName) const;
+    void setPreparedStatement(const QString &queryName, bool prepared = true);
+
+    //! Bookkeeping for the per connection prepare/exec statistics
+    void queryPrepared();
+    void queryExecuted();
+
     QStringList setupQueries();
 
     QStringList upgradeQueries(int ver);
     bool upgradeDb();
 
+    //! Prepare the backlog search index
+    /** This is called on every init(), after the schema has been upgraded. The default implementation
+     *  does nothing, as the index is usually part of the regular schema.
+     *  \return true if the search index is available
+     */
+    inline virtual bool initSearchIndex() { return true; }
+
+    //! Add messages stored before the search index existed to it
+    /** Existing backlogs can be huge, so this works through the messages in batches, newest first, and
+     *  commits each of them on its own. The progress is kept in the coreinfo table, so an interrupted
+     *  run continues where it left off on the next start.
+     */
+    bool buildSearchIndex();
+
     bool watchQuery(QSqlQuery &query);
 
     int schemaVersion();
@@ -88,10 +123,17 @@ private slots:
 private:
     void addConnectionToPool();
     void dbConnect(QSqlDatabase &db);
+    void loadQueries(int version);
 
     int _schemaVersion;
     bool _debug;
 
+    // query texts by schema version and name, read from the resource files only once
+    QMutex _queryRegistryMutex;
+    QHash<int, QHash<QString, QString> > _queryRegistry;
+
+    static const int _searchIndexBatchSize = 50000; // messageids per batch
+
     static int _nextConnectionId;
     QMutex _connectionPoolMutex;
     // we let a Connection Object manage each actual db connection
@@ -99,6 +141,7 @@ private:
     // which allows us thread safe termination of a connection
     class Connection;
     QHash<QThread *, Connection *> _connectionPool;
+    inline Connection *currentConnection() const { return _connectionPool.value(QThread::currentThread()); }
 };
 
 
@@ -115,8 +158,22 @@ public:
 
     inline QLatin1String name() const { return QLatin1String(_name); }
 
+    inline QHash<QString, QSqlQuery> &queryCache() { return _queryCache; }
+    inline QSet<QString> &preparedStatements() { return _preparedStatements; }
+    //! Forget all prepared statements, e.g. because the connection has been reestablished
+    void clearQueryCache();
+
+    inline quint64 prepareCount() const { return _prepareCount; }
+    inline quint64 execCount() const { return _execCount; }
+    inline void countPrepare() { _prepareCount++; }
+    inline void countExec() { _execCount++; }
+
 private:
     QByteArray _name;
+    QHash<QString, QSqlQuery> _queryCache;
+    QSet<QString> _preparedStatements;
+    quint64 _prepareCount;
+    quint64 _execCount;
 };
 
 
@@ -301,6 +358,16 @@ public:
     virtual bool readMo(IrcServerMO &ircserver) = 0;
     virtual bool readMo(UserSettingMO &userSetting) = 0;
 
+    //! Reads up to limit messages with an id larger than after, ordered by id.
+    /** Called from a separate thread while the writer stores the previous chunk, so implementations
+     *  must not use the migrator's shared query.
+     */
+    virtual bool readBacklogChunk(const MsgId &after, int limit, QList<BacklogMO> &chunk) = 0;
+    //! The number of messages with an id larger than after, used for progress reports
+    virtual qint64 backlogCount(const MsgId &after) = 0;
+    //! Called from the readBacklogChunk() thread before it finishes, to release resources bound to that thread
+    inline virtual void backlogReaderFinished() {}
+
     bool migrateTo(AbstractSqlMigrationWriter *writer);
 
 private:
@@ -308,14 +375,23 @@ private:
     bool finalizeMigration();
 
     template<typename T> bool transferMo(MigrationObject moType, T &mo);
+    template<typename T> bool resyncMo(MigrationObject moType, T &mo);
+    bool resyncMigration();
+    bool resyncMos();
+    bool transferBacklog(const MsgId &after);
 
     AbstractSqlMigrationWriter *_writer;
+
+    static const int _backlogChunkSize = 10000;
+    static const int _maxQueuedChunks = 4;
 };
 
 
 class AbstractSqlMigrationWriter : public AbstractSqlMigrator
 {
 public:
+    AbstractSqlMigrationWriter();
+
     virtual bool writeMo(const QuasselUserMO &user) = 0;
     virtual bool writeMo(const IdentityMO &identity) = 0;
     virtual bool writeMo(const IdentityNickMO &identityNick) = 0;
@@ -326,11 +402,36 @@ public:
     virtual bool writeMo(const IrcServerMO &ircserver) = 0;
     virtual bool writeMo(const UserSettingMO &userSetting) = 0;
 
+    //! Writes a chunk of messages as read by AbstractSqlMigrationReader::readBacklogChunk()
+    virtual bool writeBacklogChunk(const QList<BacklogMO> &chunk) = 0;
+
+    //! Returns the id of the last message migrated so far, or -1 if no migration is in progress
+    /** The progress is stored along with the migrated data, so an interrupted migration can be resumed. */
+    virtual int migrationProgress() = 0;
+    virtual bool setMigrationProgress(const MsgId &msgId) = 0;
+    virtual bool clearMigrationProgress() = 0;
+    //! Deletes everything migrated so far, so the migration can start over
+    virtual bool resetMigration() = 0;
+
+    //! Whether the data migrated so far can be brought up to date when an interrupted migration is resumed
+    /** The current backend stays in use between two attempts, so everything but the backlog is transferred
+     *  again. While resyncing() is set, writeMo() has to update rows that exist already instead of failing.
+     */
+    inline virtual bool supportsResync() { return false; }
+    inline bool resyncing() const { return _resyncing; }
+    inline void setResyncing(bool resyncing) { _resyncing = resyncing; }
+    //! Deletes the objects of type mo whose id isn't in keep, along with everything depending on them
+    /** An empty keep deletes all objects of the type. Only used for resyncing. */
+    virtual bool removeStaleMos(MigrationObject mo, const QVariantList &keep) = 0;
+
     inline bool migrateFrom(AbstractSqlMigrationReader *reader) { return reader->migrateTo(this); }
 
     // called after migration process
     virtual inline bool postProcess() { return true; }
     friend class AbstractSqlMigrationReader;
+
+private:
+    bool _resyncing;
 };
 
 
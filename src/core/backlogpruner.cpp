@@ -0,0 +1,293 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "backlogpruner.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QThread>
+
+#include "core.h"
+#include "coresettings.h"
+#include "logger.h"
+
+// Compacting a large backlog can take a long time, so it runs on a thread (and database connection) of its own
+class BacklogPruner::Compactor : public QThread
+{
+public:
+    Compactor(const MsgId &prunedBefore, QObject *parent) : QThread(parent), _prunedBefore(prunedBefore), _reclaimed(0), _time(0) {}
+
+    inline qint64 reclaimed() const { return _reclaimed; }
+    inline qint64 time() const { return _time; }
+
+protected:
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        _reclaimed = Core::compactBacklog(_prunedBefore);
+        _time = timer.elapsed();
+    }
+
+private:
+    MsgId _prunedBefore;
+    qint64 _reclaimed;
+    qint64 _time;
+};
+
+
+BacklogPruner::BacklogPruner(QObject *parent)
+    : QObject(parent),
+    _enabled(false),
+    _batchSize(1000),
+    _prunedCount(0),
+    _archivedCount(0),
+    _busyTime(0),
+    _compactor(0)
+{
+    connect(&_runTimer, SIGNAL(timeout()), this, SLOT(startRun()));
+
+    _batchTimer.setSingleShot(true);
+    _batchTimer.setInterval(_batchPause);
+    connect(&_batchTimer, SIGNAL(timeout()), this, SLOT(pruneNextBatch()));
+
+    loadSettings();
+}
+
+
+BacklogPruner::~BacklogPruner()
+{
+    if (_compactor)
+        _compactor->wait();
+}
+
+
+void BacklogPruner::loadSettings()
+{
+    QVariantMap settings = CoreSettings().retentionSettings().toMap();
+
+    _defaultRule = Rule();
+    readRule(_defaultRule, settings);
+    _enabled = _defaultRule.maxAge > 0 || _defaultRule.maxCount > 0;
+
+    _bufferTypeRules.clear();
+    QVariantMap bufferTypes = settings.value("BufferTypes").toMap();
+    QHash<QString, BufferInfo::Type> typeNames;
+    typeNames["Status"] = BufferInfo::StatusBuffer;
+    typeNames["Channel"] = BufferInfo::ChannelBuffer;
+    typeNames["Query"] = BufferInfo::QueryBuffer;
+    typeNames["Group"] = BufferInfo::GroupBuffer;
+    foreach(const QString &typeName, bufferTypes.keys()) {
+        if (!typeNames.contains(typeName)) {
+            quWarning() << "Ignoring retention rule for unknown buffer type" << typeName;
+            continue;
+        }
+        _bufferTypeRules[typeNames[typeName]] = bufferTypes[typeName].toMap();
+        _enabled = true;
+    }
+
+    _networkRules.clear();
+    QVariantMap networks = settings.value("Networks").toMap();
+    foreach(const QString &networkId, networks.keys()) {
+        _networkRules[networkId.toInt()] = networks[networkId].toMap();
+        _enabled = true;
+    }
+
+    _archiveDir = settings.value("ArchiveDir").toString();
+    _batchSize = qMax(settings.value("BatchSize", 1000).toInt(), 1);
+
+    if (_enabled) {
+        _runTimer.start(qMax(settings.value("Interval", 24).toInt(), 1) * 60 * 60 * 1000);
+        // also prune shortly after startup, instead of waiting for a whole interval
+        QTimer::singleShot(5 * 60 * 1000, this, SLOT(startRun()));
+    }
+    else {
+        _runTimer.stop();
+    }
+}
+
+
+void BacklogPruner::readRule(Rule &rule, const QVariantMap &settings)
+{
+    if (settings.contains("MaxAge"))
+        rule.maxAge = settings["MaxAge"].toInt();
+    if (settings.contains("MaxCount"))
+        rule.maxCount = settings["MaxCount"].toInt();
+}
+
+
+BacklogPruner::Rule BacklogPruner::ruleFor(const BufferInfo &bufferInfo) const
+{
+    Rule rule = _defaultRule;
+    readRule(rule, _bufferTypeRules.value(bufferInfo.type()));
+    readRule(rule, _networkRules.value(bufferInfo.networkId()));
+    return rule;
+}
+
+
+void BacklogPruner::startRun()
+{
+    if (!_enabled || !Core::isConfigured() || _batchTimer.isActive() || _compactor)
+        return; // the previous run isn't done yet
+
+    _pendingBuffers = Core::allBuffers();
+    _currentBuffer = BufferInfo();
+    _prunedCount = 0;
+    _prunedBefore = 0;
+    _archivedCount = 0;
+    _busyTime = 0;
+    _runTime.start();
+    _batchTimer.start();
+}
+
+
+// Picks the next buffer that has expired messages
+bool BacklogPruner::nextBuffer()
+{
+    while (!_pendingBuffers.isEmpty()) {
+        BufferInfo bufferInfo = _pendingBuffers.takeFirst();
+        Rule rule = ruleFor(bufferInfo);
+        if (rule.maxAge <= 0 && rule.maxCount <= 0)
+            continue;
+
+        QDateTime keepSince;
+        if (rule.maxAge > 0)
+            keepSince = QDateTime::currentDateTime().toUTC().addDays(-rule.maxAge);
+        MsgId boundary = Core::retentionBoundary(bufferInfo.bufferId(), keepSince, rule.maxCount);
+        if (boundary.isValid()) {
+            _currentBuffer = bufferInfo;
+            _currentBoundary = boundary;
+            return true;
+        }
+    }
+    _currentBuffer = BufferInfo();
+    return false;
+}
+
+
+void BacklogPruner::pruneNextBatch()
+{
+    QElapsedTimer batchTime;
+    batchTime.start();
+
+    if (!_currentBuffer.isValid() && !nextBuffer()) {
+        _busyTime += batchTime.elapsed();
+        finishRun();
+        return;
+    }
+
+    MsgId before = _currentBoundary;
+    if (!_archiveDir.isEmpty()) {
+        // only delete what made it into the archive
+        QList<Message> msgs;
+        bool ok = Core::requestExpiredMsgs(_currentBuffer, _currentBoundary, _batchSize, msgs);
+        if (!ok)
+            quWarning() << "Could not read the expired backlog - skipping buffer" << _currentBuffer.bufferName();
+        else if (!msgs.isEmpty() && !archive(msgs)) {
+            quWarning() << "Could not archive expired backlog to" << _archiveDir << "- skipping buffer" << _currentBuffer.bufferName();
+            ok = false;
+        }
+        if (!ok || msgs.isEmpty()) {
+            // nothing (more) that is safe to delete in this buffer
+            _currentBuffer = BufferInfo();
+            _busyTime += batchTime.elapsed();
+            _batchTimer.start();
+            return;
+        }
+        _archivedCount += msgs.count();
+        before = msgs.last().msgId().toInt() + 1;
+    }
+
+    int deleted = Core::pruneMsgs(_currentBuffer.bufferId(), before, _batchSize);
+    if (deleted > 0) {
+        _prunedCount += deleted;
+        _prunedBefore = qMax(_prunedBefore, before);
+        emit msgsPruned(_currentBuffer.bufferId(), before);
+    }
+    if (deleted < _batchSize) {
+        if (deleted < 0)
+            quWarning() << "Could not prune the backlog of buffer" << _currentBuffer.bufferName();
+        // done with this buffer
+        _currentBuffer = BufferInfo();
+    }
+
+    _busyTime += batchTime.elapsed();
+    _batchTimer.start();
+}
+
+
+/* Archive files contain a sequence of blocks as written by QDataStream << QByteArray. Each block is compressed
+ * with qCompress() and contains lines of tab separated fields: msgid, time (ISO 8601, UTC), type, flags, sender
+ * and contents. Tabs, newlines and backslashes within the fields are escaped with a backslash.
+ */
+bool BacklogPruner::archive(const QList<Message> &msgs)
+{
+    QDir dir(_archiveDir);
+    if (!dir.exists() && !dir.mkpath("."))
+        return false;
+
+    QFile file(dir.filePath(QString("backlog-%1-%2.qz").arg(_currentBuffer.networkId().toInt()).arg(_currentBuffer.bufferId().toInt())));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+
+    QString text;
+    foreach(const Message &msg, msgs) {
+        QStringList fields;
+        fields << QString::number(msg.msgId().toInt())
+               << msg.timestamp().toUTC().toString(Qt::ISODate)
+               << QString::number(msg.type())
+               << QString::number(msg.flags())
+               << msg.sender()
+               << msg.contents();
+        for (int i = 0; i < fields.count(); i++)
+            fields[i].replace('\\', "\\\\").replace('\t', "\\t").replace('\n', "\\n");
+        text += fields.join("\t") + '\n';
+    }
+
+    QDataStream out(&file);
+    out << qCompress(text.toUtf8());
+    return out.status() == QDataStream::Ok && file.flush();
+}
+
+
+void BacklogPruner::finishRun()
+{
+    _pendingBuffers.clear();
+    _currentBuffer = BufferInfo();
+    if (_prunedCount == 0)
+        return;
+
+    _compactor = new Compactor(_prunedBefore, this);
+    connect(_compactor, SIGNAL(finished()), this, SLOT(compactionFinished()));
+    _compactor->start(QThread::LowestPriority);
+}
+
+
+void BacklogPruner::compactionFinished()
+{
+    _busyTime += _compactor->time();
+    quInfo() << qPrintable(tr("Pruned %1 expired messages (%2 archived) and reclaimed %3 KiB in %4 s (%5 s of work)")
+                           .arg(_prunedCount).arg(_archivedCount).arg(_compactor->reclaimed() / 1024)
+                           .arg(_runTime.elapsed() / 1000).arg(_busyTime / 1000));
+
+    _compactor->deleteLater();
+    _compactor = 0;
+}
@@ -0,0 +1,113 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef BACKLOGPRUNER_H
+#define BACKLOGPRUNER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+
+#include "bufferinfo.h"
+#include "message.h"
+
+//! Deletes expired backlog according to the configured retention rules
+/** The rules are read from the RetentionSettings of the core settings, which look like this:
+ *
+ *  RetentionSettings = {
+ *      MaxAge: days,                  // messages older than this are expired; 0 keeps them forever
+ *      MaxCount: messages,            // only this many of the newest messages per buffer are kept; 0 keeps all
+ *      BufferTypes: { Status: {...}, Channel: {...}, Query: {...}, Group: {...} },
+ *      Networks: { <networkid>: {...} },
+ *      ArchiveDir: path,              // if set, expired messages are written to compressed files here first
+ *      Interval: hours,               // time between pruning runs, defaults to 24
+ *      BatchSize: messages            // messages deleted per step, defaults to 1000
+ *  }
+ *
+ *  The rules for a buffer type override the defaults, and the rules for a network override both.
+ *
+ *  Each run prunes the buffers in small batches with pauses in between, so the core stays responsive
+ *  and other writers get their share of the database. Afterwards the storage reclaims the freed space
+ *  on a low priority thread.
+ */
+class BacklogPruner : public QObject
+{
+    Q_OBJECT
+
+public:
+    BacklogPruner(QObject *parent = 0);
+    ~BacklogPruner();
+
+    //! (Re)reads the retention settings and schedules the pruning runs accordingly
+    void loadSettings();
+
+    inline bool isEnabled() const { return _enabled; }
+
+signals:
+    //! The messages of bufferId older than before have been deleted from storage
+    void msgsPruned(BufferId bufferId, MsgId before);
+
+private slots:
+    void startRun();
+    void pruneNextBatch();
+    void compactionFinished();
+
+private:
+    class Compactor;
+
+    struct Rule {
+        int maxAge;
+        int maxCount;
+        Rule() : maxAge(0), maxCount(0) {}
+    };
+
+    Rule ruleFor(const BufferInfo &bufferInfo) const;
+    static void readRule(Rule &rule, const QVariantMap &settings);
+    bool nextBuffer();
+    bool archive(const QList<Message> &msgs);
+    void finishRun();
+
+    bool _enabled;
+    Rule _defaultRule;
+    QHash<int, QVariantMap> _bufferTypeRules;
+    QHash<NetworkId, QVariantMap> _networkRules;
+    QString _archiveDir;
+    int _batchSize;
+
+    QTimer _runTimer;
+    QTimer _batchTimer;
+
+    // state of the current run
+    QList<BufferInfo> _pendingBuffers;
+    BufferInfo _currentBuffer;
+    MsgId _currentBoundary;
+    int _prunedCount;
+    MsgId _prunedBefore; // all deleted messages have a smaller id
+    int _archivedCount;
+    QElapsedTimer _runTime;
+    qint64 _busyTime;
+    Compactor *_compactor; // while the storage is compacted after a run
+
+    static const int _batchPause = 200; // ms between two batches
+};
+
+
+#endif
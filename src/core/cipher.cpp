@@ -15,15 +15,56 @@
 #include "cipher.h"
 #include "logger.h"
 
+namespace {
+
+//Custom non RFC 2045 compliant Base64 alphabet for mircryption / FiSH compatibility
+const char fishB64Chars[] = "./0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+struct FishB64DecodeTable
+{
+    FishB64DecodeTable()
+    {
+        memset(values, 0, sizeof(values)); // invalid chars decode as '.'
+        for (int i = 0; i < 64; i++)
+            values[(uchar)fishB64Chars[i]] = i;
+    }
+    quint8 values[256];
+};
+
+const FishB64DecodeTable fishB64Decode;
+
+// Pads data with '\0' up to a multiple of the blowfish block size
+void padToBlockSize(QByteArray &data)
+{
+    int oldSize = data.size();
+    int newSize = (oldSize + 7) & ~7;
+    if (newSize != oldSize) {
+        data.resize(newSize);
+        memset(data.data() + oldSize, 0, newSize - oldSize);
+    }
+}
+
+bool checkNeededFeatures()
+{
+    QCA::Initializer init;
+    return QCA::isSupported("blowfish-ecb") && QCA::isSupported("blowfish-cbc") && QCA::isSupported("dh");
+}
+
+}
+
 Cipher::Cipher()
+    : m_cbc(false)
 {
+    memset(m_ciphers, 0, sizeof(m_ciphers));
     m_primeNum = QCA::BigInteger("12745216229761186769575009943944198619149164746831579719941140425076456621824834322853258804883232842877311723249782818608677050956745409379781245497526069657222703636504651898833151008222772087491045206203033063108075098874712912417029101508315117935752962862335062591404043092163187352352197487303798807791605274487594646923");
     setType("blowfish");
 }
 
 
 Cipher::Cipher(QByteArray key, QString cipherType)
+    : m_cbc(false)
 {
+    memset(m_ciphers, 0, sizeof(m_ciphers));
     m_primeNum = QCA::BigInteger("12745216229761186769575009943944198619149164746831579719941140425076456621824834322853258804883232842877311723249782818608677050956745409379781245497526069657222703636504651898833151008222772087491045206203033063108075098874712912417029101508315117935752962862335062591404043092163187352352197487303798807791605274487594646923");
     setKey(key);
     setType(cipherType);
@@ -31,10 +72,14 @@ Cipher::Cipher(QByteArray key, QString cipherType)
 
 
 Cipher::~Cipher()
-{}
+{
+    resetCiphers();
+}
 
 bool Cipher::setKey(QByteArray key)
 {
+    resetCiphers();
+
     if (key.isEmpty()) {
         m_key.clear();
         return false;
@@ -66,48 +111,62 @@ bool Cipher::setKey(QByteArray key)
 bool Cipher::setType(const QString &type)
 {
     //TODO check QCA::isSupported()
+    resetCiphers();
     m_type = type;
     return true;
 }
 
 
+QCA::Cipher *Cipher::qcaCipher(QCA::Cipher::Mode mode, QCA::Direction direction)
+{
+    QCA::Cipher *&cipher = m_ciphers[mode == QCA::Cipher::CBC][direction == QCA::Encode];
+    if (!cipher) {
+        if (mode == QCA::Cipher::CBC)
+            cipher = new QCA::Cipher(m_type, mode, QCA::Cipher::NoPadding, direction, m_key, QCA::InitializationVector(QByteArray("0")));
+        else
+            cipher = new QCA::Cipher(m_type, mode, QCA::Cipher::NoPadding, direction, m_key);
+    }
+    return cipher;
+}
+
+
+void Cipher::resetCiphers()
+{
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            delete m_ciphers[i][j];
+            m_ciphers[i][j] = 0;
+        }
+    }
+}
+
+
 QByteArray Cipher::decrypt(QByteArray cipherText)
 {
     QByteArray pfx = "";
     bool error = false; // used to flag non cbc, seems like good practice not to parse w/o regard for set encryption type
 
     //if we get cbc
-    if (cipherText.mid(0, 5) == "+OK *")
+    if (cipherText.startsWith("+OK *"))
     {
-        //if we have cbc
-        if (m_cbc)
-            cipherText = cipherText.mid(5);
-        //if we don't
-        else
+        cipherText.remove(0, 5);
+        //if we don't have cbc
+        if (!m_cbc)
         {
-            cipherText = cipherText.mid(5);
             pfx = "ERROR_NONECB: ";
             error = true;
         }
     }
     //if we get ecb
-    else if (cipherText.mid(0, 4) == "+OK " || cipherText.mid(0, 5) == "mcps ")
+    else if (cipherText.startsWith("+OK ") || cipherText.startsWith("mcps "))
     {
+        cipherText.remove(0, cipherText.startsWith("+OK ") ? 4 : 5);
         //if we had cbc
         if (m_cbc)
         {
-            cipherText = (cipherText.mid(0, 4) == "+OK ") ? cipherText.mid(4) : cipherText.mid(5);
             pfx = "ERROR_NONCBC: ";
             error = true;
         }
-        //if we don't
-        else
-        {
-            if (cipherText.mid(0, 4) == "+OK ")
-                cipherText = cipherText.mid(4);
-            else
-                cipherText = cipherText.mid(5);
-        }
     }
     //all other cases we fail
     else
@@ -116,36 +175,27 @@ QByteArray Cipher::decrypt(QByteArray cipherText)
     QByteArray temp;
     // (if cbc and no error we parse cbc) || (if ecb and error we parse cbc)
     if ((m_cbc && !error) || (!m_cbc && error))
-    {
-        cipherText = cipherText;
         temp = blowfishCBC(cipherText, false);
-
-        if (temp == cipherText)
-        {
-            // kDebug("Decryption from CBC Failed");
-            return cipherText+' '+'\n';
-        }
-        else
-            cipherText = temp;
-    }
     else
-    {
         temp = blowfishECB(cipherText, false);
 
-        if (temp == cipherText)
-        {
-            // kDebug("Decryption from ECB Failed");
-            return cipherText+' '+'\n';
-        }
-        else
-            cipherText = temp;
+    if (temp == cipherText)
+    {
+        // kDebug("Decryption Failed");
+        return cipherText+' '+'\n';
     }
+
     // TODO FIXME the proper fix for this is to show encryption differently e.g. [nick] instead of <nick>
     // don't hate me for the mircryption reference there.
-    if (cipherText.at(0) == 1)
+    if (temp.at(0) == 1)
         pfx = "\x0";
-    cipherText = pfx+cipherText+' '+'\n'; // FIXME(??) why is there an added space here?
-    return cipherText;
+
+    QByteArray result;
+    result.reserve(pfx.size() + temp.size() + 2);
+    result += pfx;
+    result += temp;
+    result += " \n"; // FIXME(??) why is there an added space here?
+    return result;
 }
 
 
@@ -249,9 +299,9 @@ bool Cipher::parseFinishKeyX(QByteArray key)
 
 QByteArray Cipher::decryptTopic(QByteArray cipherText)
 {
-    if (cipherText.mid(0, 4) == "+OK ") // FiSH style topic
-        cipherText = cipherText.mid(4);
-    else if (cipherText.left(5) == "«m«")
+    if (cipherText.startsWith("+OK ")) // FiSH style topic
+        cipherText.remove(0, 4);
+    else if (cipherText.startsWith("«m«"))
         cipherText = cipherText.mid(5, cipherText.length()-10);
     else
         return cipherText;
@@ -268,20 +318,18 @@ QByteArray Cipher::decryptTopic(QByteArray cipherText)
     {
         return cipherText;
     }
-    else
-        cipherText = temp;
 
-    if (cipherText.mid(0, 2) == "@@")
-        cipherText = cipherText.mid(2);
+    if (temp.startsWith("@@"))
+        temp.remove(0, 2);
 
-    return cipherText;
+    return temp;
 }
 
 
 bool Cipher::encrypt(QByteArray &cipherText)
 {
-    if (cipherText.left(3) == "+p ") //don't encode if...?
-        cipherText = cipherText.mid(3);
+    if (cipherText.startsWith("+p ")) //don't encode if...?
+        cipherText.remove(0, 3);
     else
     {
         if (m_cbc) //encode in ecb or cbc decide how to determine later
@@ -294,7 +342,7 @@ bool Cipher::encrypt(QByteArray &cipherText)
                 return false;
             }
 
-            cipherText = "+OK *" + temp;
+            cipherText = temp.prepend("+OK *");
         }
         else
         {
@@ -306,7 +354,7 @@ bool Cipher::encrypt(QByteArray &cipherText)
                 return false;
             }
 
-            cipherText = "+OK " + temp;
+            cipherText = temp.prepend("+OK ");
         }
     }
     return true;
@@ -314,71 +362,72 @@ bool Cipher::encrypt(QByteArray &cipherText)
 
 
 //THE BELOW WORKS AKA DO NOT TOUCH UNLESS YOU KNOW WHAT YOU'RE DOING
-QByteArray Cipher::blowfishCBC(QByteArray cipherText, bool direction)
+// The QCA ciphers are kept across messages and never final()ized. With NoPadding and block
+// aligned input, final() never yields data. For CBC this chains each message onto the previous
+// one, which is harmless: mircryption's first block is a random IV that the receiver discards.
+QByteArray Cipher::blowfishCBC(const QByteArray &cipherText, bool direction)
 {
-    QCA::Initializer init;
-    QByteArray temp = cipherText;
+    QByteArray temp;
     if (direction)
     {
         // make sure cipherText is an interval of 8 bits. We do this before so that we
         // know there's at least 8 bytes to en/decryption this ensures QCA doesn't fail
-        while ((temp.length() % 8) != 0) temp.append('\0');
-
         QCA::InitializationVector iv(8);
-        temp.prepend(iv.toByteArray()); // prefix with 8bits of IV for mircryptions *CUSTOM* cbc implementation
+        temp = iv.toByteArray(); // prefix with 8bits of IV for mircryptions *CUSTOM* cbc implementation
+        temp.reserve(8 + cipherText.length() + 7);
+        temp += cipherText;
     }
     else
     {
-        temp = QByteArray::fromBase64(temp);
+        temp = QByteArray::fromBase64(cipherText);
         //supposedly nescessary if we get a truncated message also allows for decryption of 'crazy'
         //en/decoding clients that use STANDARDIZED PADDING TECHNIQUES
-        while ((temp.length() % 8) != 0) temp.append('\0');
     }
+    padToBlockSize(temp);
 
-    QCA::Direction dir = (direction) ? QCA::Encode : QCA::Decode;
-    QCA::Cipher cipher(m_type, QCA::Cipher::CBC, QCA::Cipher::NoPadding, dir, m_key, QCA::InitializationVector(QByteArray("0")));
-    QByteArray temp2 = cipher.update(QCA::MemoryRegion(temp)).toByteArray();
-    temp2 += cipher.final().toByteArray();
+    QCA::Cipher *cipher = qcaCipher(QCA::Cipher::CBC, direction ? QCA::Encode : QCA::Decode);
+    QByteArray temp2 = cipher->update(QCA::MemoryRegion(temp)).toByteArray();
 
-    if (!cipher.ok())
+    if (!cipher->ok()) {
+        resetCiphers();
         return cipherText;
+    }
 
     if (direction) //send in base64
         temp2 = temp2.toBase64();
     else //cut off the 8bits of IV
-        temp2 = temp2.remove(0, 8);
+        temp2.remove(0, 8);
 
     return temp2;
 }
 
 
-QByteArray Cipher::blowfishECB(QByteArray cipherText, bool direction)
+QByteArray Cipher::blowfishECB(const QByteArray &cipherText, bool direction)
 {
-    QCA::Initializer init;
-    QByteArray temp = cipherText;
+    QByteArray temp;
 
     //do padding ourselves
     if (direction)
     {
-        while ((temp.length() % 8) != 0) temp.append('\0');
+        temp = cipherText;
+        padToBlockSize(temp);
     }
     else
     {
         // ECB Blowfish encodes in blocks of 12 chars, so anything else is malformed input
-        if ((temp.length() % 12) != 0)
+        if ((cipherText.length() % 12) != 0)
             return cipherText;
 
-        temp = b64ToByte(temp);
-        while ((temp.length() % 8) != 0) temp.append('\0');
+        temp = b64ToByte(cipherText); // always a multiple of 8 bytes
     }
 
-    QCA::Direction dir = (direction) ? QCA::Encode : QCA::Decode;
-    QCA::Cipher cipher(m_type, QCA::Cipher::ECB, QCA::Cipher::NoPadding, dir, m_key);
-    QByteArray temp2 = cipher.update(QCA::MemoryRegion(temp)).toByteArray();
-    temp2 += cipher.final().toByteArray();
+    QCA::Cipher *cipher = qcaCipher(QCA::Cipher::ECB, direction ? QCA::Encode : QCA::Decode);
+    QByteArray temp2 = cipher->update(QCA::MemoryRegion(temp)).toByteArray();
 
-    if (!cipher.ok())
+    if (!cipher->ok()) {
+        resetCiphers();
         return cipherText;
+    }
 
     if (direction) {
         // Sanity check
@@ -393,49 +442,27 @@ QByteArray Cipher::blowfishECB(QByteArray cipherText, bool direction)
 
 
 //Custom non RFC 2045 compliant Base64 enc/dec code for mircryption / FiSH compatibility
-QByteArray Cipher::byteToB64(QByteArray text)
+//Every 8 byte block becomes 12 chars: 6 for the right half, then 6 for the left half, least significant bits first
+QByteArray Cipher::byteToB64(const QByteArray &text)
 {
-    int left = 0;
-    int right = 0;
-    int k = -1;
-    int v;
-    QString base64 = "./0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const uchar *data = reinterpret_cast<const uchar *>(text.constData());
+    int blocks = text.length() / 8;
+
     QByteArray encoded;
-    while (k < (text.length() - 1)) {
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        left = v << 24;
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        left += v << 16;
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        left += v << 8;
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        left += v;
-
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        right = v << 24;
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        right += v << 16;
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        right += v << 8;
-        k++;
-        v = text.at(k); if (v < 0) v += 256;
-        right += v;
+    encoded.resize(blocks * 12);
+    char *out = encoded.data();
+
+    for (int b = 0; b < blocks; b++, data += 8) {
+        // signed like the original code, so the sixth char of each half carries the same (ignored) sign bits
+        qint32 left = (qint32)((quint32)data[0] << 24 | (quint32)data[1] << 16 | (quint32)data[2] << 8 | data[3]);
+        qint32 right = (qint32)((quint32)data[4] << 24 | (quint32)data[5] << 16 | (quint32)data[6] << 8 | data[7]);
 
         for (int i = 0; i < 6; i++) {
-            encoded.append(base64.at(right & 0x3F).toLatin1());
+            *out++ = fishB64Chars[right & 0x3F];
             right = right >> 6;
         }
-
-        //TODO make sure the .toLatin1 doesn't break anything
         for (int i = 0; i < 6; i++) {
-            encoded.append(base64.at(left & 0x3F).toLatin1());
+            *out++ = fishB64Chars[left & 0x3F];
             left = left >> 6;
         }
     }
@@ -443,43 +470,31 @@ QByteArray Cipher::byteToB64(QByteArray text)
 }
 
 
-QByteArray Cipher::b64ToByte(QByteArray text)
+QByteArray Cipher::b64ToByte(const QByteArray &text)
 {
-    QString base64 = "./0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    QByteArray decoded;
-    int k = -1;
-    while (k < (text.length() - 1)) {
-        int right = 0;
-        int left = 0;
-        int v = 0;
-        int w = 0;
-        int z = 0;
+    const uchar *data = reinterpret_cast<const uchar *>(text.constData());
+    int blocks = text.length() / 12;
 
-        for (int i = 0; i < 6; i++) {
-            k++;
-            v = base64.indexOf(text.at(k));
-            right |= v << (i * 6);
-        }
-
-        for (int i = 0; i < 6; i++) {
-            k++;
-            v = base64.indexOf(text.at(k));
-            left |= v << (i * 6);
-        }
-
-        for (int i = 0; i < 4; i++) {
-            w = ((left & (0xFF << ((3 - i) * 8))));
-            z = w >> ((3 - i) * 8);
-            if (z < 0) { z = z + 256; }
-            decoded.append(z);
-        }
-
-        for (int i = 0; i < 4; i++) {
-            w = ((right & (0xFF << ((3 - i) * 8))));
-            z = w >> ((3 - i) * 8);
-            if (z < 0) { z = z + 256; }
-            decoded.append(z);
-        }
+    QByteArray decoded;
+    decoded.resize(blocks * 8);
+    uchar *out = reinterpret_cast<uchar *>(decoded.data());
+
+    for (int b = 0; b < blocks; b++, data += 12, out += 8) {
+        quint32 right = 0;
+        quint32 left = 0;
+        for (int i = 0; i < 6; i++)
+            right |= (quint32)fishB64Decode.values[data[i]] << (i * 6);
+        for (int i = 0; i < 6; i++)
+            left |= (quint32)fishB64Decode.values[data[i + 6]] << (i * 6);
+
+        out[0] = left >> 24;
+        out[1] = left >> 16;
+        out[2] = left >> 8;
+        out[3] = left;
+        out[4] = right >> 24;
+        out[5] = right >> 16;
+        out[6] = right >> 8;
+        out[7] = right;
     }
     return decoded;
 }
@@ -487,10 +502,7 @@ QByteArray Cipher::b64ToByte(QByteArray text)
 
 bool Cipher::neededFeaturesAvailable()
 {
-    QCA::Initializer init;
-
-    if (QCA::isSupported("blowfish-ecb") && QCA::isSupported("blowfish-cbc") && QCA::isSupported("dh"))
-        return true;
-
-    return false;
+    // This is checked for every message, but the available QCA plugins don't change at runtime
+    static const bool available = checkNeededFeatures();
+    return available;
 }
@@ -37,11 +37,18 @@ public:
     inline bool usesCBC() { return m_cbc; }
 
 private:
+    Q_DISABLE_COPY(Cipher)
+
     //direction is true for encrypt, false for decrypt
-    QByteArray blowfishCBC(QByteArray cipherText, bool direction);
-    QByteArray blowfishECB(QByteArray cipherText, bool direction);
-    QByteArray b64ToByte(QByteArray text);
-    QByteArray byteToB64(QByteArray text);
+    QByteArray blowfishCBC(const QByteArray &cipherText, bool direction);
+    QByteArray blowfishECB(const QByteArray &cipherText, bool direction);
+    QByteArray b64ToByte(const QByteArray &text);
+    QByteArray byteToB64(const QByteArray &text);
+
+    //! Returns the cached QCA cipher for mode and direction, creating it if needed
+    QCA::Cipher *qcaCipher(QCA::Cipher::Mode mode, QCA::Direction direction);
+    //! Drops the cached QCA ciphers, e.g. after the key changed
+    void resetCiphers();
 
     QCA::Initializer init;
     QByteArray m_key;
@@ -49,6 +56,9 @@ private:
     QCA::BigInteger m_primeNum;
     QString m_type;
     bool m_cbc;
+
+    // the key schedule is only computed once per key, indexed by [cbc][encode]
+    QCA::Cipher *m_ciphers[2][2];
 };
 
 
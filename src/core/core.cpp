@@ -81,9 +81,16 @@ void Core::destroy()
 }
 
 
+const int Core::_reconnectInterval = 2000;
+
 Core::Core()
     : QObject(),
-      _storage(0)
+      _storage(0),
+      _activeRestores(0),
+      _maxActiveRestores(qBound(2, QThread::idealThreadCount(), 8)),
+      _restoredSessions(0),
+      _restoreInitTime(0),
+      _backlogPruner(0)
 {
 #ifdef HAVE_UMASK
     umask(S_IRWXG | S_IRWXO);
@@ -213,6 +220,9 @@ void Core::init()
 
     if (Quassel::isOptionSet("oidentd"))
         _oidentdConfigGenerator = new OidentdConfigGenerator(this);
+
+    _backlogPruner = new BacklogPruner(this);
+    connect(_backlogPruner, SIGNAL(msgsPruned(BufferId, MsgId)), this, SIGNAL(backlogPruned(BufferId, MsgId)));
 }
 
 
@@ -223,6 +233,7 @@ Core::~Core()
         handler->deleteLater(); // disconnect non authed clients
     }
     qDeleteAll(_sessions);
+    qDeleteAll(_sessionWorkers);
     qDeleteAll(_storageBackends);
 }
 
@@ -264,11 +275,52 @@ void Core::restoreState()
     QVariantList activeSessions = s.coreState().toMap()["ActiveSessions"].toList();
     if (activeSessions.count() > 0) {
         quInfo() << "Restoring previous core state...";
+        instance()->_restoreTime.start();
         foreach(QVariant v, activeSessions) {
             UserId user = v.value<UserId>();
-            instance()->sessionForUser(user, true);
+            instance()->_pendingRestores << user;
         }
+        instance()->startPendingRestores();
+    }
+}
+
+
+void Core::startPendingRestores()
+{
+    while (_activeRestores < _maxActiveRestores && !_pendingRestores.isEmpty())
+        sessionForUser(_pendingRestores.first(), true);
+}
+
+
+void Core::sessionRestored()
+{
+    SessionThread *session = qobject_cast<SessionThread *>(sender());
+    if (!session)
+        return;
+
+    _activeRestores--;
+    _restoredSessions++;
+    _restoreInitTime += session->initTime();
+
+    if (_pendingRestores.isEmpty() && !_activeRestores) {
+        quInfo() << qPrintable(tr("Restored %n session(s) in %1 ms, %2 ms of which were spent setting up sessions (up to %3 at a time)", 0, _restoredSessions)
+                               .arg(_restoreTime.elapsed()).arg(_restoreInitTime).arg(_maxActiveRestores));
+        return;
     }
+    startPendingRestores();
+}
+
+
+int Core::reconnectDelay(const QString &host)
+{
+    Core *core = instance();
+    QMutexLocker locker(&core->_reconnectMutex);
+
+    const QString key = host.toLower();
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 slot = qMax(now, core->_nextReconnect.value(key));
+    core->_nextReconnect[key] = slot + _reconnectInterval;
+    return slot - now;
 }
 
 
@@ -392,6 +444,7 @@ bool Core::initStorage(const QString &backend, const QVariantMap &settings, bool
         connect(storage, SIGNAL(bufferInfoUpdated(UserId, const BufferInfo &)), this, SIGNAL(bufferInfoUpdated(UserId, const BufferInfo &)));
     }
     _storage = storage;
+    _storage->activate();
     return true;
 }
 
@@ -635,13 +688,52 @@ SessionThread *Core::sessionForUser(UserId uid, bool restore)
     if (_sessions.contains(uid))
         return _sessions[uid];
 
+    // a session still waiting to be restored is started right away when its user logs in
+    if (_pendingRestores.removeAll(uid))
+        restore = true;
+
     SessionThread *session = new SessionThread(uid, restore, this);
     _sessions[uid] = session;
-    session->start();
+    if (restore) {
+        _activeRestores++;
+        connect(session, SIGNAL(initialized()), this, SLOT(sessionRestored()));
+    }
+    SessionWorker *worker = sessionWorker();
+    if (worker)
+        session->startOn(worker);
+    else
+        session->start();
     return session;
 }
 
 
+// The worker a new session should run on, or 0 if each session gets a thread of its own
+SessionWorker *Core::sessionWorker()
+{
+    if (_sessionWorkers.isEmpty()) {
+        QString option = Quassel::optionValue("session-threads");
+        int count = option == "auto" ? QThread::idealThreadCount() : option.toInt();
+        if (count <= 0)
+            return 0;
+
+        for (int i = 0; i < count; i++) {
+            SessionWorker *worker = new SessionWorker(this);
+            worker->start();
+            _sessionWorkers << worker;
+        }
+        quInfo() << qPrintable(tr("Running sessions on %n thread(s)", 0, count));
+    }
+
+    // Spread the sessions evenly over the workers
+    SessionWorker *leastBusy = _sessionWorkers.first();
+    foreach(SessionWorker *worker, _sessionWorkers) {
+        if (worker->sessionCount() < leastBusy->sessionCount())
+            leastBusy = worker;
+    }
+    return leastBusy;
+}
+
+
 void Core::socketError(QAbstractSocket::SocketError err, const QString &errorString)
 {
     qWarning() << QString("Socket error %1: %2").arg(err).arg(errorString);
@@ -679,11 +771,20 @@ bool Core::selectBackend(const QString &backend)
 
     Storage::State storageState = storage->init(settings);
     switch (storageState) {
-    case Storage::IsReady:
+    case Storage::IsReady: {
+        // a migration to this backend that was interrupted can be resumed
+        AbstractSqlMigrationWriter *writer = getMigrationWriter(storage);
+        bool resumeMigration = writer && writer->migrationProgress() >= 0;
+        delete writer;
+        if (resumeMigration) {
+            qWarning() << "Backend contains an unfinished migration, resuming it";
+            break;
+        }
         saveBackendSettings(backend, settings);
         qWarning() << "Switched backend to:" << qPrintable(backend);
         qWarning() << "Backend already initialized. Skipping Migration";
         return true;
+    }
     case Storage::NotAvailable:
         qCritical() << "Backend is not available:" << qPrintable(backend);
         return false;
@@ -697,9 +798,7 @@ bool Core::selectBackend(const QString &backend)
             qWarning() << qPrintable(QString("Core::migrateBackend(): unable to initialize backend: %1").arg(backend));
             return false;
         }
-
-        saveBackendSettings(backend, settings);
-        qWarning() << "Switched backend to:" << qPrintable(backend);
+        // the settings are saved once we know whether we migrate, so a failed migration can be resumed
         break;
     }
 
@@ -715,8 +814,10 @@ bool Core::selectBackend(const QString &backend)
         if (reader->migrateTo(writer)) {
             qDebug() << "Migration finished!";
             saveBackendSettings(backend, settings);
+            qWarning() << "Switched backend to:" << qPrintable(backend);
             return true;
         }
+        qWarning() << "If the backlog transfer was interrupted, select the backend again to resume it.";
         return false;
         qWarning() << qPrintable(QString("Core::migrateDb(): unable to migrate storage backend! (No migration writer for %1)").arg(backend));
     }
@@ -733,7 +834,10 @@ bool Core::selectBackend(const QString &backend)
     }
 
     // so we were unable to merge, but let's create a user \o/
+    saveBackendSettings(backend, settings);
+    qWarning() << "Switched backend to:" << qPrintable(backend);
     _storage = storage;
+    _storage->activate();
     createUser();
     return true;
 }
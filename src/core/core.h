@@ -22,6 +22,8 @@
 #define CORE_H
 
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QString>
 #include <QVariant>
 #include <QTimer>
@@ -34,6 +36,7 @@
 #  include <QTcpServer>
 #endif
 
+#include "backlogpruner.h"
 #include "bufferinfo.h"
 #include "message.h"
 #include "oidentdconfiggenerator.h"
@@ -45,6 +48,7 @@ class CoreAuthHandler;
 class CoreSession;
 struct NetworkInfo;
 class SessionThread;
+class SessionWorker;
 class SignalProxy;
 
 class AbstractSqlMigrationReader;
@@ -373,6 +377,24 @@ public:
     }
 
 
+    //! Search the backlog for messages containing the given words
+    /** \note This method is threadsafe.
+     *
+     *  \param user     The owner of the buffers
+     *  \param query    The words to search for
+     *  \param buffers  The buffers to search, or an empty list to search all buffers of the user
+     *  \param start    if valid, return only messages sent at or after this time
+     *  \param end      if valid, return only messages sent before this time
+     *  \param limit    if != -1 limit the returned list to a max of \limit entries
+     *  \param last     if != -1 return only messages with a MsgId < last
+     *  \return The matching messages, newest first
+     */
+    static inline QList<Message> searchMsgs(UserId user, const QString &query, const QList<BufferId> &buffers, const QDateTime &start, const QDateTime &end, int limit = -1, MsgId last = -1)
+    {
+        return instance()->_storage->searchMsgs(user, query, buffers, start, end, limit, last);
+    }
+
+
     //! Request a list of all buffers known to a user.
     /** This method is used to get a list of all buffers we have stored a backlog from.
      *  \note This method is threadsafe.
@@ -453,6 +475,19 @@ public:
     }
 
 
+    //! Update the LastSeenDate for several Buffers at once
+    /** Stores all given ids within a single transaction.
+     *  \note This method is threadsafe.
+     *
+     * \param user      The Owner of the Buffers
+     * \param msgIds    The Message id of the message that has been just seen, by buffer id
+     */
+    static inline void setBufferLastSeenMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds)
+    {
+        return instance()->_storage->setBufferLastSeenMsgs(user, msgIds);
+    }
+
+
     //! Get a Hash of all last seen message ids
     /** This Method is called when the Quassel Core is started to restore the lastSeenMsgIds
      *  \note This method is threadsafe.
@@ -479,6 +514,19 @@ public:
     }
 
 
+    //! Update the MarkerLineMsgId for several Buffers at once
+    /** Stores all given ids within a single transaction.
+     *  \note This method is threadsafe.
+     *
+     * \param user      The Owner of the Buffers
+     * \param msgIds    The Message id where the marker line should be placed, by buffer id
+     */
+    static inline void setBufferMarkerLineMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds)
+    {
+        return instance()->_storage->setBufferMarkerLineMsgs(user, msgIds);
+    }
+
+
     //! Get a Hash of all marker line message ids
     /** This Method is called when the Quassel Core is started to restore the MarkerLineMsgIds
      *  \note This method is threadsafe.
@@ -491,6 +539,61 @@ public:
     }
 
 
+    //! Request the buffers of all users
+    /** \note This method is threadsafe.
+     */
+    static inline QList<BufferInfo> allBuffers()
+    {
+        return instance()->_storage->allBuffers();
+    }
+
+
+    //! Determine which messages of a buffer are expired
+    /** \note This method is threadsafe.
+     *
+     *  \param bufferId   The buffer to check
+     *  \param keepSince  if valid, messages sent before this time are expired
+     *  \param keepCount  if > 0, messages older than the keepCount newest ones are expired
+     *  \return All messages with an id less than the returned one are expired. Invalid if none are.
+     */
+    static inline MsgId retentionBoundary(const BufferId &bufferId, const QDateTime &keepSince, int keepCount)
+    {
+        return instance()->_storage->retentionBoundary(bufferId, keepSince, keepCount);
+    }
+
+
+    //! Request the oldest expired messages of a buffer, oldest first
+    /** \note This method is threadsafe.
+     *  \return false on error, as opposed to there being no expired messages
+     */
+    static inline bool requestExpiredMsgs(const BufferInfo &bufferInfo, const MsgId &before, int limit, QList<Message> &messages)
+    {
+        return instance()->_storage->requestExpiredMsgs(bufferInfo, before, limit, messages);
+    }
+
+
+    //! Delete up to limit of the oldest messages of a buffer with an id less than before
+    /** \note This method is threadsafe.
+     *
+     *  \return The number of deleted messages, or -1 on error
+     */
+    static inline int pruneMsgs(const BufferId &bufferId, const MsgId &before, int limit)
+    {
+        return instance()->_storage->pruneMsgs(bufferId, before, limit);
+    }
+
+
+    //! Reclaim the space freed by pruned messages
+    /** \note This method is threadsafe.
+     *  \param prunedBefore Messages with a MsgId < prunedBefore may have been deleted
+     *  \return The number of bytes reclaimed, as far as the storage backend can tell
+     */
+    static inline qint64 compactBacklog(const MsgId &prunedBefore)
+    {
+        return instance()->_storage->compactBacklog(prunedBefore);
+    }
+
+
     static inline QDateTime startTime() { return instance()->_startTime; }
     static inline bool isConfigured() { return instance()->_configured; }
     static bool sslSupported();
@@ -502,6 +605,16 @@ public:
 
     inline OidentdConfigGenerator *oidentdConfigGenerator() const { return _oidentdConfigGenerator; }
 
+    //! Get the delay before the next connection to the given IRC server may be made
+    /** Reconnects after a core restart are spread out per server, so that the server does not
+     *  throttle or ban us for connecting lots of clients at once. Every call reserves a slot.
+     *  \note This method is threadsafe.
+     *
+     *  \param host  The host name of the IRC server
+     *  \return The number of milliseconds to wait before connecting
+     */
+    static int reconnectDelay(const QString &host);
+
     static const int AddClientEventId;
 
 public slots:
@@ -516,6 +629,9 @@ signals:
     //! Sent when a BufferInfo is updated in storage.
     void bufferInfoUpdated(UserId user, const BufferInfo &info);
 
+    //! Relay from BacklogPruner::msgsPruned(), so the sessions can drop the deleted messages from their caches
+    void backlogPruned(BufferId bufferId, MsgId before);
+
     //! Relay from CoreSession::sessionState(). Used for internal connection only
     void sessionState(const Protocol::SessionState &sessionState);
 
@@ -527,6 +643,7 @@ private slots:
     void stopListening(const QString &msg = QString());
     void incomingConnection();
     void clientDisconnected();
+    void sessionRestored();
 
     bool initStorage(const QString &backend, const QVariantMap &settings, bool setup = false);
 
@@ -542,6 +659,8 @@ private:
     static Core *instanceptr;
 
     SessionThread *sessionForUser(UserId userId, bool restoreState = false);
+    SessionWorker *sessionWorker();
+    void startPendingRestores();
     void addClientHelper(RemotePeer *peer, UserId uid);
     //void processCoreSetup(QTcpSocket *socket, QVariantMap &msg);
     QString setupCoreForInternalUsage();
@@ -558,7 +677,23 @@ private:
 private:
     QSet<CoreAuthHandler *> _connectingClients;
     QHash<UserId, SessionThread *> _sessions;
+
+    // If set, sessions share these threads instead of running on one thread each
+    QList<SessionWorker *> _sessionWorkers;
     Storage *_storage;
+
+    // Sessions are restored a few at a time, so they don't all fight over the storage at once.
+    // A client logging in moves its session to the front of the queue.
+    QList<UserId> _pendingRestores;
+    int _activeRestores;
+    int _maxActiveRestores;
+    int _restoredSessions;
+    qint64 _restoreInitTime;
+    QElapsedTimer _restoreTime;
+
+    QMutex _reconnectMutex;
+    QHash<QString, qint64> _nextReconnect;
+    static const int _reconnectInterval;
     QTimer _storageSyncTimer;
 
 #ifdef HAVE_SSL
@@ -568,6 +703,7 @@ private:
 #endif
 
     OidentdConfigGenerator *_oidentdConfigGenerator;
+    BacklogPruner *_backlogPruner;
 
     QHash<QString, Storage *> _storageBackends;
 
@@ -165,6 +165,8 @@ void CoreAuthHandler::handle(const RegisterClient &msg)
         return;
     }
 
+    _peer->setFeatures(Quassel::Features(msg.clientFeatures));
+
     QVariantList backends;
     bool configured = Core::isConfigured();
     if (!configured)
@@ -216,6 +218,9 @@ void CoreAuthHandler::handle(const Login &msg)
     }
     _peer->dispatch(LoginSuccess());
 
+    if (_peer->features() & Quassel::ResumableSessions)
+        _peer->setResumeRequest(msg.resumeToken, msg.resumeCount);
+
     quInfo() << qPrintable(tr("Client %1 initialized and authenticated successfully as \"%2\" (UserId: %3).").arg(socket()->peerAddress().toString(), msg.user, QString::number(uid.toInt())));
 
     disconnect(socket(), 0, this, 0);
@@ -24,11 +24,215 @@
 
 #include <QDebug>
 
+QAtomicInt CoreBacklogManager::_totalBacklogTailSize(0);
+
 INIT_SYNCABLE_OBJECT(CoreBacklogManager)
 CoreBacklogManager::CoreBacklogManager(CoreSession *coreSession)
     : BacklogManager(coreSession),
-    _coreSession(coreSession)
+    _coreSession(coreSession),
+    _backlogTailSize(0),
+    _backlogTailMessages(0),
+    _backlogTailUses(0),
+    _backlogTailHits(0),
+    _backlogTailMisses(0)
+{
+}
+
+
+CoreBacklogManager::~CoreBacklogManager()
+{
+    _totalBacklogTailSize.fetchAndAddOrdered(-_backlogTailSize);
+}
+
+
+void CoreBacklogManager::addToBacklogTail(const MessageList &messages)
+{
+    foreach(const Message &msg, messages) {
+        BufferId bufferId = msg.bufferInfo().bufferId();
+        QHash<BufferId, BacklogTail>::iterator iter = _backlogTails.find(bufferId);
+        if (iter == _backlogTails.end()) {
+            iter = _backlogTails.insert(bufferId, BacklogTail());
+            iter->coveredFrom = msg.msgId(); // fresh tail, we only know about messages from now on
+        }
+        BacklogTail &tail = *iter;
+        tail.messages << msg;
+        tail.lastUse = ++_backlogTailUses;
+        int size = messageSize(msg);
+        tail.size += size;
+        _backlogTailSize += size;
+        _backlogTailMessages++;
+        _totalBacklogTailSize.fetchAndAddOrdered(size);
+        if (tail.messages.count() > maxBacklogTailLength)
+            trimBacklogTail(tail, maxBacklogTailLength);
+    }
+    if (!messages.isEmpty())
+        enforceBacklogTailBudget(messages.last().bufferInfo().bufferId());
+}
+
+
+void CoreBacklogManager::dropBacklogTail(BufferId bufferId)
 {
+    QHash<BufferId, BacklogTail>::iterator tail = _backlogTails.find(bufferId);
+    if (tail != _backlogTails.end())
+        removeBacklogTail(tail);
+}
+
+
+void CoreBacklogManager::pruneBacklogTail(BufferId bufferId, MsgId before)
+{
+    QHash<BufferId, BacklogTail>::iterator tail = _backlogTails.find(bufferId);
+    if (tail == _backlogTails.end())
+        return;
+
+    int kept = 0;
+    while (kept < tail->messages.count() && tail->messages.at(tail->messages.count() - 1 - kept).msgId() >= before)
+        kept++;
+    if (kept == 0)
+        removeBacklogTail(tail);
+    else if (kept < tail->messages.count())
+        trimBacklogTail(*tail, kept);
+}
+
+
+QVariantMap CoreBacklogManager::backlogTailStats() const
+{
+    QVariantMap stats;
+    stats["backlogTailHits"] = _backlogTailHits;
+    stats["backlogTailMisses"] = _backlogTailMisses;
+    stats["backlogTailBuffers"] = _backlogTails.count();
+    stats["backlogTailMessages"] = _backlogTailMessages;
+    stats["backlogTailSize"] = _backlogTailSize;
+    stats["backlogTailTotalSize"] = _totalBacklogTailSize.fetchAndAddOrdered(0);
+    stats["backlogTailBudget"] = backlogTailBudget;
+    return stats;
+}
+
+
+QList<Message> CoreBacklogManager::requestMsgs(BufferId bufferId, MsgId first, MsgId last, int limit)
+{
+    QList<Message> msgList;
+    if (requestMsgsFromTail(bufferId, first, last, limit, msgList)) {
+        _backlogTailHits++;
+        return msgList;
+    }
+
+    _backlogTailMisses++;
+    msgList = Core::requestMsgs(coreSession()->user(), bufferId, first, last, limit);
+    if (last == -1)
+        fillBacklogTail(bufferId, first, limit, msgList);
+    return msgList;
+}
+
+
+bool CoreBacklogManager::requestMsgsFromTail(BufferId bufferId, MsgId first, MsgId last, int limit, QList<Message> &messages)
+{
+    QHash<BufferId, BacklogTail>::iterator tail = _backlogTails.find(bufferId);
+    if (tail == _backlogTails.end())
+        return false;
+
+    // same as the storage: first <= msgId < last, newest first
+    messages.clear();
+    for (int i = tail->messages.count() - 1; i >= 0 && (limit < 0 || messages.count() < limit); --i) {
+        const Message &msg = tail->messages.at(i);
+        if (last != -1 && msg.msgId() >= last)
+            continue;
+        if (first != -1 && msg.msgId() < first)
+            break;
+        messages << msg;
+    }
+
+    // Everything the storage could add is older than our oldest message, so either we have enough
+    // messages already, or the tail needs to reach back to first
+    bool complete = (limit >= 0 && messages.count() >= limit)
+                    || tail->coveredFrom == -1
+                    || (first != -1 && first >= tail->coveredFrom);
+    if (!complete) {
+        messages.clear();
+        return false;
+    }
+    tail->lastUse = ++_backlogTailUses;
+    return true;
+}
+
+
+void CoreBacklogManager::fillBacklogTail(BufferId bufferId, MsgId first, int limit, const QList<Message> &messages)
+{
+    // messages are the newest ones >= first, so if there are less than requested, we have all of those
+    MsgId coveredFrom = first;
+    if (limit >= 0 && messages.count() >= limit) {
+        if (messages.isEmpty())
+            return;
+        coveredFrom = messages.last().msgId();
+    }
+
+    QHash<BufferId, BacklogTail>::iterator tail = _backlogTails.find(bufferId);
+    if (tail != _backlogTails.end()) {
+        if (tail->coveredFrom == -1 || (coveredFrom != -1 && coveredFrom >= tail->coveredFrom))
+            return; // we already know more than that
+        removeBacklogTail(tail);
+    }
+
+    BacklogTail newTail;
+    newTail.coveredFrom = coveredFrom;
+    int count = qMin(messages.count(), (int)maxBacklogTailLength);
+    for (int i = count - 1; i >= 0; --i) {
+        newTail.messages << messages.at(i);
+        newTail.size += messageSize(messages.at(i));
+    }
+    if (count < messages.count())
+        newTail.coveredFrom = messages.at(count - 1).msgId();
+    newTail.lastUse = ++_backlogTailUses;
+
+    _backlogTailSize += newTail.size;
+    _backlogTailMessages += count;
+    _totalBacklogTailSize.fetchAndAddOrdered(newTail.size);
+    _backlogTails[bufferId] = newTail;
+    enforceBacklogTailBudget(bufferId);
+}
+
+
+void CoreBacklogManager::trimBacklogTail(BacklogTail &tail, int length)
+{
+    int removedSize = 0;
+    int removed = tail.messages.count() - length;
+    for (int i = 0; i < removed; ++i)
+        removedSize += messageSize(tail.messages.at(i));
+    tail.messages.erase(tail.messages.begin(), tail.messages.begin() + removed);
+    tail.coveredFrom = tail.messages.first().msgId();
+    tail.size -= removedSize;
+    _backlogTailSize -= removedSize;
+    _backlogTailMessages -= removed;
+    _totalBacklogTailSize.fetchAndAddOrdered(-removedSize);
+}
+
+
+void CoreBacklogManager::removeBacklogTail(QHash<BufferId, BacklogTail>::iterator tail)
+{
+    _backlogTailSize -= tail->size;
+    _backlogTailMessages -= tail->messages.count();
+    _totalBacklogTailSize.fetchAndAddOrdered(-tail->size);
+    _backlogTails.erase(tail);
+}
+
+
+// Drop our least recently used tails while all sessions together are over budget
+void CoreBacklogManager::enforceBacklogTailBudget(BufferId keep)
+{
+    while (_totalBacklogTailSize.fetchAndAddOrdered(0) > backlogTailBudget && _backlogTails.count() > 1) {
+        QHash<BufferId, BacklogTail>::iterator lru = _backlogTails.end();
+        QHash<BufferId, BacklogTail>::iterator iter = _backlogTails.begin();
+        for (; iter != _backlogTails.end(); ++iter) {
+            if (iter.key() != keep && (lru == _backlogTails.end() || iter->lastUse < lru->lastUse))
+                lru = iter;
+        }
+        removeBacklogTail(lru);
+    }
+}
+
+
+int CoreBacklogManager::messageSize(const Message &msg)
+{
+    return (int)sizeof(Message) + (msg.contents().size() + msg.sender().size()) * (int)sizeof(QChar);
 }
 
 
@@ -36,7 +240,7 @@ QVariantList CoreBacklogManager::requestBacklog(BufferId bufferId, MsgId first,
 {
     QVariantList backlog;
     QList<Message> msgList;
-    msgList = Core::requestMsgs(coreSession()->user(), bufferId, first, last, limit);
+    msgList = requestMsgs(bufferId, first, last, limit);
 
     QList<Message>::const_iterator msgIter = msgList.constBegin();
     QList<Message>::const_iterator msgListEnd = msgList.constEnd();
@@ -64,7 +268,7 @@ QVariantList CoreBacklogManager::requestBacklog(BufferId bufferId, MsgId first,
         // only fetch additional messages if they continue seemlessly
         // that is, if the list of messages is not truncated by the limit
         if (last == oldestMessage) {
-            msgList = Core::requestMsgs(coreSession()->user(), bufferId, -1, last, additional);
+            msgList = requestMsgs(bufferId, -1, last, additional);
             msgIter = msgList.constBegin();
             msgListEnd = msgList.constEnd();
             while (msgIter != msgListEnd) {
@@ -115,3 +319,24 @@ QVariantList CoreBacklogManager::requestBacklogAll(MsgId first, MsgId last, int
 
     return backlog;
 }
+
+
+QVariantList CoreBacklogManager::requestBacklogSearch(QString query, QVariantList bufferIds, QDateTime start, QDateTime end, int limit, MsgId last)
+{
+    QList<BufferId> buffers;
+    foreach(QVariant bufferId, bufferIds) {
+        buffers << bufferId.value<BufferId>();
+    }
+
+    QVariantList backlog;
+    QList<Message> msgList = Core::searchMsgs(coreSession()->user(), query, buffers, start, end, limit, last);
+
+    QList<Message>::const_iterator msgIter = msgList.constBegin();
+    QList<Message>::const_iterator msgListEnd = msgList.constEnd();
+    while (msgIter != msgListEnd) {
+        backlog << qVariantFromValue(*msgIter);
+        ++msgIter;
+    }
+
+    return backlog;
+}
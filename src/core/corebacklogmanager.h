@@ -21,7 +21,10 @@
 #ifndef COREBACKLOGMANAGER_H
 #define COREBACKLOGMANAGER_H
 
+#include <QAtomicInt>
+
 #include "backlogmanager.h"
+#include "message.h"
 
 class CoreSession;
 
@@ -32,15 +35,64 @@ class CoreBacklogManager : public BacklogManager
 
 public:
     CoreBacklogManager(CoreSession *coreSession = 0);
+    ~CoreBacklogManager();
 
     CoreSession *coreSession() { return _coreSession; }
 
+    //! Keep the newest messages of each buffer in memory, so the common backlog requests need no storage access
+    /** Requests for the newest messages of a buffer (optionally since a given MsgId) are served from these
+     *  tails whenever they are known to contain the full answer. The tails are filled with new messages as they
+     *  are stored and with the results of such requests, up to maxBacklogTailLength messages per buffer. All
+     *  sessions together keep at most backlogTailBudget bytes; beyond that, the least recently used tails of
+     *  the session are dropped.
+     */
+    void addToBacklogTail(const MessageList &messages);
+
+    //! Forget the tail of a buffer whose messages changed in storage (e.g. removed or merged into another buffer)
+    void dropBacklogTail(BufferId bufferId);
+
+    //! Remove the messages older than before from the tail of a buffer, after they were deleted from storage
+    void pruneBacklogTail(BufferId bufferId, MsgId before);
+
+    //! Hit count, miss count, and size of the backlog tails, for CoreInfo
+    QVariantMap backlogTailStats() const;
+
+    static const int maxBacklogTailLength = 500;
+    static const int backlogTailBudget = 64*1024*1024;
+
 public slots:
     virtual QVariantList requestBacklog(BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
     virtual QVariantList requestBacklogAll(MsgId first = -1, MsgId last = -1, int limit = -1, int additional = 0);
+    virtual QVariantList requestBacklogSearch(QString query, QVariantList bufferIds, QDateTime start, QDateTime end, int limit = -1, MsgId last = -1);
 
 private:
+    struct BacklogTail {
+        BacklogTail() : coveredFrom(-1), size(0), lastUse(0) {}
+        MessageList messages; // oldest first
+        MsgId coveredFrom;    // all messages of the buffer with an id >= coveredFrom are in messages; -1 for all
+        int size;
+        quint64 lastUse;
+    };
+
+    QList<Message> requestMsgs(BufferId bufferId, MsgId first, MsgId last, int limit);
+    bool requestMsgsFromTail(BufferId bufferId, MsgId first, MsgId last, int limit, QList<Message> &messages);
+    void fillBacklogTail(BufferId bufferId, MsgId first, int limit, const QList<Message> &messages);
+    void trimBacklogTail(BacklogTail &tail, int length);
+    void removeBacklogTail(QHash<BufferId, BacklogTail>::iterator tail);
+    void enforceBacklogTailBudget(BufferId keep);
+
+    static int messageSize(const Message &msg);
+
     CoreSession *_coreSession;
+
+    QHash<BufferId, BacklogTail> _backlogTails;
+    int _backlogTailSize;
+    int _backlogTailMessages;
+    quint64 _backlogTailUses;
+    quint64 _backlogTailHits;
+    quint64 _backlogTailMisses;
+
+    static QAtomicInt _totalBacklogTailSize; // of all sessions
 };
 
 
@@ -21,6 +21,7 @@
 #include "corebuffersyncer.h"
 
 #include "core.h"
+#include "corebacklogmanager.h"
 #include "coresession.h"
 #include "corenetwork.h"
 #include "ircchannel.h"
@@ -32,44 +33,110 @@ public:
 };
 
 
+const int CoreBufferSyncer::_storeDelay = 2000;
+const int CoreBufferSyncer::_maxStoreDelay = 30000;
+
 INIT_SYNCABLE_OBJECT(CoreBufferSyncer)
 CoreBufferSyncer::CoreBufferSyncer(CoreSession *parent)
     : BufferSyncer(Core::bufferLastSeenMsgIds(parent->user()), Core::bufferMarkerLineMsgIds(parent->user()), parent),
     _coreSession(parent),
     _purgeBuffers(false)
 {
+    _pendingSyncTimer.setSingleShot(true);
+    _pendingSyncTimer.setInterval(0);
+    connect(&_pendingSyncTimer, SIGNAL(timeout()), this, SLOT(syncPendingIds()));
+
+    _storeTimer.setSingleShot(true);
+    connect(&_storeTimer, SIGNAL(timeout()), this, SLOT(storeDirtyIds()));
+    _unsavedSince.invalidate();
 }
 
 
 void CoreBufferSyncer::requestSetLastSeenMsg(BufferId buffer, const MsgId &msgId)
 {
-    if (setLastSeenMsg(buffer, msgId))
-        dirtyLastSeenBuffers << buffer;
+    if (!buffer.isValid() || !msgId.isValid())
+        return;
+
+    // Clients send these while scrolling through a buffer, so only the newest one per tick goes out
+    MsgId &pending = _pendingLastSeenMsgs[buffer];
+    if (!pending.isValid() || pending < msgId)
+        pending = msgId;
+    _pendingSyncTimer.start();
 }
 
 
 void CoreBufferSyncer::requestSetMarkerLine(BufferId buffer, const MsgId &msgId)
 {
-    if (setMarkerLine(buffer, msgId))
-        dirtyMarkerLineBuffers << buffer;
+    if (!buffer.isValid() || !msgId.isValid())
+        return;
+
+    // The marker line may also move backwards, so the latest request wins
+    _pendingMarkerLines[buffer] = msgId;
+    _pendingSyncTimer.start();
+}
+
+
+void CoreBufferSyncer::syncPendingIds()
+{
+    _pendingSyncTimer.stop();
+
+    QHash<BufferId, MsgId>::const_iterator iter = _pendingLastSeenMsgs.constBegin();
+    while (iter != _pendingLastSeenMsgs.constEnd()) {
+        if (setLastSeenMsg(iter.key(), iter.value()))
+            dirtyLastSeenBuffers << iter.key();
+        ++iter;
+    }
+    _pendingLastSeenMsgs.clear();
+
+    iter = _pendingMarkerLines.constBegin();
+    while (iter != _pendingMarkerLines.constEnd()) {
+        if (setMarkerLine(iter.key(), iter.value()))
+            dirtyMarkerLineBuffers << iter.key();
+        ++iter;
+    }
+    _pendingMarkerLines.clear();
+
+    if (!dirtyLastSeenBuffers.isEmpty() || !dirtyMarkerLineBuffers.isEmpty())
+        scheduleStore();
+}
+
+
+void CoreBufferSyncer::scheduleStore()
+{
+    // Every new change pushes the store back, so a burst of changes ends up in a single batch
+    if (!_unsavedSince.isValid())
+        _unsavedSince.start();
+
+    int delay = qMin<qint64>(_storeDelay, _maxStoreDelay - _unsavedSince.elapsed());
+    _storeTimer.start(qMax(delay, 0));
 }
 
 
 void CoreBufferSyncer::storeDirtyIds()
 {
+    syncPendingIds();
+    _storeTimer.stop();
+    _unsavedSince.invalidate();
+
     UserId userId = _coreSession->user();
+    QHash<BufferId, MsgId> msgIds;
     MsgId msgId;
     foreach(BufferId bufferId, dirtyLastSeenBuffers) {
         msgId = lastSeenMsg(bufferId);
         if (msgId.isValid())
-            Core::setBufferLastSeenMsg(userId, bufferId, msgId);
+            msgIds[bufferId] = msgId;
     }
+    if (!msgIds.isEmpty())
+        Core::setBufferLastSeenMsgs(userId, msgIds);
 
+    msgIds.clear();
     foreach(BufferId bufferId, dirtyMarkerLineBuffers) {
         msgId = markerLine(bufferId);
         if (msgId.isValid())
-            Core::setBufferMarkerLineMsg(userId, bufferId, msgId);
+            msgIds[bufferId] = msgId;
     }
+    if (!msgIds.isEmpty())
+        Core::setBufferMarkerLineMsgs(userId, msgIds);
 
     dirtyLastSeenBuffers.clear();
     dirtyMarkerLineBuffers.clear();
@@ -101,8 +168,13 @@ void CoreBufferSyncer::removeBuffer(BufferId bufferId)
             return;
         }
     }
-    if (Core::removeBuffer(_coreSession->user(), bufferId))
+    if (Core::removeBuffer(_coreSession->user(), bufferId)) {
+        _coreSession->uncacheBufferInfo(bufferInfo);
+        _coreSession->backlogManager()->dropBacklogTail(bufferId);
+        _pendingLastSeenMsgs.remove(bufferId);
+        _pendingMarkerLines.remove(bufferId);
         BufferSyncer::removeBuffer(bufferId);
+    }
 }
 
 
@@ -119,8 +191,12 @@ void CoreBufferSyncer::renameBuffer(BufferId bufferId, QString newName)
         return;
     }
 
-    if (Core::renameBuffer(_coreSession->user(), bufferId, newName))
+    if (Core::renameBuffer(_coreSession->user(), bufferId, newName)) {
+        _coreSession->uncacheBufferInfo(bufferInfo);
+        _coreSession->cacheBufferInfo(BufferInfo(bufferId, bufferInfo.networkId(), bufferInfo.type(), bufferInfo.groupId(), newName));
+        _coreSession->backlogManager()->dropBacklogTail(bufferId); // the cached messages still carry the old name
         BufferSyncer::renameBuffer(bufferId, newName);
+    }
 }
 
 
@@ -139,6 +215,11 @@ void CoreBufferSyncer::mergeBuffersPermanently(BufferId bufferId1, BufferId buff
     }
 
     if (Core::mergeBuffersPermanently(_coreSession->user(), bufferId1, bufferId2)) {
+        _coreSession->uncacheBufferInfo(bufferInfo2);
+        _coreSession->backlogManager()->dropBacklogTail(bufferId1);
+        _coreSession->backlogManager()->dropBacklogTail(bufferId2);
+        _pendingLastSeenMsgs.remove(bufferId2);
+        _pendingMarkerLines.remove(bufferId2);
         BufferSyncer::mergeBuffersPermanently(bufferId1, bufferId2);
     }
 }
@@ -168,6 +249,7 @@ void CoreBufferSyncer::purgeBufferIds()
 {
     _purgeBuffers = false;
     QList<BufferInfo> bufferInfos = Core::requestBuffers(_coreSession->user());
+    _coreSession->loadBufferInfoCache(bufferInfos);
     QSet<BufferId> actualBuffers;
     foreach(BufferInfo bufferInfo, bufferInfos) {
         actualBuffers << bufferInfo.bufferId();
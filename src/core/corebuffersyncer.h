@@ -21,6 +21,9 @@
 #ifndef COREBUFFERSYNCER_H
 #define COREBUFFERSYNCER_H
 
+#include <QElapsedTimer>
+#include <QTimer>
+
 #include "buffersyncer.h"
 
 class CoreSession;
@@ -55,13 +58,30 @@ public slots:
 protected:
     virtual void customEvent(QEvent *event);
 
+private slots:
+    void syncPendingIds();
+
 private:
+    void scheduleStore();
+
     CoreSession *_coreSession;
     bool _purgeBuffers;
 
     QSet<BufferId> dirtyLastSeenBuffers;
     QSet<BufferId> dirtyMarkerLineBuffers;
 
+    // Requests received within one event loop iteration, synced to the clients together
+    QHash<BufferId, MsgId> _pendingLastSeenMsgs;
+    QHash<BufferId, MsgId> _pendingMarkerLines;
+    QTimer _pendingSyncTimer;
+
+    // Dirty ids are stored once no request came in for _storeDelay ms, but no later than
+    // _maxStoreDelay ms after the first unsaved change
+    QTimer _storeTimer;
+    QElapsedTimer _unsavedSince;
+    static const int _storeDelay;
+    static const int _maxStoreDelay;
+
     void purgeBufferIds();
 };
 
@@ -21,6 +21,8 @@
 #include "corecoreinfo.h"
 
 #include "core.h"
+#include "corebacklogmanager.h"
+#include "corenetwork.h"
 #include "coresession.h"
 #include "quassel.h"
 #include "signalproxy.h"
@@ -40,5 +42,16 @@ QVariantMap CoreCoreInfo::coreData() const
     data["quasselBuildDate"] = Quassel::buildInfo().buildDate;
     data["startTime"] = Core::instance()->startTime();
     data["sessionConnectedClients"] = _coreSession->signalProxy()->peerCount();
+
+    // milliseconds spent on the incoming data of each network
+    QVariantMap processingTimes;
+    foreach(const CoreNetwork *net, _coreSession->networks())
+        processingTimes[QString::number(net->networkId().toInt())] = net->processingTime();
+    data["networkProcessingTimes"] = processingTimes;
+
+    QVariantMap backlogTailStats = _coreSession->backlogManager()->backlogTailStats();
+    QVariantMap::const_iterator iter = backlogTailStats.constBegin();
+    for (; iter != backlogTailStats.constEnd(); ++iter)
+        data[iter.key()] = iter.value();
     return data;
 }
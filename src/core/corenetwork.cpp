@@ -18,6 +18,7 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
  ***************************************************************************/
 
+#include <QElapsedTimer>
 #include <QHostInfo>
 
 #include "corenetwork.h"
@@ -39,6 +40,8 @@ CoreNetwork::CoreNetwork(const NetworkId &networkid, CoreSession *session)
 
     _previousConnectionAttemptFailed(false),
     _lastUsedServerIndex(0),
+    _readScheduled(false),
+    _processingTime(0),
 
     _lastPingTime(0),
     _pingCount(0),
@@ -424,7 +427,12 @@ void CoreNetwork::setMyNick(const QString &mynick)
 
 void CoreNetwork::socketHasData()
 {
-    while (socket.canReadLine()) {
+    _readScheduled = false;
+
+    QElapsedTimer timer;
+    timer.start();
+    int lines = 0;
+    while (socket.canReadLine() && lines++ < _maxLinesPerBatch) {
         QByteArray s = socket.readLine();
         if (s.endsWith("\r\n"))
             s.chop(2);
@@ -434,6 +442,13 @@ void CoreNetwork::socketHasData()
         event->setTimestamp(QDateTime::currentDateTimeUtc());
         emit newEvent(event);
     }
+    _processingTime += timer.nsecsElapsed();
+
+    // Let the other networks (and clients) have their turn before handling the rest
+    if (socket.canReadLine() && !_readScheduled) {
+        _readScheduled = true;
+        QTimer::singleShot(0, this, SLOT(socketHasData()));
+    }
 }
 
 
@@ -597,7 +612,7 @@ void CoreNetwork::networkInitialized()
         startAutoWhoCycle(); // FIXME wait for autojoin to be completed
     }
 
-    Core::bufferInfo(userId(), networkId(), BufferInfo::StatusBuffer); // create status buffer
+    coreSession()->cachedBufferInfo(networkId(), BufferInfo::StatusBuffer); // create status buffer
     Core::setNetworkConnected(userId(), networkId(), true);
 }
 
@@ -91,6 +91,9 @@ public:
 
     inline UserId userId() const { return _coreSession->user(); }
 
+    //! Time spent handling incoming data of this network (parsing and processing events), in milliseconds
+    inline qint64 processingTime() const { return _processingTime / 1000000; }
+
     inline QAbstractSocket::SocketState socketState() const { return socket.state(); }
     inline bool socketConnected() const { return socket.state() == QAbstractSocket::ConnectedState; }
     inline QHostAddress localAddress() const { return socket.localAddress(); }
@@ -365,6 +368,11 @@ private:
     bool _previousConnectionAttemptFailed;
     int _lastUsedServerIndex;
 
+    // Incoming lines are handled in batches, so a busy network doesn't hold up the others of the session
+    static const int _maxLinesPerBatch = 50;
+    bool _readScheduled;
+    qint64 _processingTime; // in nanoseconds
+
     QTimer _pingTimer;
     uint _lastPingTime;
     uint _pingCount;
@@ -21,6 +21,7 @@
 #include "coresession.h"
 
 #include <QtScript>
+#include <QUuid>
 
 #include "core.h"
 #include "coreuserinputhandler.h"
@@ -88,6 +89,7 @@ CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
 
     p->attachSlot(SIGNAL(sendInput(BufferInfo, QString)), this, SLOT(msgFromClient(BufferInfo, QString)));
     p->attachSignal(this, SIGNAL(displayMsg(Message)));
+    p->attachSignal(this, SIGNAL(displayMessages(QVariantList)));
     p->attachSignal(this, SIGNAL(displayStatusMsg(QString, QString)));
 
     p->attachSignal(this, SIGNAL(identityCreated(const Identity &)));
@@ -103,7 +105,15 @@ CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
     p->attachSlot(SIGNAL(changePassword(PeerPtr,QString,QString,QString)), this, SLOT(changePassword(PeerPtr,QString,QString,QString)));
     p->attachSignal(this, SIGNAL(passwordChanged(PeerPtr,bool)));
 
+    QElapsedTimer timer;
+    timer.start();
+
+    // one query for all buffers, instead of one per buffer as messages come in
+    loadBufferInfoCache(Core::requestBuffers(user()));
+    qint64 bufferTime = timer.restart();
+
     loadSettings();
+    qint64 settingsTime = timer.restart();
     initScriptEngine();
 
     eventManager()->registerObject(ircParser(), EventManager::NormalPriority);
@@ -118,6 +128,9 @@ CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
     // periodically save our session state
     connect(&(Core::instance()->syncTimer()), SIGNAL(timeout()), this, SLOT(saveSessionState()));
 
+    // expired messages must not be served from the backlog tails anymore
+    connect(Core::instance(), SIGNAL(backlogPruned(BufferId, MsgId)), this, SLOT(backlogPruned(BufferId, MsgId)));
+
     p->synchronize(_bufferSyncer);
     p->synchronize(&aliasManager());
     p->synchronize(_backlogManager);
@@ -126,10 +139,13 @@ CoreSession::CoreSession(UserId uid, bool restoreState, QObject *parent)
     p->synchronize(&_coreInfo);
     p->synchronize(&_ignoreListManager);
     p->synchronize(transferManager());
+    qint64 setupTime = timer.restart();
     // Restore session state
     if (restoreState)
         restoreSessionState();
 
+    qDebug() << qPrintable(QString("Session for user %1 set up: buffers %2 ms, identities and networks %3 ms, rest %4 ms, reconnect %5 ms")
+                           .arg(user().toInt()).arg(bufferTime).arg(settingsTime).arg(setupTime).arg(timer.elapsed()));
     emit initialized();
 }
 
@@ -200,6 +216,12 @@ void CoreSession::saveSessionState() const
 }
 
 
+void CoreSession::backlogPruned(BufferId bufferId, MsgId before)
+{
+    _backlogManager->pruneBacklogTail(bufferId, before);
+}
+
+
 void CoreSession::restoreSessionState()
 {
     QList<NetworkId> nets = Core::connectedNetworks(user());
@@ -207,14 +229,35 @@ void CoreSession::restoreSessionState()
     foreach(NetworkId id, nets) {
         net = network(id);
         Q_ASSERT(net);
-        net->connectToIrc();
+        // other sessions are being restored as well, so don't hit the same server all at once
+        QString host = net->serverList().isEmpty() ? net->networkName() : net->serverList().first().host;
+        int delay = Core::reconnectDelay(host);
+        if (delay > 0)
+            QTimer::singleShot(delay, net, SLOT(connectToIrc()));
+        else
+            net->connectToIrc();
     }
 }
 
 
 void CoreSession::addClient(RemotePeer *peer)
 {
-    peer->dispatch(sessionState());
+    if (!(peer->features() & Quassel::ResumableSessions)) {
+        peer->dispatch(sessionState());
+        signalProxy()->addPeer(peer);
+        return;
+    }
+
+    // A client that still has the state of its previous connection only needs the messages it missed
+    bool resumed = signalProxy()->canResume(peer->resumeToken(), peer->resumeCount(), peer->features());
+    QByteArray token = resumed ? peer->resumeToken() : QUuid::createUuid().toByteArray();
+    Protocol::SessionState state = resumed ? Protocol::SessionState() : sessionState();
+    state.resumeToken = token;
+    state.resumed = resumed;
+    peer->dispatch(state);
+
+    // Start logging (and replay missed messages) before addPeer(), which may already send messages to the client
+    signalProxy()->startMessageLog(peer, token, resumed ? peer->resumeCount() : 0);
     signalProxy()->addPeer(peer);
 }
 
@@ -318,34 +361,29 @@ void CoreSession::processMessages()
     if (_messageQueue.count() == 1) {
         const RawMessage &rawMsg = _messageQueue.first();
         bool createBuffer = !(rawMsg.flags & Message::Redirected);
-        BufferInfo bufferInfo = Core::bufferInfo(user(), rawMsg.networkId, rawMsg.bufferType, rawMsg.target, createBuffer);
+        BufferInfo bufferInfo = cachedBufferInfo(rawMsg.networkId, rawMsg.bufferType, rawMsg.target, createBuffer);
         if (!bufferInfo.isValid()) {
             Q_ASSERT(!createBuffer);
-            bufferInfo = Core::bufferInfo(user(), rawMsg.networkId, BufferInfo::StatusBuffer, "");
+            bufferInfo = cachedBufferInfo(rawMsg.networkId, BufferInfo::StatusBuffer, "");
         }
         Message msg(bufferInfo, rawMsg.type, rawMsg.text, rawMsg.sender, rawMsg.flags);
-        if(Core::storeMessage(msg))
+        if(Core::storeMessage(msg)) {
+            _backlogManager->addToBacklogTail(MessageList() << msg);
             emit displayMsg(msg);
+        }
     }
     else {
-        QHash<NetworkId, QHash<QString, BufferInfo> > bufferInfoCache;
         MessageList messages;
         QList<RawMessage> redirectedMessages; // list of Messages which don't enforce a buffer creation
         BufferInfo bufferInfo;
         for (int i = 0; i < _messageQueue.count(); i++) {
             const RawMessage &rawMsg = _messageQueue.at(i);
-            if (bufferInfoCache.contains(rawMsg.networkId) && bufferInfoCache[rawMsg.networkId].contains(rawMsg.target)) {
-                bufferInfo = bufferInfoCache[rawMsg.networkId][rawMsg.target];
-            }
-            else {
-                bool createBuffer = !(rawMsg.flags & Message::Redirected);
-                bufferInfo = Core::bufferInfo(user(), rawMsg.networkId, rawMsg.bufferType, rawMsg.target, createBuffer);
-                if (!bufferInfo.isValid()) {
-                    Q_ASSERT(!createBuffer);
-                    redirectedMessages << rawMsg;
-                    continue;
-                }
-                bufferInfoCache[rawMsg.networkId][rawMsg.target] = bufferInfo;
+            bool createBuffer = !(rawMsg.flags & Message::Redirected);
+            bufferInfo = cachedBufferInfo(rawMsg.networkId, rawMsg.bufferType, rawMsg.target, createBuffer);
+            if (!bufferInfo.isValid()) {
+                Q_ASSERT(!createBuffer);
+                redirectedMessages << rawMsg;
+                continue;
             }
             Message msg(bufferInfo, rawMsg.type, rawMsg.text, rawMsg.sender, rawMsg.flags);
             messages << msg;
@@ -354,24 +392,19 @@ void CoreSession::processMessages()
         // recheck if there exists a buffer to store a redirected message in
         for (int i = 0; i < redirectedMessages.count(); i++) {
             const RawMessage &rawMsg = redirectedMessages.at(i);
-            if (bufferInfoCache.contains(rawMsg.networkId) && bufferInfoCache[rawMsg.networkId].contains(rawMsg.target)) {
-                bufferInfo = bufferInfoCache[rawMsg.networkId][rawMsg.target];
-            }
-            else {
+            // the storage has already been asked above, so only buffers created meanwhile can show up in the cache
+            bufferInfo = bufferInfoFromCache(rawMsg.networkId, rawMsg.target);
+            if (!bufferInfo.isValid()) {
                 // no luck -> we store them in the StatusBuffer
-                bufferInfo = Core::bufferInfo(user(), rawMsg.networkId, BufferInfo::StatusBuffer, "");
-                // add the StatusBuffer to the Cache in case there are more Messages for the original target
-                bufferInfoCache[rawMsg.networkId][rawMsg.target] = bufferInfo;
+                bufferInfo = cachedBufferInfo(rawMsg.networkId, BufferInfo::StatusBuffer, "");
             }
             Message msg(bufferInfo, rawMsg.type, rawMsg.text, rawMsg.sender, rawMsg.flags);
             messages << msg;
         }
 
         if(Core::storeMessages(messages)) {
-            // FIXME: extend protocol to a displayMessages(MessageList)
-            for (int i = 0; i < messages.count(); i++) {
-                emit displayMsg(messages[i]);
-            }
+            _backlogManager->addToBacklogTail(messages);
+            sendMessagesToClients(messages);
         }
     }
     _processMessages = false;
@@ -379,6 +412,76 @@ void CoreSession::processMessages()
 }
 
 
+// Clients that support it get the whole batch in a single displayMessages() call, older ones one displayMsg() per message.
+// The logs of disconnected clients that may resume get the messages in the same format as their client would.
+void CoreSession::sendMessagesToClients(const MessageList &messages)
+{
+    signalProxy()->restrictTargetFeature(Quassel::BatchedMessages, true, [&] {
+        QVariantList messageList;
+        foreach(const Message &msg, messages) {
+            messageList << QVariant::fromValue<Message>(msg);
+        }
+        emit displayMessages(messageList);
+    });
+
+    signalProxy()->restrictTargetFeature(Quassel::BatchedMessages, false, [&] {
+        for (int i = 0; i < messages.count(); i++) {
+            emit displayMsg(messages[i]);
+        }
+    });
+}
+
+
+BufferInfo CoreSession::bufferInfoFromCache(NetworkId networkId, const QString &bufferName) const
+{
+    QHash<NetworkId, QHash<QString, BufferInfo> >::const_iterator netIter = _bufferInfoCache.constFind(networkId);
+    if (netIter == _bufferInfoCache.constEnd())
+        return BufferInfo();
+
+    return netIter->value(bufferName.toLower());
+}
+
+
+BufferInfo CoreSession::cachedBufferInfo(NetworkId networkId, BufferInfo::Type type, const QString &bufferName, bool create)
+{
+    BufferInfo bufferInfo = bufferInfoFromCache(networkId, bufferName);
+    if (bufferInfo.isValid())
+        return bufferInfo;
+
+    bufferInfo = Core::bufferInfo(user(), networkId, type, bufferName, create);
+    if (bufferInfo.isValid())
+        _bufferInfoCache[networkId][bufferName.toLower()] = bufferInfo;
+    return bufferInfo;
+}
+
+
+void CoreSession::loadBufferInfoCache(const QList<BufferInfo> &bufferInfos)
+{
+    _bufferInfoCache.clear();
+    foreach(const BufferInfo &bufferInfo, bufferInfos) {
+        cacheBufferInfo(bufferInfo);
+    }
+}
+
+
+void CoreSession::cacheBufferInfo(const BufferInfo &bufferInfo)
+{
+    _bufferInfoCache[bufferInfo.networkId()][bufferInfo.bufferName().toLower()] = bufferInfo;
+}
+
+
+void CoreSession::uncacheBufferInfo(const BufferInfo &bufferInfo)
+{
+    QHash<NetworkId, QHash<QString, BufferInfo> >::iterator netIter = _bufferInfoCache.find(bufferInfo.networkId());
+    if (netIter == _bufferInfoCache.end())
+        return;
+
+    QHash<QString, BufferInfo>::iterator iter = netIter->find(bufferInfo.bufferName().toLower());
+    if (iter != netIter->end() && iter->bufferId() == bufferInfo.bufferId())
+        netIter->erase(iter);
+}
+
+
 Protocol::SessionState CoreSession::sessionState() const
 {
     QVariantList bufferInfos;
@@ -491,7 +594,7 @@ void CoreSession::createNetwork(const NetworkInfo &info_, const QStringList &per
                 qWarning() << QString("Invalid persistent channel declaration: %1").arg(channel);
                 continue;
             }
-            Core::bufferInfo(user(), info.networkId, BufferInfo::ChannelBuffer, rx.cap(1), true);
+            cachedBufferInfo(info.networkId, BufferInfo::ChannelBuffer, rx.cap(1), true);
             Core::setChannelPersistent(user(), info.networkId, rx.cap(1), true);
             if (!rx.cap(2).isEmpty())
                 Core::setPersistentChannelKey(user(), info.networkId, rx.cap(1), rx.cap(2));
@@ -554,7 +657,9 @@ void CoreSession::destroyNetwork(NetworkId id)
         // remove buffers from syncer
         foreach(BufferId bufferId, removedBuffers) {
             _bufferSyncer->removeBuffer(bufferId);
+            _backlogManager->dropBacklogTail(bufferId);
         }
+        _bufferInfoCache.remove(id);
         emit networkRemoved(id);
         net->deleteLater();
     }
@@ -563,7 +668,7 @@ void CoreSession::destroyNetwork(NetworkId id)
 
 void CoreSession::renameBuffer(const NetworkId &networkId, const QString &newName, const QString &oldName)
 {
-    BufferInfo bufferInfo = Core::bufferInfo(user(), networkId, BufferInfo::QueryBuffer, oldName, false);
+    BufferInfo bufferInfo = cachedBufferInfo(networkId, BufferInfo::QueryBuffer, oldName, false);
     if (bufferInfo.isValid()) {
         _bufferSyncer->renameBuffer(bufferInfo.bufferId(), newName);
     }
@@ -66,13 +66,26 @@ public:
     QList<BufferInfo> buffers() const;
     inline UserId user() const { return _user; }
     CoreNetwork *network(NetworkId) const;
+    inline QList<CoreNetwork *> networks() const { return _networks.values(); }
     CoreIdentity *identity(IdentityId) const;
     inline CoreNetworkConfig *networkConfig() const { return _networkConfig; }
     NetworkConnection *networkConnection(NetworkId) const;
 
     Protocol::SessionState sessionState() const;
 
+    //! Get the BufferInfo for a buffer name, only asking the storage if it isn't cached yet
+    /** Buffer names are compared case insensitively, in the same way the storage backends match them.
+     *  \sa Core::bufferInfo()
+     */
+    BufferInfo cachedBufferInfo(NetworkId networkId, BufferInfo::Type type, const QString &bufferName = "", bool create = true);
+
+    //! Replace the contents of the BufferInfo cache, e.g. with all buffers of the user at session start
+    void loadBufferInfoCache(const QList<BufferInfo> &bufferInfos);
+    void cacheBufferInfo(const BufferInfo &bufferInfo);
+    void uncacheBufferInfo(const BufferInfo &bufferInfo);
+
     inline SignalProxy *signalProxy() const { return _signalProxy; }
+    inline CoreBacklogManager *backlogManager() const { return _backlogManager; }
 
     const AliasManager &aliasManager() const { return _aliasManager; }
     AliasManager &aliasManager() { return _aliasManager; }
@@ -140,6 +153,8 @@ signals:
 
     //void msgFromGui(uint netid, QString buf, QString message);
     void displayMsg(Message message);
+    //! A batch of new messages, for clients supporting Quassel::BatchedMessages
+    void displayMessages(QVariantList messages);
     void displayStatusMsg(QString, QString);
 
     void scriptResult(QString result);
@@ -182,8 +197,12 @@ private slots:
 
     void saveSessionState() const;
 
+    void backlogPruned(BufferId bufferId, MsgId before);
+
 private:
     void processMessages();
+    void sendMessagesToClients(const MessageList &messages);
+    BufferInfo bufferInfoFromCache(NetworkId networkId, const QString &bufferName) const;
 
     void loadSettings();
     void initScriptEngine();
@@ -218,6 +237,8 @@ private:
 
     QList<RawMessage> _messageQueue;
     bool _processMessages;
+    // lowercased buffer names per network, kept for the whole session
+    QHash<NetworkId, QHash<QString, BufferInfo> > _bufferInfoCache;
     CoreIgnoreListManager _ignoreListManager;
 };
 
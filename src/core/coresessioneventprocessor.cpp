@@ -1228,6 +1228,7 @@ void CoreSessionEventProcessor::handleCtcpDcc(CtcpEvent *e)
 
     // normal:  SEND <filename> <ip> <port> [<filesize>]
     // reverse: SEND <filename> <ip> 0 <filesize> <token>
+    // resume:  ACCEPT <filename> <port> <position> (answer to our RESUME)
     QStringList params = e->param().split(' ');
     if (params.count()) {
         QString cmd = params[0].toUpper();
@@ -1266,9 +1267,27 @@ void CoreSessionEventProcessor::handleCtcpDcc(CtcpEvent *e)
 
             // TODO: check if target is the right thing to use for the partner
             CoreTransfer *transfer = new CoreTransfer(Transfer::Receive, e->target(), filename, address, port, size, this);
+            transfer->setNetwork(coreNetwork(e));
             coreSession()->signalProxy()->synchronize(transfer);
             coreSession()->transferManager()->addTransfer(transfer);
         }
+        else if (cmd == "ACCEPT") {
+            if (params.count() < 4) {
+                qWarning() << "Invalid DCC ACCEPT request:" << e;
+                return;
+            }
+            quint16 port = params[2].toUShort();
+            quint64 pos = params[3].toULongLong();
+            CoreTransferManager *manager = coreSession()->transferManager();
+            foreach(const QUuid &uuid, manager->transferIds()) {
+                CoreTransfer *transfer = manager->transfer(uuid);
+                if (transfer && transfer->isWaitingForResume() && transfer->network() == coreNetwork(e)
+                    && transfer->port() == port && transfer->nick().compare(e->target(), Qt::CaseInsensitive) == 0) {
+                    transfer->resumeAccepted(pos);
+                    break;
+                }
+            }
+        }
         else {
             emit newEvent(new MessageEvent(Message::Error, e->network(), tr("DCC %1 not supported").arg(cmd), e->prefix(), e->target(), Message::None, e->timestamp()));
             return;
@@ -44,6 +44,12 @@ QVariant CoreSettings::storageSettings(const QVariant &def)
 }
 
 
+QVariant CoreSettings::retentionSettings(const QVariant &def)
+{
+    return localValue("RetentionSettings", def);
+}
+
+
 // FIXME remove
 QVariant CoreSettings::oldDbSettings()
 {
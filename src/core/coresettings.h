@@ -34,6 +34,8 @@ public:
 
     QVariant oldDbSettings();  // FIXME remove
 
+    QVariant retentionSettings(const QVariant &def = QVariant());
+
     void setCoreState(const QVariant &data);
     QVariant coreState(const QVariant &def = QVariant());
 };
@@ -20,25 +20,50 @@
 
 #include <QtEndian>
 
-#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QTcpSocket>
+#include <QTimer>
 
+#include "corenetwork.h"
+#include "coresession.h"
 #include "coretransfer.h"
+#include "ctcpparser.h"
+#include "quassel.h"
 
-const qint64 chunkSize = 16 * 1024;
+const qint64 chunkSize = 64 * 1024;         // data is relayed to the client in chunks of up to this size
+const qint64 windowSize = 1024 * 1024;      // max. data relayed to a client that hasn't written it yet
+const int maxChunksPerRead = 4;             // so a fast transfer doesn't hold up the rest of the session
+const quint32 maxFileChunk = 1024 * 1024;   // max. data served per requestFileChunk() call
+const int resumeTimeout = 30000;            // ms to wait for a DCC ACCEPT before starting over
 
 INIT_SYNCABLE_OBJECT(CoreTransfer)
 
+QMutex CoreTransfer::_partFilesMutex;
+QSet<QString> CoreTransfer::_partFiles;
+
 CoreTransfer::CoreTransfer(Direction direction, const QString &nick, const QString &fileName, const QHostAddress &address, quint16 port, quint64 fileSize, QObject *parent)
     : Transfer(direction, nick, fileName, address, port, fileSize, parent),
     _socket(0),
     _pos(0),
-    _reading(false)
+    _ackedPos(0),
+    _readScheduled(false),
+    _storeOnCore(false),
+    _resumeRequested(false),
+    _file(0)
 {
 
 }
 
 
+CoreTransfer::~CoreTransfer()
+{
+    closeDownloadFile();
+}
+
+
 void CoreTransfer::cleanUp()
 {
     if (_socket) {
@@ -48,7 +73,11 @@ void CoreTransfer::cleanUp()
     }
 
     _buffer.clear();
-    _reading = false;
+    _readScheduled = false;
+    _resumeRequested = false;
+
+    // an incomplete download stays on disk, so a later attempt can resume it
+    closeDownloadFile();
 }
 
 
@@ -87,6 +116,21 @@ void CoreTransfer::requestAccepted(PeerPtr peer)
 }
 
 
+void CoreTransfer::requestAcceptedOnCore(PeerPtr peer)
+{
+    if (_peer || _storeOnCore || state() != New)
+        return; // transfer was already accepted
+
+    // The core receives the file on its own, so no client needs to stay connected
+    _storeOnCore = true;
+    setState(Pending);
+
+    emit accepted(peer);
+
+    start();
+}
+
+
 void CoreTransfer::requestRejected(PeerPtr peer)
 {
     if (_peer || state() != New)
@@ -99,15 +143,219 @@ void CoreTransfer::requestRejected(PeerPtr peer)
 }
 
 
+void CoreTransfer::requestDataAcknowledged(PeerPtr peer, quint64 pos)
+{
+    if (!_peer || peer != _peer)
+        return;
+
+    if (pos > _ackedPos) {
+        _ackedPos = pos;
+        scheduleRead(); // in case we stopped reading because the window was full
+    }
+}
+
+
+void CoreTransfer::requestFileChunk(PeerPtr peer, quint64 offset, quint32 size)
+{
+    if (!peer || !storedOnCore())
+        return;
+
+    QFile file(_storedPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "DCC: Could not open" << _storedPath << "for reading:" << file.errorString();
+        return;
+    }
+    QByteArray data;
+    if (offset < (quint64)file.size() && file.seek(offset))
+        data = file.read(qMin(size, maxFileChunk));
+
+    // an empty chunk tells the client that there is nothing more to fetch
+    SYNC_OTHER(fileChunkReceived, ARG(peer), ARG(offset), ARG(data));
+}
+
+
 void CoreTransfer::start()
 {
-    if (!_peer || state() != Pending || direction() != Receive)
+    if ((!_peer && !_storeOnCore) || state() != Pending || direction() != Receive)
         return;
 
+    if (_storeOnCore) {
+        if (!openDownloadFile())
+            return;
+
+        if (_pos > 0 && _network) {
+            // Ask the sender to continue where the previous attempt stopped. Senders that don't
+            // support resuming never answer, so we start over after a while.
+            _resumeRequested = true;
+            _network->coreSession()->ctcpParser()->query(_network, nick(), "DCC",
+                QString("RESUME %1 %2 %3").arg(fileName()).arg(port()).arg(_pos));
+            QTimer::singleShot(resumeTimeout, this, SLOT(onResumeTimeout()));
+            return;
+        }
+        _pos = 0;
+    }
+
     setupConnectionForReceive();
 }
 
 
+void CoreTransfer::resumeAccepted(quint64 pos)
+{
+    if (!_resumeRequested || !_file)
+        return;
+
+    _resumeRequested = false;
+    // the sender would skip data we never got, so the file would end up corrupted
+    if (pos > _pos) {
+        setError(tr("Could not resume %1: the sender wants to continue at byte %2, but only %3 bytes were received").arg(_file->fileName()).arg(pos).arg(_pos));
+        return;
+    }
+    _pos = pos;
+    if (!_file->resize(_pos) || !_file->seek(_pos)) {
+        setError(tr("Could not resume %1: %2").arg(_file->fileName(), _file->errorString()));
+        return;
+    }
+
+    setupConnectionForReceive();
+}
+
+
+void CoreTransfer::onResumeTimeout()
+{
+    if (!_resumeRequested)
+        return;
+
+    qDebug() << "DCC: No answer to resume request, starting over";
+    _resumeRequested = false;
+    _pos = 0;
+    if (!_file->resize(0) || !_file->seek(0)) {
+        setError(tr("Could not write to %1: %2").arg(_file->fileName(), _file->errorString()));
+        return;
+    }
+
+    setupConnectionForReceive();
+}
+
+
+QString CoreTransfer::downloadDir() const
+{
+    return QDir(Quassel::configDirPath()).filePath(QString("downloads/%1").arg(_network->coreSession()->user().toInt()));
+}
+
+
+bool CoreTransfer::openDownloadFile()
+{
+    if (_file)
+        return true;
+
+    if (!_network) {
+        setError(tr("Network for DCC receive is gone!"));
+        return false;
+    }
+
+    QDir dir(downloadDir());
+    if (!dir.mkpath(".")) {
+        setError(tr("Could not create download directory %1").arg(dir.path()));
+        return false;
+    }
+
+    // Never let the sender pick a path outside of the download directory
+    QString name = QFileInfo(QString(fileName()).replace('\\', '/')).fileName();
+    while (name.startsWith('.'))
+        name.remove(0, 1);
+    if (name.isEmpty())
+        name = "download";
+    _storedPath = dir.filePath(name);
+
+    // Only resume what is known to be the same file, i.e. the same name and size offered by the same nick
+    QByteArray key = QCryptographicHash::hash(QString("%1\n%2\n%3").arg(nick().toLower(), fileName()).arg(fileSize()).toUtf8(),
+                                              QCryptographicHash::Sha1).toHex().left(12);
+    QString partPath = QString("%1.%2.part").arg(_storedPath, QString(key));
+    {
+        QMutexLocker locker(&_partFilesMutex);
+        if (_partFiles.contains(partPath)) {
+            locker.unlock();
+            setError(tr("%1 is already being downloaded").arg(name));
+            return false;
+        }
+        _partFiles.insert(partPath);
+    }
+
+    _file = new QFile(partPath, this);
+    if (!_file->open(QIODevice::ReadWrite)) {
+        setError(tr("Could not open %1 for writing: %2").arg(_file->fileName(), _file->errorString()));
+        closeDownloadFile();
+        return false;
+    }
+
+    // resume a previous attempt if there is one
+    quint64 partSize = _file->size();
+    _pos = (partSize > 0 && partSize < fileSize()) ? partSize : 0;
+    if (!_file->resize(_pos) || !_file->seek(_pos)) {
+        setError(tr("Could not write to %1: %2").arg(_file->fileName(), _file->errorString()));
+        return false;
+    }
+    return true;
+}
+
+
+void CoreTransfer::closeDownloadFile()
+{
+    if (!_file)
+        return;
+
+    {
+        QMutexLocker locker(&_partFilesMutex);
+        _partFiles.remove(_file->fileName());
+    }
+    _file->close();
+    delete _file;
+    _file = 0;
+}
+
+
+bool CoreTransfer::storeData(const QByteArray &data)
+{
+    if (_file->write(data) != data.size()) {
+        setError(tr("Could not write to %1: %2").arg(_file->fileName(), _file->errorString()));
+        return false;
+    }
+    return true;
+}
+
+
+void CoreTransfer::finishDownloadFile()
+{
+    QString partPath = _file->fileName();
+    _file->close();
+
+    // don't overwrite earlier downloads of the same name
+    QString path = _storedPath;
+    QFileInfo info(_storedPath);
+    for (int i = 1; QFile::exists(path); ++i) {
+        QString name = info.completeBaseName() + QString("-%1").arg(i);
+        if (!info.suffix().isEmpty())
+            name += '.' + info.suffix();
+        path = info.dir().filePath(name);
+    }
+
+    if (!_file->rename(path)) {
+        setError(tr("Could not rename %1 to %2: %3").arg(_file->fileName(), path, _file->errorString()));
+        return;
+    }
+    {
+        QMutexLocker locker(&_partFilesMutex);
+        _partFiles.remove(partPath);
+    }
+    delete _file;
+    _file = 0;
+
+    _storedPath = path;
+    setStoredOnCore(true);
+    setState(Completed);
+}
+
+
 void CoreTransfer::setupConnectionForReceive()
 {
     if (port() == 0) {
@@ -118,6 +366,8 @@ void CoreTransfer::setupConnectionForReceive()
     setState(Connecting);
 
     _socket = new QTcpSocket(this);
+    // Don't buffer more than a window, so the sender slows down if the client can't keep up
+    _socket->setReadBufferSize(windowSize);
     connect(_socket, SIGNAL(connected()), SLOT(startReceiving()));
     connect(_socket, SIGNAL(disconnected()), SLOT(onSocketDisconnected()));
     connect(_socket, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(onSocketError(QAbstractSocket::SocketError)));
@@ -135,20 +385,31 @@ void CoreTransfer::startReceiving()
 
 void CoreTransfer::onDataReceived()
 {
-    if (_reading) // since we're spinning the event loop, we may get another readyRead() and thus reentrancy
+    _readScheduled = false;
+    if (!_socket)
         return;
-    _reading = true;
 
-    while (_socket->bytesAvailable()) {
-        QByteArray data = _socket->read(chunkSize);
+    bool flowControl = !_storeOnCore && _peer && (_peer->features() & Quassel::TransferFlowControl);
+    bool moreToRead = false;
+    for (int chunks = 0; _socket->bytesAvailable(); ++chunks) {
+        if (chunks == maxChunksPerRead) {
+            moreToRead = true;
+            break;
+        }
+        qint64 maxSize = chunkSize;
+        if (flowControl) {
+            maxSize = qMin(maxSize, windowSize - (qint64)(_pos - _ackedPos));
+            if (maxSize <= 0)
+                break; // wait for the client to catch up, requestDataAcknowledged() continues
+        }
+        QByteArray data = _socket->read(maxSize);
         _pos += data.size();
-        if (!relayData(data, true))
-            return;
-
-        QCoreApplication::processEvents();  // don't block the rest of the core/client communication
-        if (!_socket)  // just in case something happened during spinning the event loop that killed our socket
+        if (!(_storeOnCore ? storeData(data) : relayData(data, true)))
             return;
     }
+    // don't keep a partial chunk around, the client couldn't acknowledge it
+    if (!_storeOnCore && !_buffer.isEmpty() && !relayData(QByteArray(), false))
+        return;
 
     // Send ack to sender. The DCC protocol only specifies 32 bit values, but modern clients (i.e. those who can send files
     // larger than 4 GB) will ignore this anyway...
@@ -161,11 +422,26 @@ void CoreTransfer::onDataReceived()
     }
     else if (_pos == fileSize()) {
         qDebug() << "DCC Receive: Transfer finished";
-        if (relayData(QByteArray(), false)) // empty buffer
+        if (_storeOnCore)
+            finishDownloadFile();
+        else if (relayData(QByteArray(), false)) // empty buffer
             setState(Completed);
+        return;
     }
 
-    _reading = false;
+    // let the rest of the session run before reading more
+    if (moreToRead)
+        scheduleRead();
+}
+
+
+void CoreTransfer::scheduleRead()
+{
+    if (_readScheduled || !_socket || state() != Transferring)
+        return;
+
+    _readScheduled = true;
+    QTimer::singleShot(0, this, SLOT(onDataReceived()));
 }
 
 
@@ -21,11 +21,15 @@
 #ifndef CORETRANSFER_H
 #define CORETRANSFER_H
 
+#include <QMutex>
 #include <QPointer>
+#include <QSet>
 
 #include "transfer.h"
 #include "peer.h"
 
+class CoreNetwork;
+class QFile;
 class QTcpSocket;
 
 class CoreTransfer : public Transfer
@@ -35,6 +39,17 @@ class CoreTransfer : public Transfer
 
 public:
     CoreTransfer(Direction direction, const QString &nick, const QString &fileName, const QHostAddress &address, quint16 port, quint64 size = 0, QObject *parent = 0);
+    ~CoreTransfer();
+
+    //! The network the transfer was offered on, needed for negotiating a resume with the sender
+    inline void setNetwork(CoreNetwork *network) { _network = network; }
+    inline CoreNetwork *network() const { return _network; }
+
+    //! Whether we asked the sender to resume the transfer (DCC RESUME) and are still waiting for the answer
+    inline bool isWaitingForResume() const { return _resumeRequested; }
+
+    //! The sender agreed to resume the transfer at pos (DCC ACCEPT)
+    void resumeAccepted(quint64 pos);
 
 public slots:
     void start();
@@ -42,23 +57,45 @@ public slots:
     // called through sync calls
     void requestAccepted(PeerPtr peer);
     void requestRejected(PeerPtr peer);
+    void requestDataAcknowledged(PeerPtr peer, quint64 pos);
+    void requestAcceptedOnCore(PeerPtr peer);
+    void requestFileChunk(PeerPtr peer, quint64 offset, quint32 size);
 
 private slots:
     void startReceiving();
     void onDataReceived();
     void onSocketDisconnected();
     void onSocketError(QAbstractSocket::SocketError error);
+    void onResumeTimeout();
 
 private:
     void setupConnectionForReceive();
     bool relayData(const QByteArray &data, bool requireChunkSize);
+    bool storeData(const QByteArray &data);
+    void scheduleRead();
+    bool openDownloadFile();
+    void closeDownloadFile();
+    void finishDownloadFile();
+    QString downloadDir() const;
     virtual void cleanUp();
 
     QPointer<Peer> _peer;
     QTcpSocket *_socket;
     quint64 _pos;
+    quint64 _ackedPos; // data the client has written already, if it supports flow control
     QByteArray _buffer;
-    bool _reading;
+    bool _readScheduled;
+
+    // for receiving into the core's download directory
+    QPointer<CoreNetwork> _network;
+    bool _storeOnCore;
+    bool _resumeRequested;
+    QFile *_file;
+    QString _storedPath;
+
+    // the partial files currently written to by any transfer, as sessions run in their own threads
+    static QMutex _partFilesMutex;
+    static QSet<QString> _partFiles;
 };
 
 #endif
@@ -20,21 +20,69 @@
 
 #include "postgresqlstorage.h"
 
+#include <QThread>
+#include <QWaitCondition>
 #include <QtSql>
 
 #include "logger.h"
 #include "network.h"
 #include "quassel.h"
 
+// Copies the existing messages on a connection of its own, so neither the core nor the sessions wait for it
+class PostgreSqlStorage::PartitionThread : public QThread
+{
+public:
+    PartitionThread(PostgreSqlStorage *storage) : QThread(storage), _storage(storage), _stopped(false) {}
+
+    void stop()
+    {
+        QMutexLocker locker(&_mutex);
+        _stopped = true;
+        _stopCondition.wakeOne();
+    }
+
+protected:
+    void run()
+    {
+        while (_storage->partitionBacklogStep()) {
+            // leave the writers some time between two chunks
+            QMutexLocker locker(&_mutex);
+            if (!_stopped)
+                _stopCondition.wait(&_mutex, _stepPause);
+            if (_stopped)
+                break;
+        }
+        _storage->releaseConnection();
+    }
+
+private:
+    PostgreSqlStorage *_storage;
+    QMutex _mutex;
+    QWaitCondition _stopCondition;
+    bool _stopped;
+
+    static const int _stepPause = 100; // ms
+};
+
+
 PostgreSqlStorage::PostgreSqlStorage(QObject *parent)
     : AbstractSqlStorage(parent),
-    _port(-1)
+    _port(-1),
+    _batchInsertAvailable(false),
+    _partitionLimit(0),
+    _partitionMsgId(0),
+    _partitionEndMsgId(0),
+    _partitionThread(0)
 {
 }
 
 
 PostgreSqlStorage::~PostgreSqlStorage()
 {
+    if (_partitionThread) {
+        _partitionThread->stop();
+        _partitionThread->wait();
+    }
 }
 
 
@@ -52,6 +100,55 @@ AbstractSqlMigrationWriter *PostgreSqlStorage::createMigrationWriter()
 }
 
 
+Storage::State PostgreSqlStorage::init(const QVariantMap &settings)
+{
+    State state = AbstractSqlStorage::init(settings);
+    if (state != IsReady)
+        return state;
+
+    QMutexLocker locker(&_partitionMutex);
+    _partitionParent = QString();
+    _partitionMsgId = 0;
+    _partitionEndMsgId = 0;
+    _partitionLimit = loadBacklogPartitions("backlog");
+    if (_partitionLimit > 0) {
+        _partitionParent = "backlog";
+        return state;
+    }
+
+    // see if there's an unfinished conversion, new messages have to be mirrored into it
+    QSqlQuery progressQuery(logDb());
+    progressQuery.prepare(queryString("select_partition_progress"));
+    progressQuery.exec();
+    if (watchQuery(progressQuery) && progressQuery.next()) {
+        do {
+            if (progressQuery.value(0).toString() == "partitionmsgid")
+                _partitionMsgId = progressQuery.value(1).toInt();
+            else
+                _partitionEndMsgId = progressQuery.value(1).toInt();
+        } while (progressQuery.next());
+        _partitionParent = "backlog_partitioned";
+        _partitionLimit = loadBacklogPartitions(_partitionParent);
+    }
+    return state;
+}
+
+
+void PostgreSqlStorage::activate()
+{
+    QMutexLocker locker(&_partitionMutex);
+    if (_partitionParent == "backlog_partitioned") {
+        quInfo() << "Resuming the conversion to a partitioned backlog";
+        startPartitionThread();
+    }
+    else if (_partitionParent.isEmpty() && Quassel::isOptionSet("partition-backlog")) {
+        locker.unlock();
+        if (startBacklogPartitioning())
+            startPartitionThread();
+    }
+}
+
+
 bool PostgreSqlStorage::isAvailable() const
 {
     qDebug() << QSqlDatabase::drivers();
@@ -144,6 +241,10 @@ bool PostgreSqlStorage::initDbSession(QSqlDatabase &db)
         return false;
     }
 
+    // All connections talk to the same server, so every session comes to the same conclusion here
+    QSqlQuery versionQuery = db.exec("SHOW server_version_num");
+    _batchInsertAvailable = versionQuery.first() && versionQuery.value(0).toInt() >= 90500;
+
     return true;
 }
 
@@ -1028,8 +1129,7 @@ BufferInfo PostgreSqlStorage::bufferInfo(UserId user, const NetworkId &networkId
         return BufferInfo();
     }
 
-    QSqlQuery query(db);
-    query.prepare(queryString("select_bufferByName"));
+    QSqlQuery query = cachedQuery("select_bufferByName", db);
     query.bindValue(":networkid", networkId.toInt());
     query.bindValue(":userid", user.toInt());
     query.bindValue(":buffercname", buffer.toLower());
@@ -1056,8 +1156,7 @@ BufferInfo PostgreSqlStorage::bufferInfo(UserId user, const NetworkId &networkId
         return BufferInfo();
     }
 
-    QSqlQuery createQuery(db);
-    createQuery.prepare(queryString("insert_buffer"));
+    QSqlQuery createQuery = cachedQuery("insert_buffer", db);
     createQuery.bindValue(":userid", user.toInt());
     createQuery.bindValue(":networkid", networkId.toInt());
     createQuery.bindValue(":buffertype", (int)type);
@@ -1083,8 +1182,8 @@ BufferInfo PostgreSqlStorage::bufferInfo(UserId user, const NetworkId &networkId
 
 BufferInfo PostgreSqlStorage::getBufferInfo(UserId user, const BufferId &bufferId)
 {
-    QSqlQuery query(logDb());
-    query.prepare(queryString("select_buffer_by_id"));
+    QSqlDatabase db = logDb();
+    QSqlQuery query = cachedQuery("select_buffer_by_id", db);
     query.bindValue(":userid", user.toInt());
     query.bindValue(":bufferid", bufferId.toInt());
     safeExec(query);
@@ -1277,8 +1376,8 @@ bool PostgreSqlStorage::mergeBuffersPermanently(const UserId &user, const Buffer
 
 void PostgreSqlStorage::setBufferLastSeenMsg(UserId user, const BufferId &bufferId, const MsgId &msgId)
 {
-    QSqlQuery query(logDb());
-    query.prepare(queryString("update_buffer_lastseen"));
+    QSqlDatabase db = logDb();
+    QSqlQuery query = cachedQuery("update_buffer_lastseen", db);
 
     query.bindValue(":userid", user.toInt());
     query.bindValue(":bufferid", bufferId.toInt());
@@ -1288,6 +1387,41 @@ void PostgreSqlStorage::setBufferLastSeenMsg(UserId user, const BufferId &buffer
 }
 
 
+void PostgreSqlStorage::setBufferLastSeenMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds)
+{
+    if (msgIds.isEmpty())
+        return;
+
+    QVariantList bufferIds;
+    QVariantList messageIds;
+    QHash<BufferId, MsgId>::const_iterator iter = msgIds.constBegin();
+    while (iter != msgIds.constEnd()) {
+        bufferIds << iter.key().toInt();
+        messageIds << iter.value().toInt();
+        ++iter;
+    }
+
+    QSqlDatabase db = logDb();
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::setBufferLastSeenMsgs(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return;
+    }
+
+    // a single UPDATE ... FROM unnest(...) covers the whole batch
+    QStringList params;
+    params << QString::number(user.toInt())
+           << formatArray(bufferIds, "integer", db)
+           << formatArray(messageIds, "integer", db);
+    QSqlQuery query = prepareAndExecuteQuery("update_buffer_lastseen_batch", params.join(", "), db);
+    if (!watchQuery(query)) {
+        db.rollback();
+        return;
+    }
+    db.commit();
+}
+
+
 QHash<BufferId, MsgId> PostgreSqlStorage::bufferLastSeenMsgIds(UserId user)
 {
     QHash<BufferId, MsgId> lastSeenHash;
@@ -1319,8 +1453,8 @@ QHash<BufferId, MsgId> PostgreSqlStorage::bufferLastSeenMsgIds(UserId user)
 
 void PostgreSqlStorage::setBufferMarkerLineMsg(UserId user, const BufferId &bufferId, const MsgId &msgId)
 {
-    QSqlQuery query(logDb());
-    query.prepare(queryString("update_buffer_markerlinemsgid"));
+    QSqlDatabase db = logDb();
+    QSqlQuery query = cachedQuery("update_buffer_markerlinemsgid", db);
 
     query.bindValue(":userid", user.toInt());
     query.bindValue(":bufferid", bufferId.toInt());
@@ -1330,6 +1464,41 @@ void PostgreSqlStorage::setBufferMarkerLineMsg(UserId user, const BufferId &buff
 }
 
 
+void PostgreSqlStorage::setBufferMarkerLineMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds)
+{
+    if (msgIds.isEmpty())
+        return;
+
+    QVariantList bufferIds;
+    QVariantList messageIds;
+    QHash<BufferId, MsgId>::const_iterator iter = msgIds.constBegin();
+    while (iter != msgIds.constEnd()) {
+        bufferIds << iter.key().toInt();
+        messageIds << iter.value().toInt();
+        ++iter;
+    }
+
+    QSqlDatabase db = logDb();
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::setBufferMarkerLineMsgs(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return;
+    }
+
+    // a single UPDATE ... FROM unnest(...) covers the whole batch
+    QStringList params;
+    params << QString::number(user.toInt())
+           << formatArray(bufferIds, "integer", db)
+           << formatArray(messageIds, "integer", db);
+    QSqlQuery query = prepareAndExecuteQuery("update_buffer_markerlinemsgid_batch", params.join(", "), db);
+    if (!watchQuery(query)) {
+        db.rollback();
+        return;
+    }
+    db.commit();
+}
+
+
 QHash<BufferId, MsgId> PostgreSqlStorage::bufferMarkerLineMsgIds(UserId user)
 {
     QHash<BufferId, MsgId> markerLineHash;
@@ -1412,6 +1581,7 @@ bool PostgreSqlStorage::logMessage(Message &msg)
     db.commit();
     if (msgId.isValid()) {
         msg.setMsgId(msgId);
+        ensureBacklogPartitions(msgId);
         return true;
     }
     else {
@@ -1429,6 +1599,9 @@ bool PostgreSqlStorage::logMessages(MessageList &msgs)
         return false;
     }
 
+    if (_batchInsertAvailable)
+        return logMessagesBatched(msgs, db);
+
     QList<int> senderIdList;
     QHash<QString, int> senderIds;
     QSqlQuery addSenderQuery;
@@ -1498,6 +1671,100 @@ bool PostgreSqlStorage::logMessages(MessageList &msgs)
     }
 
     db.commit();
+    if (!msgs.isEmpty())
+        ensureBacklogPartitions(msgs.last().msgId());
+    return true;
+}
+
+
+// Does the same as the loops in logMessages(), but with a constant number of statements per batch.
+// Expects a transaction to be open on db, and commits or rolls it back.
+bool PostgreSqlStorage::logMessagesBatched(MessageList &msgs, QSqlDatabase &db)
+{
+    QVariantList senders;
+    QHash<QString, int> senderIds;
+    for (int i = 0; i < msgs.count(); i++) {
+        const QString &sender = msgs.at(i).sender();
+        if (!senderIds.contains(sender)) {
+            senderIds[sender] = 0;
+            senders << sender;
+        }
+    }
+
+    // Most senders are known already, so we only touch the sender table for the new ones
+    QSqlQuery selectSendersQuery = prepareAndExecuteQuery("select_senderids", formatArray(senders, "text", db), db);
+    if (!watchQuery(selectSendersQuery)) {
+        db.rollback();
+        return false;
+    }
+    while (selectSendersQuery.next())
+        senderIds[selectSendersQuery.value(1).toString()] = selectSendersQuery.value(0).toInt();
+
+    QVariantList newSenders;
+    foreach(const QVariant &sender, senders) {
+        if (!senderIds[sender.toString()])
+            newSenders << sender;
+    }
+    if (!newSenders.isEmpty()) {
+        // The upsert also returns the ids of senders added by another thread in the meantime
+        QSqlQuery addSendersQuery = prepareAndExecuteQuery("insert_senders", formatArray(newSenders, "text", db), db);
+        if (!watchQuery(addSendersQuery)) {
+            db.rollback();
+            return false;
+        }
+        while (addSendersQuery.next())
+            senderIds[addSendersQuery.value(1).toString()] = addSendersQuery.value(0).toInt();
+    }
+
+    // The ids are drawn up front, so each message is inserted with the id it is known by. Sorted, so the
+    // messages still get ascending ids in the order of msgs.
+    QSqlQuery msgIdsQuery = prepareAndExecuteQuery("select_new_messageids", QString::number(msgs.count()), db);
+    if (!watchQuery(msgIdsQuery)) {
+        db.rollback();
+        return false;
+    }
+    QList<int> msgIds;
+    while (msgIdsQuery.next())
+        msgIds << msgIdsQuery.value(0).toInt();
+    if (msgIds.count() != msgs.count()) {
+        qWarning() << "PostgreSqlStorage::logMessages(): got" << msgIds.count() << "ids for" << msgs.count() << "messages!";
+        db.rollback();
+        return false;
+    }
+    qSort(msgIds);
+
+    QVariantList ids, timestamps, bufferIds, types, flags, msgSenderIds, contents;
+    for (int i = 0; i < msgs.count(); i++) {
+        const Message &msg = msgs.at(i);
+        ids << msgIds.at(i);
+        timestamps << msg.timestamp();
+        bufferIds << msg.bufferInfo().bufferId().toInt();
+        types << (int)msg.type();
+        flags << (int)msg.flags();
+        msgSenderIds << senderIds.value(msg.sender());
+        contents << msg.contents();
+    }
+
+    QStringList params;
+    params << formatArray(ids, "integer", db)
+           << formatArray(timestamps, "timestamp", db)
+           << formatArray(bufferIds, "integer", db)
+           << formatArray(types, "integer", db)
+           << formatArray(flags, "integer", db)
+           << formatArray(msgSenderIds, "integer", db)
+           << formatArray(contents, "text", db);
+    QSqlQuery logMessagesQuery = prepareAndExecuteQuery("insert_messages", params.join(", "), db);
+    if (!watchQuery(logMessagesQuery)) {
+        db.rollback();
+        return false;
+    }
+
+    for (int i = 0; i < msgs.count(); i++)
+        msgs[i].setMsgId(msgIds.at(i));
+
+    db.commit();
+    if (!msgIds.isEmpty())
+        ensureBacklogPartitions(msgIds.last());
     return true;
 }
 
@@ -1618,6 +1885,488 @@ QList<Message> PostgreSqlStorage::requestAllMsgs(UserId user, MsgId first, MsgId
 }
 
 
+QList<Message> PostgreSqlStorage::searchMsgs(UserId user, const QString &query, const QList<BufferId> &buffers, const QDateTime &start, const QDateTime &end, int limit, MsgId last)
+{
+    QList<Message> messagelist;
+    if (query.trimmed().isEmpty())
+        return messagelist;
+
+    // requestBuffers uses it's own transaction.
+    QHash<BufferId, BufferInfo> bufferInfoHash;
+    foreach(BufferInfo bufferInfo, requestBuffers(user)) {
+        bufferInfoHash[bufferInfo.bufferId()] = bufferInfo;
+    }
+
+    // search the buffers one by one, so each of them can use the index on bufferid
+    QList<BufferId> searchBuffers;
+    foreach(BufferId bufferId, buffers) {
+        if (bufferInfoHash.contains(bufferId))
+            searchBuffers << bufferId;
+    }
+    if (buffers.isEmpty())
+        searchBuffers << BufferId();
+
+    QSqlDatabase db = logDb();
+    if (!beginReadOnlyTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::searchMsgs(): cannot start read only transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return messagelist;
+    }
+
+    foreach(BufferId bufferId, searchBuffers) {
+        QVariantList params;
+        params << query;
+        if (bufferId.isValid())
+            params << bufferId.toInt();
+        else
+            params << user.toInt();
+        params << (last != -1 ? QVariant(last.toInt()) : QVariant(QVariant::Int))
+               << (start.isValid() ? QVariant(start.toUTC()) : QVariant(QVariant::DateTime))
+               << (end.isValid() ? QVariant(end.toUTC()) : QVariant(QVariant::DateTime))
+               << (limit != -1 ? QVariant(limit) : QVariant(QVariant::Int));
+
+        QSqlQuery searchQuery = executePreparedQuery(bufferId.isValid() ? "select_searchMessagesBuffer" : "select_searchMessages", params, db);
+        if (!watchQuery(searchQuery)) {
+            db.rollback();
+            return QList<Message>();
+        }
+
+        QDateTime timestamp;
+        while (searchQuery.next()) {
+            timestamp = searchQuery.value(2).toDateTime();
+            timestamp.setTimeSpec(Qt::UTC);
+            Message msg(timestamp,
+                bufferInfoHash[searchQuery.value(1).toInt()],
+                (Message::Type)searchQuery.value(3).toUInt(),
+                searchQuery.value(6).toString(),
+                searchQuery.value(5).toString(),
+                (Message::Flags)searchQuery.value(4).toUInt());
+            msg.setMsgId(searchQuery.value(0).toInt());
+            messagelist << msg;
+        }
+    }
+    db.commit();
+
+    if (searchBuffers.count() > 1) {
+        // merge the results of the single buffers
+        qSort(messagelist.begin(), messagelist.end(), qGreater<Message>());
+        if (limit != -1)
+            messagelist = messagelist.mid(0, limit);
+    }
+    return messagelist;
+}
+
+
+QList<BufferInfo> PostgreSqlStorage::allBuffers()
+{
+    QList<BufferInfo> bufferlist;
+
+    QSqlDatabase db = logDb();
+    if (!beginReadOnlyTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::allBuffers(): cannot start read only transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return bufferlist;
+    }
+
+    QSqlQuery query(db);
+    query.prepare(queryString("select_all_buffers"));
+    safeExec(query);
+    watchQuery(query);
+    while (query.next()) {
+        bufferlist << BufferInfo(query.value(0).toInt(), query.value(1).toInt(), (BufferInfo::Type)query.value(2).toInt(), query.value(3).toInt(), query.value(4).toString());
+    }
+    db.commit();
+    return bufferlist;
+}
+
+
+MsgId PostgreSqlStorage::retentionBoundary(const BufferId &bufferId, const QDateTime &keepSince, int keepCount)
+{
+    MsgId boundary;
+
+    QSqlDatabase db = logDb();
+    if (!beginReadOnlyTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::retentionBoundary(): cannot start read only transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return boundary;
+    }
+
+    if (keepSince.isValid()) {
+        QSqlQuery query(db);
+        query.prepare(queryString("select_retention_boundary_age"));
+        query.bindValue(":bufferid", bufferId.toInt());
+        query.bindValue(":keepsince", keepSince.toUTC());
+        safeExec(query);
+        if (watchQuery(query) && query.first())
+            boundary = query.value(0).toInt();
+    }
+    if (keepCount > 0) {
+        QSqlQuery query(db);
+        query.prepare(queryString("select_retention_boundary_count"));
+        query.bindValue(":bufferid", bufferId.toInt());
+        query.bindValue(":offset", keepCount - 1);
+        safeExec(query);
+        if (watchQuery(query) && query.first())
+            boundary = qMax(boundary, MsgId(query.value(0).toInt()));
+    }
+    db.commit();
+    return boundary;
+}
+
+
+bool PostgreSqlStorage::requestExpiredMsgs(const BufferInfo &bufferInfo, const MsgId &before, int limit, QList<Message> &messages)
+{
+    messages.clear();
+
+    QSqlDatabase db = logDb();
+    if (!beginReadOnlyTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::requestExpiredMsgs(): cannot start read only transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare(queryString("select_expired_messages"));
+    query.bindValue(":bufferid", bufferInfo.bufferId().toInt());
+    query.bindValue(":before", before.toInt());
+    query.bindValue(":limit", limit);
+    safeExec(query);
+    if (!watchQuery(query)) {
+        db.rollback();
+        return false;
+    }
+
+    QDateTime timestamp;
+    while (query.next()) {
+        timestamp = query.value(1).toDateTime();
+        timestamp.setTimeSpec(Qt::UTC);
+        Message msg(timestamp,
+            bufferInfo,
+            (Message::Type)query.value(2).toUInt(),
+            query.value(5).toString(),
+            query.value(4).toString(),
+            (Message::Flags)query.value(3).toUInt());
+        msg.setMsgId(query.value(0).toInt());
+        messages << msg;
+    }
+    db.commit();
+    return true;
+}
+
+
+int PostgreSqlStorage::pruneMsgs(const BufferId &bufferId, const MsgId &before, int limit)
+{
+    QSqlDatabase db = logDb();
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::pruneMsgs(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return -1;
+    }
+
+    QSqlQuery query(db);
+    query.prepare(queryString("delete_expired_messages"));
+    query.bindValue(":bufferid", bufferId.toInt());
+    query.bindValue(":before", before.toInt());
+    query.bindValue(":limit", limit);
+    safeExec(query);
+    if (!watchQuery(query)) {
+        db.rollback();
+        return -1;
+    }
+    int deleted = query.numRowsAffected();
+    db.commit();
+    return deleted;
+}
+
+
+qint64 PostgreSqlStorage::compactBacklog(const MsgId &prunedBefore)
+{
+    qint64 reclaimed = 0;
+    {
+        QSqlDatabase db = logDb();
+        reclaimed = dropEmptyBacklogPartitions(db);
+
+        // Making the space of the deleted rows reusable is left to autovacuum, which paces itself. Only the planner
+        // statistics of the tables that lost rows are updated right away, as ANALYZE just reads a sample of them.
+        QStringList tables;
+        {
+            QMutexLocker locker(&_partitionMutex);
+            if (_partitionParent == "backlog") {
+                QSqlQuery query(db);
+                query.prepare(queryString("select_backlog_partitions"));
+                query.bindValue(":parent", _partitionParent);
+                query.exec();
+                QRegExp partitionName("backlog_p(\\d+)");
+                while (watchQuery(query) && query.next()) {
+                    if (partitionName.exactMatch(query.value(0).toString())
+                        && partitionName.cap(1).toInt() * _partitionSize < prunedBefore.toInt())
+                        tables << query.value(0).toString();
+                }
+            }
+            else {
+                tables << "backlog";
+            }
+        }
+        foreach(const QString &table, tables) {
+            QSqlQuery analyzeQuery = db.exec(QString("ANALYZE %1").arg(table));
+            watchQuery(analyzeQuery);
+        }
+    }
+    // the pruner's thread ends after this
+    releaseConnection();
+    return reclaimed;
+}
+
+
+// Returns the end of the id range covered by the partitions of parent, or 0 if it has none
+int PostgreSqlStorage::loadBacklogPartitions(const QString &parent)
+{
+    QSqlQuery query(logDb());
+    query.prepare(queryString("select_backlog_partitions"));
+    query.bindValue(":parent", parent);
+    query.exec();
+    if (!watchQuery(query))
+        return 0;
+
+    int limit = 0;
+    QRegExp partitionName("backlog_p(\\d+)");
+    while (query.next()) {
+        if (partitionName.exactMatch(query.value(0).toString()))
+            limit = qMax(limit, (partitionName.cap(1).toInt() + 1) * _partitionSize);
+    }
+    return limit;
+}
+
+
+// Creates partitions of parent until there's a spare one after msgId. The caller must hold _partitionMutex.
+bool PostgreSqlStorage::createBacklogPartitions(QSqlDatabase &db, const QString &parent, int &limit, int msgId)
+{
+    while (limit < msgId + _partitionSize) {
+        QSqlQuery query = db.exec(QString("CREATE TABLE IF NOT EXISTS backlog_p%1 PARTITION OF %2 FOR VALUES FROM (%3) TO (%4)")
+                                  .arg(limit / _partitionSize).arg(parent).arg(limit).arg(limit + _partitionSize));
+        if (!watchQuery(query))
+            return false;
+        limit += _partitionSize;
+    }
+    return true;
+}
+
+
+// Called after storing messages, so there always is a partition for the next ones
+void PostgreSqlStorage::ensureBacklogPartitions(const MsgId &msgId)
+{
+    QMutexLocker locker(&_partitionMutex);
+    if (_partitionParent.isEmpty() || msgId.toInt() + _partitionSize / 2 < _partitionLimit)
+        return;
+
+    QSqlDatabase db = logDb();
+    if (!createBacklogPartitions(db, _partitionParent, _partitionLimit, msgId.toInt()))
+        qWarning() << "PostgreSqlStorage::ensureBacklogPartitions(): unable to create a partition for message" << msgId.toInt();
+}
+
+
+bool PostgreSqlStorage::startBacklogPartitioning()
+{
+    QMutexLocker locker(&_partitionMutex);
+    QSqlDatabase db = logDb();
+
+    // primary keys, foreign keys and ON CONFLICT for partitioned tables need PostgreSQL 11
+    QSqlQuery versionQuery = db.exec("SHOW server_version_num");
+    if (!versionQuery.first() || versionQuery.value(0).toInt() < 110000) {
+        quWarning() << "Partitioning the backlog requires PostgreSQL 11 or newer";
+        return false;
+    }
+
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::startBacklogPartitioning(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return false;
+    }
+
+    QStringList setupQueries;
+    setupQueries << queryString("create_backlog_partitioned")
+                 << queryString("create_backlog_partitioned_idx")
+                 << queryString("create_backlog_partitioned_messagetsv_idx")
+                 << queryString("create_backlog_partition_sync_function")
+                 // from here on, no messages are written until we commit
+                 << "LOCK TABLE backlog IN SHARE ROW EXCLUSIVE MODE";
+    foreach(QString queryString, setupQueries) {
+        QSqlQuery query = db.exec(queryString);
+        if (!watchQuery(query)) {
+            db.rollback();
+            return false;
+        }
+    }
+
+    // Everything up to the newest id handed out so far is copied in chunks, the trigger takes care of the rest
+    QSqlQuery maxMsgIdQuery(db);
+    maxMsgIdQuery.prepare(queryString("select_backlog_maxmsgid"));
+    maxMsgIdQuery.exec();
+    if (!watchQuery(maxMsgIdQuery) || !maxMsgIdQuery.first()) {
+        db.rollback();
+        return false;
+    }
+    int endMsgId = maxMsgIdQuery.value(0).toInt();
+
+    int limit = 0;
+    if (!createBacklogPartitions(db, "backlog_partitioned", limit, endMsgId)) {
+        db.rollback();
+        return false;
+    }
+
+    QSqlQuery triggerQuery = db.exec(queryString("create_backlog_partition_sync_trigger"));
+    QSqlQuery progressQuery(db);
+    progressQuery.prepare(queryString("insert_partition_progress"));
+    progressQuery.bindValue(":msgid", QString::number(0));
+    progressQuery.bindValue(":endmsgid", QString::number(endMsgId));
+    progressQuery.exec();
+    if (!watchQuery(triggerQuery) || !watchQuery(progressQuery) || !db.commit()) {
+        db.rollback();
+        return false;
+    }
+
+    _partitionParent = "backlog_partitioned";
+    _partitionLimit = limit;
+    _partitionMsgId = 0;
+    _partitionEndMsgId = endMsgId;
+    quInfo() << "Converting the backlog to a partitioned table, messages can be stored meanwhile";
+    return true;
+}
+
+
+void PostgreSqlStorage::startPartitionThread()
+{
+    if (_partitionThread)
+        return;
+
+    _partitionThread = new PartitionThread(this);
+    _partitionThread->start(QThread::LowPriority);
+}
+
+
+// Copies the next chunk of messages, returns false once there is nothing left to do
+bool PostgreSqlStorage::partitionBacklogStep()
+{
+    if (_partitionMsgId >= _partitionEndMsgId) {
+        if (finishBacklogPartitioning())
+            quInfo() << "The backlog is partitioned now";
+        return false;
+    }
+
+    QSqlDatabase db = logDb();
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::partitionBacklogStep(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return true;
+    }
+
+    // The copied rows are locked until we commit, so they can't change between being read and being written.
+    // Writers of other messages aren't held up.
+    int lastMsgId = qMin(_partitionMsgId + _partitionChunkSize, _partitionEndMsgId);
+    QSqlQuery chunkQuery(db);
+    chunkQuery.prepare(queryString("insert_backlog_partitioned_chunk"));
+    chunkQuery.bindValue(":firstmsg", _partitionMsgId);
+    chunkQuery.bindValue(":lastmsg", lastMsgId);
+    chunkQuery.exec();
+
+    QSqlQuery progressQuery(db);
+    progressQuery.prepare(queryString("update_partition_progress"));
+    progressQuery.bindValue(":msgid", QString::number(lastMsgId));
+    progressQuery.exec();
+
+    if (!watchQuery(chunkQuery) || !watchQuery(progressQuery) || !db.commit()) {
+        // try again after the pause
+        db.rollback();
+        return true;
+    }
+
+    int chunks = (_partitionEndMsgId + _partitionChunkSize - 1) / _partitionChunkSize;
+    if ((lastMsgId / _partitionChunkSize) % qMax(chunks / 100, 1) == 0)
+        quInfo() << qPrintable(tr("Backlog partitioning: %1% done").arg(100 * (qint64)lastMsgId / _partitionEndMsgId));
+    _partitionMsgId = lastMsgId;
+    return true;
+}
+
+
+bool PostgreSqlStorage::finishBacklogPartitioning()
+{
+    QMutexLocker locker(&_partitionMutex);
+    QSqlDatabase db = logDb();
+    if (!beginTransaction(db)) {
+        qWarning() << "PostgreSqlStorage::finishBacklogPartitioning(): cannot start transaction!";
+        qWarning() << " -" << qPrintable(db.lastError().text());
+        return false;
+    }
+
+    QStringList swapQueries;
+    swapQueries << "LOCK TABLE backlog IN ACCESS EXCLUSIVE MODE"
+                << "DROP TRIGGER backlog_partition_sync ON backlog"
+                // the sequence would go away with the old table otherwise
+                << "ALTER SEQUENCE backlog_messageid_seq OWNED BY backlog_partitioned.messageid"
+                << "DROP TABLE backlog"
+                << "ALTER TABLE backlog_partitioned RENAME TO backlog"
+                << "ALTER TABLE backlog RENAME CONSTRAINT backlog_partitioned_pkey TO backlog_pkey"
+                << "ALTER INDEX backlog_partitioned_bufferid_idx RENAME TO backlog_bufferid_idx"
+                << "ALTER INDEX backlog_partitioned_messagetsv_idx RENAME TO backlog_messagetsv_idx"
+                << "DROP FUNCTION backlog_partition_sync()"
+                << queryString("delete_partition_progress");
+    foreach(QString queryString, swapQueries) {
+        QSqlQuery query = db.exec(queryString);
+        if (!watchQuery(query)) {
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        db.rollback();
+        return false;
+    }
+
+    _partitionParent = "backlog";
+    return true;
+}
+
+
+// Messages are pruned from the oldest partitions first, so they end up empty. Dropping them returns
+// their space right away, which a VACUUM can't do.
+qint64 PostgreSqlStorage::dropEmptyBacklogPartitions(QSqlDatabase &db)
+{
+    QMutexLocker locker(&_partitionMutex);
+    if (_partitionParent != "backlog")
+        return 0;
+
+    QSqlQuery query(db);
+    query.prepare(queryString("select_backlog_partitions"));
+    query.bindValue(":parent", _partitionParent);
+    query.exec();
+    if (!watchQuery(query))
+        return 0;
+
+    QStringList partitions;
+    QRegExp partitionName("backlog_p(\\d+)");
+    while (query.next()) {
+        // leave the partitions alone that new messages (or cached ids of other connections) might still go to
+        if (partitionName.exactMatch(query.value(0).toString())
+            && (partitionName.cap(1).toInt() + 1) * _partitionSize <= _partitionLimit - 2 * _partitionSize)
+            partitions << query.value(0).toString();
+    }
+
+    qint64 reclaimed = 0;
+    foreach(const QString &partition, partitions) {
+        QSqlQuery emptyQuery = db.exec(QString("SELECT NOT EXISTS (SELECT 1 FROM %1)").arg(partition));
+        if (!emptyQuery.first() || !emptyQuery.value(0).toBool())
+            continue;
+
+        QSqlQuery sizeQuery = db.exec(QString("SELECT pg_total_relation_size('%1')").arg(partition));
+        qint64 size = sizeQuery.first() ? sizeQuery.value(0).toLongLong() : 0;
+        QSqlQuery dropQuery = db.exec(QString("DROP TABLE %1").arg(partition));
+        if (watchQuery(dropQuery))
+            reclaimed += size;
+    }
+    return reclaimed;
+}
+
+
 // void PostgreSqlStorage::safeExec(QSqlQuery &query) {
 //   qDebug() << "PostgreSqlStorage::safeExec";
 //   qDebug() << "   executing:\n" << query.executedQuery();
@@ -1665,9 +2414,28 @@ bool PostgreSqlStorage::beginReadOnlyTransaction(QSqlDatabase &db)
 
 QSqlQuery PostgreSqlStorage::prepareAndExecuteQuery(const QString &queryname, const QString &paramstring, QSqlDatabase &db)
 {
+    queryExecuted();
+
+    QSqlQuery query;
+
+    // Once we've seen a statement work on this connection, we can skip the savepoint dance below
+    if (isPreparedStatement(queryname)) {
+        if (paramstring.isNull())
+            query = db.exec(QString("EXECUTE quassel_%1").arg(queryname));
+        else
+            query = db.exec(QString("EXECUTE quassel_%1 (%2)").arg(queryname).arg(paramstring));
+
+        if (db.isOpen() && !query.lastError().isValid())
+            return query;
+
+        // The connection might have been lost or reset, or the backend discarded the statement. Forget about it
+        // and take the safe way below, which reconnects and prepares the statement again if needed. Within a
+        // transaction, the failed EXECUTE has aborted it already, so the caller will see an error in that case.
+        setPreparedStatement(queryname, false);
+    }
+
     // Query preparing is done lazily. That means that instead of always checking if the query is already prepared
     // we just EXECUTE and catch the error
-    QSqlQuery query;
 
     db.exec("SAVEPOINT quassel_prepare_query");
     if (paramstring.isNull()) {
@@ -1702,6 +2470,7 @@ QSqlQuery PostgreSqlStorage::prepareAndExecuteQuery(const QString &queryname, co
                 qWarning() << "  Error:" << db.lastError().text();
                 return QSqlQuery(db);
             }
+            queryPrepared();
         }
         // we always execute the query again, even if the query was already prepared.
         // this ensures, that the error is properly propagated to the calling function
@@ -1713,10 +2482,13 @@ QSqlQuery PostgreSqlStorage::prepareAndExecuteQuery(const QString &queryname, co
         else {
             query = db.exec(QString("EXECUTE quassel_%1 (%2)").arg(queryname).arg(paramstring));
         }
+        if (!query.lastError().isValid())
+            setPreparedStatement(queryname);
     }
     else {
         // only release the SAVEPOINT
         db.exec("RELEASE SAVEPOINT quassel_prepare_query");
+        setPreparedStatement(queryname);
     }
     return query;
 }
@@ -1762,14 +2534,38 @@ QSqlQuery PostgreSqlStorage::executePreparedQuery(const QString &queryname, cons
 }
 
 
+// Formats values as an array literal that can be passed to a prepared query
+QString PostgreSqlStorage::formatArray(const QVariantList &values, const QString &type, const QSqlDatabase &db)
+{
+    QSqlDriver *driver = db.driver();
+
+    QStringList elements;
+    QSqlField field;
+    for (int i = 0; i < values.count(); i++) {
+        const QVariant &value = values.at(i);
+        field.setType(value.type());
+        if (value.isNull())
+            field.clear();
+        else
+            field.setValue(value);
+
+        elements << driver->formatValue(field);
+    }
+    return QString("ARRAY[%1]::%2[]").arg(elements.join(", "), type);
+}
+
+
 void PostgreSqlStorage::deallocateQuery(const QString &queryname, const QSqlDatabase &db)
 {
     db.exec(QString("DEALLOCATE quassel_%1").arg(queryname));
+    setPreparedStatement(queryname, false);
 }
 
 
 void PostgreSqlStorage::safeExec(QSqlQuery &query)
 {
+    queryExecuted();
+
     // If the query fails due to the connection being gone, it seems to cause
     // exec() to return false but no lastError to be set
     if(!query.exec() && !query.lastError().isValid())
@@ -1799,26 +2595,27 @@ PostgreSqlMigrationWriter::PostgreSqlMigrationWriter()
 
 bool PostgreSqlMigrationWriter::prepareQuery(MigrationObject mo)
 {
+    // the objects that others depend on are updated in place when resyncing, the rest is written from scratch
     QString query;
     switch (mo) {
     case QuasselUser:
-        query = queryString("migrate_write_quasseluser");
+        query = queryString(resyncing() ? "migrate_upsert_quasseluser" : "migrate_write_quasseluser");
         break;
     case Sender:
-        query = queryString("migrate_write_sender");
+        query = queryString(resyncing() ? "migrate_upsert_sender" : "migrate_write_sender");
         break;
     case Identity:
         _validIdentities.clear();
-        query = queryString("migrate_write_identity");
+        query = queryString(resyncing() ? "migrate_upsert_identity" : "migrate_write_identity");
         break;
     case IdentityNick:
         query = queryString("migrate_write_identity_nick");
         break;
     case Network:
-        query = queryString("migrate_write_network");
+        query = queryString(resyncing() ? "migrate_upsert_network" : "migrate_write_network");
         break;
     case Buffer:
-        query = queryString("migrate_write_buffer");
+        query = queryString(resyncing() ? "migrate_upsert_buffer" : "migrate_write_buffer");
         break;
     case Backlog:
         query = queryString("migrate_write_backlog");
@@ -1957,6 +2754,125 @@ bool PostgreSqlMigrationWriter::writeMo(const BacklogMO &backlog)
     bindValue(4, (int)backlog.flags);
     bindValue(5, backlog.senderid);
     bindValue(6, backlog.message);
+    bindValue(7, backlog.message);
+    return exec();
+}
+
+
+// Uses one multi-row INSERT per chunk. QtSql can't speak the COPY protocol.
+bool PostgreSqlMigrationWriter::writeBacklogChunk(const QList<BacklogMO> &chunk)
+{
+    if (chunk.isEmpty())
+        return true;
+
+    QVariantList messageIds, times, bufferIds, types, flags, senderIds, messages;
+    foreach(const BacklogMO &backlog, chunk) {
+        messageIds << backlog.messageid.toInt();
+        times << backlog.time;
+        bufferIds << backlog.bufferid.toInt();
+        types << backlog.type;
+        flags << backlog.flags;
+        senderIds << backlog.senderid;
+        messages << backlog.message;
+    }
+
+    QSqlDatabase db = logDb();
+    QStringList params;
+    params << formatArray(messageIds, "integer", db)
+           << formatArray(times, "timestamp", db)
+           << formatArray(bufferIds, "integer", db)
+           << formatArray(types, "integer", db)
+           << formatArray(flags, "integer", db)
+           << formatArray(senderIds, "integer", db)
+           << formatArray(messages, "text", db);
+    QSqlQuery query = prepareAndExecuteQuery("migrate_write_backlog_chunk", params.join(", "), db);
+    return watchQuery(query);
+}
+
+
+int PostgreSqlMigrationWriter::migrationProgress()
+{
+    QSqlQuery query(logDb());
+    query.prepare(queryString("select_migration_progress"));
+    query.exec();
+    if (!watchQuery(query) || !query.first())
+        return -1;
+    return query.value(0).toInt();
+}
+
+
+bool PostgreSqlMigrationWriter::setMigrationProgress(const MsgId &msgId)
+{
+    QSqlQuery query(logDb());
+    query.prepare(queryString(migrationProgress() < 0 ? "insert_migration_progress" : "update_migration_progress"));
+    query.bindValue(":msgid", QString::number(msgId.toInt()));
+    query.exec();
+    return watchQuery(query);
+}
+
+
+bool PostgreSqlMigrationWriter::clearMigrationProgress()
+{
+    QSqlQuery query(logDb());
+    query.prepare(queryString("delete_migration_progress"));
+    query.exec();
+    return watchQuery(query);
+}
+
+
+bool PostgreSqlMigrationWriter::resetMigration()
+{
+    QSqlQuery query(logDb());
+    query.prepare(queryString("reset_migration"));
+    query.exec();
+    return watchQuery(query);
+}
+
+
+bool PostgreSqlMigrationWriter::removeStaleMos(MigrationObject mo, const QVariantList &keep)
+{
+    QString table, key;
+    switch (mo) {
+    case QuasselUser:
+        table = "quasseluser";
+        key = "userid";
+        break;
+    case Identity:
+        table = "identity";
+        key = "identityid";
+        break;
+    case IdentityNick:
+        table = "identity_nick";
+        key = "nickid";
+        break;
+    case Network:
+        table = "network";
+        key = "networkid";
+        break;
+    case Buffer:
+        table = "buffer";
+        key = "bufferid";
+        break;
+    case IrcServer:
+        table = "ircserver";
+        key = "serverid";
+        break;
+    case UserSetting:
+        if (!keep.isEmpty())
+            return false; // no single column key
+        table = "user_setting";
+        break;
+    default:
+        // senders are never deleted, and the backlog isn't resynced
+        return false;
+    }
+
+    QSqlDatabase db = logDb();
+    QString query = QString("DELETE FROM %1").arg(table);
+    if (!keep.isEmpty())
+        query += QString(" WHERE %1 <> ALL(%2)").arg(key, formatArray(keep, "integer", db));
+    resetQuery();
+    newQuery(query, db);
     return exec();
 }
 
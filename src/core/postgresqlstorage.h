@@ -23,6 +23,7 @@
 
 #include "abstractsqlstorage.h"
 
+#include <QMutex>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 
@@ -38,6 +39,8 @@ public:
 
 public slots:
     /* General */
+    virtual State init(const QVariantMap &settings = QVariantMap());
+    virtual void activate();
     virtual bool isAvailable() const;
     virtual QString displayName() const;
     virtual QString description() const;
@@ -92,8 +95,10 @@ public slots:
     virtual bool renameBuffer(const UserId &user, const BufferId &bufferId, const QString &newName);
     virtual bool mergeBuffersPermanently(const UserId &user, const BufferId &bufferId1, const BufferId &bufferId2);
     virtual void setBufferLastSeenMsg(UserId user, const BufferId &bufferId, const MsgId &msgId);
+    virtual void setBufferLastSeenMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds);
     virtual QHash<BufferId, MsgId> bufferLastSeenMsgIds(UserId user);
     virtual void setBufferMarkerLineMsg(UserId user, const BufferId &bufferId, const MsgId &msgId);
+    virtual void setBufferMarkerLineMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds);
     virtual QHash<BufferId, MsgId> bufferMarkerLineMsgIds(UserId user);
 
     /* Message handling */
@@ -101,6 +106,14 @@ public slots:
     virtual bool logMessages(MessageList &msgs);
     virtual QList<Message> requestMsgs(UserId user, BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1);
     virtual QList<Message> requestAllMsgs(UserId user, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual QList<Message> searchMsgs(UserId user, const QString &query, const QList<BufferId> &buffers, const QDateTime &start, const QDateTime &end, int limit = -1, MsgId last = -1);
+
+    /* Backlog retention */
+    virtual QList<BufferInfo> allBuffers();
+    virtual MsgId retentionBoundary(const BufferId &bufferId, const QDateTime &keepSince, int keepCount);
+    virtual bool requestExpiredMsgs(const BufferInfo &bufferInfo, const MsgId &before, int limit, QList<Message> &messages);
+    virtual int pruneMsgs(const BufferId &bufferId, const MsgId &before, int limit);
+    virtual qint64 compactBacklog(const MsgId &prunedBefore);
 
 protected:
     virtual bool initDbSession(QSqlDatabase &db);
@@ -121,6 +134,10 @@ protected:
 
     QSqlQuery executePreparedQuery(const QString &queryname, const QVariantList &params, QSqlDatabase &db);
     QSqlQuery executePreparedQuery(const QString &queryname, const QVariant &param, QSqlDatabase &db);
+    QString formatArray(const QVariantList &values, const QString &type, const QSqlDatabase &db);
+    inline bool upsertAvailable() const { return _batchInsertAvailable; }
+    QSqlQuery prepareAndExecuteQuery(const QString &queryname, const QString &paramstring, QSqlDatabase &db);
+    inline QSqlQuery prepareAndExecuteQuery(const QString &queryname, QSqlDatabase &db) { return prepareAndExecuteQuery(queryname, QString(), db); }
     void deallocateQuery(const QString &queryname, const QSqlDatabase &db);
 
     inline void savePoint(const QString &handle, const QSqlDatabase &db) { db.exec(QString("SAVEPOINT %1").arg(handle)); }
@@ -130,14 +147,43 @@ protected:
 private:
     void bindNetworkInfo(QSqlQuery &query, const NetworkInfo &info);
     void bindServerInfo(QSqlQuery &query, const Network::Server &server);
-    QSqlQuery prepareAndExecuteQuery(const QString &queryname, const QString &paramstring, QSqlDatabase &db);
-    inline QSqlQuery prepareAndExecuteQuery(const QString &queryname, QSqlDatabase &db) { return prepareAndExecuteQuery(queryname, QString(), db); }
+    bool logMessagesBatched(MessageList &msgs, QSqlDatabase &db);
 
     QString _hostName;
     int _port;
     QString _databaseName;
     QString _userName;
     QString _password;
+
+    // INSERT ... ON CONFLICT needs PostgreSQL 9.5
+    bool _batchInsertAvailable;
+
+private:
+    class PartitionThread;
+
+    /* The backlog can be range partitioned on messageid, with partitions named backlog_p<n> that hold
+     * _partitionSize ids each. Partitions are created ahead of the message ids in use. While an existing
+     * backlog is converted, new messages are mirrored into backlog_partitioned by a trigger. The existing
+     * messages are copied in chunks by a PartitionThread.
+     */
+    int loadBacklogPartitions(const QString &parent);
+    bool createBacklogPartitions(QSqlDatabase &db, const QString &parent, int &limit, int msgId);
+    void ensureBacklogPartitions(const MsgId &msgId);
+    bool startBacklogPartitioning();
+    bool partitionBacklogStep();
+    bool finishBacklogPartitioning();
+    void startPartitionThread();
+    qint64 dropEmptyBacklogPartitions(QSqlDatabase &db);
+
+    QMutex _partitionMutex;
+    QString _partitionParent; // the partitioned table new messages end up in, if any
+    int _partitionLimit; // messages with smaller ids have a partition
+    int _partitionMsgId; // messages up to this one have been converted already
+    int _partitionEndMsgId; // the newest message that needs to be converted; later ones are mirrored
+    PartitionThread *_partitionThread;
+
+    static const int _partitionSize = 10000000;
+    static const int _partitionChunkSize = 20000;
 };
 
 
@@ -161,6 +207,15 @@ public:
     virtual bool writeMo(const IrcServerMO &ircserver);
     virtual bool writeMo(const UserSettingMO &userSetting);
 
+    virtual bool writeBacklogChunk(const QList<BacklogMO> &chunk);
+
+    virtual int migrationProgress();
+    virtual bool setMigrationProgress(const MsgId &msgId);
+    virtual bool clearMigrationProgress();
+    virtual bool resetMigration();
+    inline virtual bool supportsResync() { return upsertAvailable(); }
+    virtual bool removeStaleMos(MigrationObject mo, const QVariantList &keep);
+
     bool prepareQuery(MigrationObject mo);
 
     virtual bool postProcess();
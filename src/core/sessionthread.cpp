@@ -18,6 +18,8 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
  ***************************************************************************/
 
+#include <QCoreApplication>
+
 #include "core.h"
 #include "coresession.h"
 #include "internalpeer.h"
@@ -25,12 +27,45 @@
 #include "sessionthread.h"
 #include "signalproxy.h"
 
+// Lives in the worker thread of a pooled session, and creates and destroys the session there
+class SessionThread::Runner : public QObject
+{
+public:
+    enum EventType {
+        CreateSessionEvent = QEvent::User,
+        DestroySessionEvent
+    };
+
+    Runner(SessionThread *sessionThread) : _sessionThread(sessionThread) {}
+
+protected:
+    void customEvent(QEvent *event)
+    {
+        if (event->type() == CreateSessionEvent) {
+            _sessionThread->createSession();
+        }
+        else if (event->type() == DestroySessionEvent) {
+            delete _sessionThread->_session;
+            _sessionThread->_session = 0;
+            _sessionThread->_sessionDestroyed.release();
+            deleteLater();
+        }
+    }
+
+private:
+    SessionThread *_sessionThread;
+};
+
+
 SessionThread::SessionThread(UserId uid, bool restoreState, QObject *parent)
     : QThread(parent),
     _session(0),
+    _worker(0),
+    _runner(0),
     _user(uid),
     _sessionInitialized(false),
-    _restoreState(restoreState)
+    _restoreState(restoreState),
+    _initTime(0)
 {
     connect(this, SIGNAL(initialized()), this, SLOT(setSessionInitialized()));
 }
@@ -38,12 +73,41 @@ SessionThread::SessionThread(UserId uid, bool restoreState, QObject *parent)
 
 SessionThread::~SessionThread()
 {
+    if (_worker) {
+        destroySession();
+        return;
+    }
+
     // shut down thread gracefully
     quit();
     wait();
 }
 
 
+void SessionThread::startOn(SessionWorker *worker)
+{
+    _worker = worker;
+    _worker->_sessionCount++;
+
+    _runner = new Runner(this);
+    _runner->moveToThread(worker);
+    QCoreApplication::postEvent(_runner, new QEvent(QEvent::Type(Runner::CreateSessionEvent)));
+}
+
+
+// Blocks until the worker has deleted the session, so it can save its state like with a thread of its own
+void SessionThread::destroySession()
+{
+    if (!_runner)
+        return;
+
+    QCoreApplication::postEvent(_runner, new QEvent(QEvent::Type(Runner::DestroySessionEvent)));
+    _sessionDestroyed.acquire();
+    _runner = 0;
+    _worker->_sessionCount--;
+}
+
+
 CoreSession *SessionThread::session()
 {
     return _session;
@@ -118,13 +182,23 @@ void SessionThread::addInternalClientToSession(InternalPeer *internalPeer)
 }
 
 
-void SessionThread::run()
+// Executed in the session's thread, i.e. this one or its worker
+void SessionThread::createSession()
 {
+    QElapsedTimer timer;
+    timer.start();
     _session = new CoreSession(user(), _restoreState);
     connect(this, SIGNAL(addRemoteClient(RemotePeer*)), _session, SLOT(addClient(RemotePeer*)));
     connect(this, SIGNAL(addInternalClient(InternalPeer*)), _session, SLOT(addClient(InternalPeer*)));
     connect(_session, SIGNAL(sessionState(Protocol::SessionState)), Core::instance(), SIGNAL(sessionState(Protocol::SessionState)));
+    _initTime = timer.elapsed();
     emit initialized();
+}
+
+
+void SessionThread::run()
+{
+    createSession();
     exec();
     delete _session;
 }
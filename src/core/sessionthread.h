@@ -21,7 +21,9 @@
 #ifndef SESSIONTHREAD_H
 #define SESSIONTHREAD_H
 
+#include <QElapsedTimer>
 #include <QMutex>
+#include <QSemaphore>
 #include <QThread>
 
 #include "types.h"
@@ -31,6 +33,24 @@ class InternalPeer;
 class RemotePeer;
 class QIODevice;
 
+//! A thread running the event loops of several sessions, if the core uses a pool of session threads
+/** Cf. the session-threads option. Each worker has its own storage connection, shared by its sessions.
+ */
+class SessionWorker : public QThread
+{
+public:
+    SessionWorker(QObject *parent = 0) : QThread(parent), _sessionCount(0) {}
+    ~SessionWorker() { quit(); wait(); }
+
+    inline int sessionCount() const { return _sessionCount; }
+
+private:
+    int _sessionCount;
+
+    friend class SessionThread;
+};
+
+
 class SessionThread : public QThread
 {
     Q_OBJECT
@@ -41,9 +61,16 @@ public:
 
     void run();
 
+    //! Run the session on the given worker instead of on a thread of its own
+    void startOn(SessionWorker *worker);
+    inline SessionWorker *worker() const { return _worker; }
+
     CoreSession *session();
     UserId user();
 
+    //! The time it took to set up the session, in milliseconds. Valid once initialized() was emitted.
+    inline qint64 initTime() const { return _initTime; }
+
 public slots:
     void addClient(QObject *peer);
 
@@ -58,11 +85,20 @@ signals:
     void addInternalClient(InternalPeer *peer);
 
 private:
+    class Runner;
+
+    void createSession();
+    void destroySession();
+
     CoreSession *_session;
+    SessionWorker *_worker;
+    Runner *_runner;
+    QSemaphore _sessionDestroyed;
     UserId _user;
     QList<QObject *> clientQueue;
     bool _sessionInitialized;
     bool _restoreState;
+    qint64 _initTime;
 
     bool isSessionInitialized();
     void addClientToSession(QObject *peer);
@@ -21,16 +21,44 @@
 #include "sqlitestorage.h"
 
 #include <QtSql>
+#include <QThread>
+
+#include <limits>
 
 #include "logger.h"
 #include "network.h"
 #include "quassel.h"
 
-int SqliteStorage::_maxRetryCount = 150;
+int SqliteStorage::_maxRetryCount = 8;
+
+namespace {
+
+// Give other connections a chance to finish, waiting a bit longer on each retry
+void backoff(int retryCount)
+{
+    unsigned long delay = qMin(1 << retryCount, 100);
+#if QT_VERSION >= 0x050000
+    QThread::msleep(delay);
+#else
+    // QThread::msleep() is protected in Qt4
+    class Sleeper : public QThread
+    {
+    public:
+        static void msleep(unsigned long msecs) { QThread::msleep(msecs); }
+    };
+    Sleeper::msleep(delay);
+#endif
+}
+
+}
 
 SqliteStorage::SqliteStorage(QObject *parent)
-    : AbstractSqlStorage(parent)
+    : AbstractSqlStorage(parent),
+    _walMode(false),
+    _searchIndexAvailable(false)
 {
+    _checkpointTimer.setInterval(_checkpointInterval * 1000);
+    connect(&_checkpointTimer, SIGNAL(timeout()), this, SLOT(checkpoint()));
 }
 
 
@@ -39,6 +67,69 @@ SqliteStorage::~SqliteStorage()
 }
 
 
+Storage::State SqliteStorage::init(const QVariantMap &settings)
+{
+    State state = AbstractSqlStorage::init(settings);
+    if (state != IsReady)
+        return state;
+
+    // The journal mode is stored in the database file, so all connections agree on it.
+    // We only look at it once we're initialized, so that no locks are held while it changes.
+    QSqlQuery query = logDb().exec("PRAGMA journal_mode");
+    _walMode = query.first() && query.value(0).toString().toLower() == "wal";
+    if (_walMode) {
+        quInfo() << "SQLite database is in WAL mode, readers won't block writers";
+        _checkpointTimer.start();
+    }
+    return state;
+}
+
+
+bool SqliteStorage::initDbSession(QSqlDatabase &db)
+{
+    // let SQLite wait (and back off) by itself when the database is locked, instead of failing right away
+    db.exec(QString("PRAGMA busy_timeout = %1").arg(_busyTimeout));
+
+    // This fails silently for databases that can't use WAL (e.g. on network file systems), which keep
+    // using the rollback journal then.
+    QSqlQuery query = db.exec("PRAGMA journal_mode = WAL");
+    if (query.first() && query.value(0).toString().toLower() == "wal") {
+        // in WAL mode, this is still safe against corruption, it only might lose the last commits on power loss
+        db.exec("PRAGMA synchronous = NORMAL");
+    }
+    return true;
+}
+
+
+void SqliteStorage::checkpoint()
+{
+    // SQLite checkpoints automatically whenever the WAL grows larger than 1000 pages. Doing it periodically as
+    // well keeps the WAL small when the core is mostly idle. A passive checkpoint never waits for other connections.
+    QSqlQuery query = logDb().exec("PRAGMA wal_checkpoint(PASSIVE)");
+    watchQuery(query);
+}
+
+
+void SqliteStorage::lockForWrite()
+{
+    _dbLock.lockForWrite();
+    if (_walMode)
+        _holdsWriteLock.setLocalData(true);
+}
+
+
+void SqliteStorage::unlock()
+{
+    if (_walMode) {
+        // lockForRead() didn't lock anything
+        if (!_holdsWriteLock.hasLocalData() || !_holdsWriteLock.localData())
+            return;
+        _holdsWriteLock.setLocalData(false);
+    }
+    _dbLock.unlock();
+}
+
+
 bool SqliteStorage::isAvailable() const
 {
     if (!QSqlDatabase::isDriverAvailable("QSQLITE")) return false;
@@ -116,6 +207,46 @@ bool SqliteStorage::setupSchemaVersion(int version)
 }
 
 
+bool SqliteStorage::initSearchIndex()
+{
+    // only used when there is a singlethread (during startup)
+    // so we don't need locking here
+    QSqlDatabase db = logDb();
+    if (db.tables().contains("backlog_fts")) {
+        _searchIndexAvailable = true;
+        return true;
+    }
+
+    // The index isn't part of the regular schema, since the FTS5 module might not be compiled into
+    // the SQLite library Qt uses. We create it as soon as it is available, and index the existing
+    // backlog from the newest message stored at that time downwards.
+    db.transaction();
+    QSqlQuery tableQuery = db.exec(queryString("create_searchindex_table"));
+    if (tableQuery.lastError().isValid()) {
+        db.rollback();
+        quInfo() << "SQLite has no FTS5 support, backlog searches won't be indexed.";
+        _searchIndexAvailable = false;
+        return false;
+    }
+
+    QStringList queries;
+    queries << queryString("create_searchindex_insert_trigger")
+            << queryString("create_searchindex_delete_trigger")
+            << queryString("insert_searchindex_progress");
+    foreach(QString queryString, queries) {
+        QSqlQuery query = db.exec(queryString);
+        if (!watchQuery(query)) {
+            db.rollback();
+            _searchIndexAvailable = false;
+            return false;
+        }
+    }
+    db.commit();
+    _searchIndexAvailable = true;
+    return true;
+}
+
+
 UserId SqliteStorage::addUser(const QString &user, const QString &password)
 {
     QSqlDatabase db = logDb();
@@ -424,7 +555,7 @@ bool SqliteStorage::updateIdentity(UserId user, const CoreIdentity &identity)
         checkQuery.prepare(queryString("select_checkidentity"));
         checkQuery.bindValue(":identityid", identity.id().toInt());
         checkQuery.bindValue(":userid", user.toInt());
-        lockForRead();
+        lockForWrite();
         safeExec(checkQuery);
 
         // there should be exactly one identity for the given id and user
@@ -498,7 +629,7 @@ void SqliteStorage::removeIdentity(UserId user, IdentityId identityId)
         checkQuery.prepare(queryString("select_checkidentity"));
         checkQuery.bindValue(":identityid", identityId.toInt());
         checkQuery.bindValue(":userid", user.toInt());
-        lockForRead();
+        lockForWrite();
         safeExec(checkQuery);
 
         // there should be exactly one identity for the given id and user
@@ -1102,8 +1233,7 @@ BufferInfo SqliteStorage::bufferInfo(UserId user, const NetworkId &networkId, Bu
 
     BufferInfo bufferInfo;
     {
-        QSqlQuery query(db);
-        query.prepare(queryString("select_bufferByName"));
+        QSqlQuery query = cachedQuery("select_bufferByName", db);
         query.bindValue(":networkid", networkId.toInt());
         query.bindValue(":userid", user.toInt());
         query.bindValue(":buffercname", buffer.toLower());
@@ -1125,8 +1255,7 @@ BufferInfo SqliteStorage::bufferInfo(UserId user, const NetworkId &networkId, Bu
         }
         else if (create) {
             // let's create the buffer
-            QSqlQuery createQuery(db);
-            createQuery.prepare(queryString("insert_buffer"));
+            QSqlQuery createQuery = cachedQuery("insert_buffer", db);
             createQuery.bindValue(":userid", user.toInt());
             createQuery.bindValue(":networkid", networkId.toInt());
             createQuery.bindValue(":buffertype", (int)type);
@@ -1134,12 +1263,19 @@ BufferInfo SqliteStorage::bufferInfo(UserId user, const NetworkId &networkId, Bu
             createQuery.bindValue(":buffercname", buffer.toLower());
             createQuery.bindValue(":joined", type & BufferInfo::ChannelBuffer ? 1 : 0);
 
+            // In WAL mode, a read transaction can't be upgraded once another connection has written in the
+            // meantime, so we end it and do the insert in a write transaction of its own.
+            query.finish();
+            db.commit();
             unlock();
             lockForWrite();
+            db.transaction();
             safeExec(createQuery);
             watchQuery(createQuery);
             bufferInfo = BufferInfo(createQuery.lastInsertId().toInt(), networkId, type, 0, buffer);
+            createQuery.finish();
         }
+        query.finish();
     }
     db.commit();
     unlock();
@@ -1154,8 +1290,7 @@ BufferInfo SqliteStorage::getBufferInfo(UserId user, const BufferId &bufferId)
 
     BufferInfo bufferInfo;
     {
-        QSqlQuery query(db);
-        query.prepare(queryString("select_buffer_by_id"));
+        QSqlQuery query = cachedQuery("select_buffer_by_id", db);
         query.bindValue(":userid", user.toInt());
         query.bindValue(":bufferid", bufferId.toInt());
 
@@ -1166,6 +1301,7 @@ BufferInfo SqliteStorage::getBufferInfo(UserId user, const BufferId &bufferId)
             bufferInfo = BufferInfo(query.value(0).toInt(), query.value(1).toInt(), (BufferInfo::Type)query.value(2).toInt(), 0, query.value(4).toString());
             Q_ASSERT(!query.next());
         }
+        query.finish();
         db.commit();
     }
     unlock();
@@ -1370,8 +1506,7 @@ void SqliteStorage::setBufferLastSeenMsg(UserId user, const BufferId &bufferId,
     db.transaction();
 
     {
-        QSqlQuery query(db);
-        query.prepare(queryString("update_buffer_lastseen"));
+        QSqlQuery query = cachedQuery("update_buffer_lastseen", db);
         query.bindValue(":userid", user.toInt());
         query.bindValue(":bufferid", bufferId.toInt());
         query.bindValue(":lastseenmsgid", msgId.toInt());
@@ -1379,6 +1514,36 @@ void SqliteStorage::setBufferLastSeenMsg(UserId user, const BufferId &bufferId,
         lockForWrite();
         safeExec(query);
         watchQuery(query);
+        query.finish();
+    }
+    db.commit();
+    unlock();
+}
+
+
+void SqliteStorage::setBufferLastSeenMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds)
+{
+    if (msgIds.isEmpty())
+        return;
+
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    {
+        // one transaction for the whole batch, reusing the prepared update for every buffer
+        QSqlQuery query = cachedQuery("update_buffer_lastseen", db);
+        query.bindValue(":userid", user.toInt());
+
+        lockForWrite();
+        QHash<BufferId, MsgId>::const_iterator iter = msgIds.constBegin();
+        while (iter != msgIds.constEnd()) {
+            query.bindValue(":bufferid", iter.key().toInt());
+            query.bindValue(":lastseenmsgid", iter.value().toInt());
+            safeExec(query);
+            watchQuery(query);
+            ++iter;
+        }
+        query.finish();
     }
     db.commit();
     unlock();
@@ -1420,8 +1585,7 @@ void SqliteStorage::setBufferMarkerLineMsg(UserId user, const BufferId &bufferId
     db.transaction();
 
     {
-        QSqlQuery query(db);
-        query.prepare(queryString("update_buffer_markerlinemsgid"));
+        QSqlQuery query = cachedQuery("update_buffer_markerlinemsgid", db);
         query.bindValue(":userid", user.toInt());
         query.bindValue(":bufferid", bufferId.toInt());
         query.bindValue(":markerlinemsgid", msgId.toInt());
@@ -1429,6 +1593,36 @@ void SqliteStorage::setBufferMarkerLineMsg(UserId user, const BufferId &bufferId
         lockForWrite();
         safeExec(query);
         watchQuery(query);
+        query.finish();
+    }
+    db.commit();
+    unlock();
+}
+
+
+void SqliteStorage::setBufferMarkerLineMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds)
+{
+    if (msgIds.isEmpty())
+        return;
+
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    {
+        // one transaction for the whole batch, reusing the prepared update for every buffer
+        QSqlQuery query = cachedQuery("update_buffer_markerlinemsgid", db);
+        query.bindValue(":userid", user.toInt());
+
+        lockForWrite();
+        QHash<BufferId, MsgId>::const_iterator iter = msgIds.constBegin();
+        while (iter != msgIds.constEnd()) {
+            query.bindValue(":bufferid", iter.key().toInt());
+            query.bindValue(":markerlinemsgid", iter.value().toInt());
+            safeExec(query);
+            watchQuery(query);
+            ++iter;
+        }
+        query.finish();
     }
     db.commit();
     unlock();
@@ -1471,8 +1665,7 @@ bool SqliteStorage::logMessage(Message &msg)
 
     bool error = false;
     {
-        QSqlQuery logMessageQuery(db);
-        logMessageQuery.prepare(queryString("insert_message"));
+        QSqlQuery logMessageQuery = cachedQuery("insert_message", db);
 
         logMessageQuery.bindValue(":time", msg.timestamp().toTime_t());
         logMessageQuery.bindValue(":bufferid", msg.bufferInfo().bufferId().toInt());
@@ -1487,10 +1680,10 @@ bool SqliteStorage::logMessage(Message &msg)
         if (logMessageQuery.lastError().isValid()) {
             // constraint violation - must be NOT NULL constraint - probably the sender is missing...
             if (logMessageQuery.lastError().number() == 19) {
-                QSqlQuery addSenderQuery(db);
-                addSenderQuery.prepare(queryString("insert_sender"));
+                QSqlQuery addSenderQuery = cachedQuery("insert_sender", db);
                 addSenderQuery.bindValue(":sender", msg.sender());
                 safeExec(addSenderQuery);
+                addSenderQuery.finish();
                 safeExec(logMessageQuery);
                 error = !watchQuery(logMessageQuery);
             }
@@ -1507,6 +1700,7 @@ bool SqliteStorage::logMessage(Message &msg)
                 error = true;
             }
         }
+        logMessageQuery.finish();
     }
 
     if (error) {
@@ -1528,8 +1722,7 @@ bool SqliteStorage::logMessages(MessageList &msgs)
 
     {
         QSet<QString> senders;
-        QSqlQuery addSenderQuery(db);
-        addSenderQuery.prepare(queryString("insert_sender"));
+        QSqlQuery addSenderQuery = cachedQuery("insert_sender", db);
         lockForWrite();
         for (int i = 0; i < msgs.count(); i++) {
             const QString &sender = msgs.at(i).sender();
@@ -1540,12 +1733,12 @@ bool SqliteStorage::logMessages(MessageList &msgs)
             addSenderQuery.bindValue(":sender", sender);
             safeExec(addSenderQuery);
         }
+        addSenderQuery.finish();
     }
 
     bool error = false;
     {
-        QSqlQuery logMessageQuery(db);
-        logMessageQuery.prepare(queryString("insert_message"));
+        QSqlQuery logMessageQuery = cachedQuery("insert_message", db);
         for (int i = 0; i < msgs.count(); i++) {
             Message &msg = msgs[i];
 
@@ -1565,6 +1758,7 @@ bool SqliteStorage::logMessages(MessageList &msgs)
                 msg.setMsgId(logMessageQuery.lastInsertId().toInt());
             }
         }
+        logMessageQuery.finish();
     }
 
     if (error) {
@@ -1595,8 +1789,7 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
     {
         // code dupication from getBufferInfo:
         // this is due to the impossibility of nesting transactions and recursive locking
-        QSqlQuery bufferInfoQuery(db);
-        bufferInfoQuery.prepare(queryString("select_buffer_by_id"));
+        QSqlQuery bufferInfoQuery = cachedQuery("select_buffer_by_id", db);
         bufferInfoQuery.bindValue(":userid", user.toInt());
         bufferInfoQuery.bindValue(":bufferid", bufferId.toInt());
 
@@ -1607,6 +1800,7 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
             bufferInfo = BufferInfo(bufferInfoQuery.value(0).toInt(), bufferInfoQuery.value(1).toInt(), (BufferInfo::Type)bufferInfoQuery.value(2).toInt(), 0, bufferInfoQuery.value(4).toString());
             error = !bufferInfo.isValid();
         }
+        bufferInfoQuery.finish();
     }
     if (error) {
         db.rollback();
@@ -1615,16 +1809,16 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
     }
 
     {
-        QSqlQuery query(db);
+        QSqlQuery query;
         if (last == -1 && first == -1) {
-            query.prepare(queryString("select_messagesNewestK"));
+            query = cachedQuery("select_messagesNewestK", db);
         }
         else if (last == -1) {
-            query.prepare(queryString("select_messagesNewerThan"));
+            query = cachedQuery("select_messagesNewerThan", db);
             query.bindValue(":firstmsg", first.toInt());
         }
         else {
-            query.prepare(queryString("select_messages"));
+            query = cachedQuery("select_messages", db);
             query.bindValue(":lastmsg", last.toInt());
             query.bindValue(":firstmsg", first.toInt());
         }
@@ -1644,6 +1838,7 @@ QList<Message> SqliteStorage::requestMsgs(UserId user, BufferId bufferId, MsgId
             msg.setMsgId(query.value(0).toInt());
             messagelist << msg;
         }
+        query.finish();
     }
     db.commit();
     unlock();
@@ -1661,8 +1856,7 @@ QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId las
 
     QHash<BufferId, BufferInfo> bufferInfoHash;
     {
-        QSqlQuery bufferInfoQuery(db);
-        bufferInfoQuery.prepare(queryString("select_buffers"));
+        QSqlQuery bufferInfoQuery = cachedQuery("select_buffers", db);
         bufferInfoQuery.bindValue(":userid", user.toInt());
 
         lockForRead();
@@ -1672,13 +1866,14 @@ QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId las
             BufferInfo bufferInfo = BufferInfo(bufferInfoQuery.value(0).toInt(), bufferInfoQuery.value(1).toInt(), (BufferInfo::Type)bufferInfoQuery.value(2).toInt(), bufferInfoQuery.value(3).toInt(), bufferInfoQuery.value(4).toString());
             bufferInfoHash[bufferInfo.bufferId()] = bufferInfo;
         }
+        bufferInfoQuery.finish();
 
-        QSqlQuery query(db);
+        QSqlQuery query;
         if (last == -1) {
-            query.prepare(queryString("select_messagesAllNew"));
+            query = cachedQuery("select_messagesAllNew", db);
         }
         else {
-            query.prepare(queryString("select_messagesAll"));
+            query = cachedQuery("select_messagesAll", db);
             query.bindValue(":lastmsg", last.toInt());
         }
         query.bindValue(":userid", user.toInt());
@@ -1698,6 +1893,7 @@ QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId las
             msg.setMsgId(query.value(0).toInt());
             messagelist << msg;
         }
+        query.finish();
     }
     db.commit();
     unlock();
@@ -1705,6 +1901,261 @@ QList<Message> SqliteStorage::requestAllMsgs(UserId user, MsgId first, MsgId las
 }
 
 
+QList<Message> SqliteStorage::searchMsgs(UserId user, const QString &query, const QList<BufferId> &buffers, const QDateTime &start, const QDateTime &end, int limit, MsgId last)
+{
+    QList<Message> messagelist;
+    if (query.trimmed().isEmpty())
+        return messagelist;
+
+    QString searchString;
+    if (_searchIndexAvailable) {
+        // quote every word, so the user can't (accidentally) use FTS5 query syntax. Like PostgreSQL's
+        // plainto_tsquery(), this matches whole words only, without a prefix search.
+        QStringList terms;
+        foreach(QString term, query.split(QRegExp("\\s+"), QString::SkipEmptyParts)) {
+            terms << QString("\"%1\"").arg(term.replace('"', "\"\""));
+        }
+        searchString = terms.join(" ");
+    }
+    else {
+        // without FTS5, we can only fall back to a (much slower) substring match of the whole query
+        QString pattern = query.trimmed();
+        pattern.replace('\\', "\\\\").replace('%', "\\%").replace('_', "\\_");
+        searchString = QString("%%1%").arg(pattern);
+    }
+
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    QHash<BufferId, BufferInfo> bufferInfoHash;
+    {
+        QSqlQuery bufferInfoQuery(db);
+        bufferInfoQuery.prepare(queryString("select_buffers"));
+        bufferInfoQuery.bindValue(":userid", user.toInt());
+
+        lockForRead();
+        safeExec(bufferInfoQuery);
+        watchQuery(bufferInfoQuery);
+        while (bufferInfoQuery.next()) {
+            BufferInfo bufferInfo = BufferInfo(bufferInfoQuery.value(0).toInt(), bufferInfoQuery.value(1).toInt(), (BufferInfo::Type)bufferInfoQuery.value(2).toInt(), bufferInfoQuery.value(3).toInt(), bufferInfoQuery.value(4).toString());
+            bufferInfoHash[bufferInfo.bufferId()] = bufferInfo;
+        }
+
+        // search the buffers one by one, so each of them can use the index on bufferid
+        QList<BufferId> searchBuffers;
+        foreach(BufferId bufferId, buffers) {
+            if (bufferInfoHash.contains(bufferId))
+                searchBuffers << bufferId;
+        }
+        if (buffers.isEmpty())
+            searchBuffers << BufferId();
+
+        QString queryName = _searchIndexAvailable ? "select_searchMessages" : "select_searchMessagesLike";
+        foreach(BufferId bufferId, searchBuffers) {
+            QSqlQuery searchQuery(db);
+            if (bufferId.isValid()) {
+                searchQuery.prepare(queryString(queryName + "Buffer"));
+                searchQuery.bindValue(":bufferid", bufferId.toInt());
+            }
+            else {
+                searchQuery.prepare(queryString(queryName));
+                searchQuery.bindValue(":userid", user.toInt());
+            }
+            searchQuery.bindValue(":query", searchString);
+            searchQuery.bindValue(":lastmsg", last == -1 ? std::numeric_limits<int>::max() : last.toInt());
+            searchQuery.bindValue(":starttime", start.isValid() ? start.toTime_t() : 0);
+            searchQuery.bindValue(":endtime", end.isValid() ? (qint64)end.toTime_t() : std::numeric_limits<qint64>::max());
+            searchQuery.bindValue(":limit", limit);
+            safeExec(searchQuery);
+            watchQuery(searchQuery);
+
+            while (searchQuery.next()) {
+                Message msg(QDateTime::fromTime_t(searchQuery.value(2).toInt()),
+                    bufferInfoHash[searchQuery.value(1).toInt()],
+                    (Message::Type)searchQuery.value(3).toUInt(),
+                    searchQuery.value(6).toString(),
+                    searchQuery.value(5).toString(),
+                    (Message::Flags)searchQuery.value(4).toUInt());
+                msg.setMsgId(searchQuery.value(0).toInt());
+                messagelist << msg;
+            }
+        }
+    }
+    db.commit();
+    unlock();
+
+    if (buffers.count() > 1) {
+        // merge the results of the single buffers
+        qSort(messagelist.begin(), messagelist.end(), qGreater<Message>());
+        if (limit != -1)
+            messagelist = messagelist.mid(0, limit);
+    }
+    return messagelist;
+}
+
+
+QList<BufferInfo> SqliteStorage::allBuffers()
+{
+    QList<BufferInfo> bufferlist;
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    {
+        QSqlQuery query(db);
+        query.prepare(queryString("select_all_buffers"));
+
+        lockForRead();
+        safeExec(query);
+        watchQuery(query);
+        while (query.next()) {
+            bufferlist << BufferInfo(query.value(0).toInt(), query.value(1).toInt(), (BufferInfo::Type)query.value(2).toInt(), query.value(3).toInt(), query.value(4).toString());
+        }
+    }
+    db.commit();
+    unlock();
+    return bufferlist;
+}
+
+
+MsgId SqliteStorage::retentionBoundary(const BufferId &bufferId, const QDateTime &keepSince, int keepCount)
+{
+    MsgId boundary;
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    {
+        lockForRead();
+        if (keepSince.isValid()) {
+            QSqlQuery query(db);
+            query.prepare(queryString("select_retention_boundary_age"));
+            query.bindValue(":bufferid", bufferId.toInt());
+            query.bindValue(":keepsince", keepSince.toTime_t());
+            safeExec(query);
+            if (watchQuery(query) && query.first())
+                boundary = query.value(0).toInt();
+        }
+        if (keepCount > 0) {
+            QSqlQuery query(db);
+            query.prepare(queryString("select_retention_boundary_count"));
+            query.bindValue(":bufferid", bufferId.toInt());
+            query.bindValue(":offset", keepCount - 1);
+            safeExec(query);
+            if (watchQuery(query) && query.first())
+                boundary = qMax(boundary, MsgId(query.value(0).toInt()));
+        }
+    }
+    db.commit();
+    unlock();
+    return boundary;
+}
+
+
+bool SqliteStorage::requestExpiredMsgs(const BufferInfo &bufferInfo, const MsgId &before, int limit, QList<Message> &messages)
+{
+    bool ok = false;
+    messages.clear();
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    {
+        QSqlQuery query(db);
+        query.prepare(queryString("select_expired_messages"));
+        query.bindValue(":bufferid", bufferInfo.bufferId().toInt());
+        query.bindValue(":before", before.toInt());
+        query.bindValue(":limit", limit);
+
+        lockForRead();
+        safeExec(query);
+        ok = watchQuery(query);
+        while (ok && query.next()) {
+            Message msg(QDateTime::fromTime_t(query.value(1).toInt()),
+                bufferInfo,
+                (Message::Type)query.value(2).toUInt(),
+                query.value(5).toString(),
+                query.value(4).toString(),
+                (Message::Flags)query.value(3).toUInt());
+            msg.setMsgId(query.value(0).toInt());
+            messages << msg;
+        }
+    }
+    db.commit();
+    unlock();
+    return ok;
+}
+
+
+int SqliteStorage::pruneMsgs(const BufferId &bufferId, const MsgId &before, int limit)
+{
+    int deleted = -1;
+    QSqlDatabase db = logDb();
+    db.transaction();
+
+    {
+        QSqlQuery query(db);
+        query.prepare(queryString("delete_expired_messages"));
+        query.bindValue(":bufferid", bufferId.toInt());
+        query.bindValue(":before", before.toInt());
+        query.bindValue(":limit", limit);
+
+        lockForWrite();
+        safeExec(query);
+        if (watchQuery(query))
+            deleted = query.numRowsAffected();
+    }
+    if (deleted == -1)
+        db.rollback();
+    else
+        db.commit();
+    unlock();
+    return deleted;
+}
+
+
+qint64 SqliteStorage::compactBacklog(const MsgId &prunedBefore)
+{
+    Q_UNUSED(prunedBefore)
+
+    qint64 reclaimed = 0;
+    {
+        QSqlDatabase db = logDb();
+
+        // Pages freed by deletes are reused for new rows. Only with incremental auto vacuum, which can't
+        // be enabled for existing databases without a full VACUUM, they are returned to the file system.
+        QSqlQuery pageSizeQuery = db.exec("PRAGMA page_size");
+        QSqlQuery freePagesQuery = db.exec("PRAGMA freelist_count");
+        if (pageSizeQuery.first() && freePagesQuery.first())
+            reclaimed = pageSizeQuery.value(0).toLongLong() * freePagesQuery.value(0).toLongLong();
+
+        QSqlQuery autoVacuumQuery = db.exec("PRAGMA auto_vacuum");
+        if (autoVacuumQuery.first() && autoVacuumQuery.value(0).toInt() == 2) {
+            // give the pages back in small steps, so the sessions can write in between
+            int freePages = freePagesQuery.value(0).toInt();
+            while (freePages > 0) {
+                lockForWrite();
+                db.exec(QString("PRAGMA incremental_vacuum(%1)").arg(_vacuumStepPages));
+                QSqlQuery freeQuery = db.exec("PRAGMA freelist_count");
+                unlock();
+                int left = freeQuery.first() ? freeQuery.value(0).toInt() : 0;
+                if (left >= freePages)
+                    break;
+                freePages = left;
+            }
+        }
+
+        // ANALYZE is done without our write lock, and only reads a sample of the rows where SQLite supports
+        // that, so SQLite's own lock is held briefly. Writers wait for it, or retry if it takes too long.
+        db.exec("PRAGMA analysis_limit = 1000");
+        QSqlQuery analyzeQuery(db);
+        analyzeQuery.prepare("ANALYZE backlog");
+        safeExec(analyzeQuery);
+        watchQuery(analyzeQuery);
+    }
+    // the pruner's thread ends after this
+    releaseConnection();
+    return reclaimed;
+}
+
+
 QString SqliteStorage::backlogFile()
 {
     return Quassel::configDirPath() + "quassel-storage.sqlite";
@@ -1713,18 +2164,25 @@ QString SqliteStorage::backlogFile()
 
 bool SqliteStorage::safeExec(QSqlQuery &query, int retryCount)
 {
-    query.exec();
+    if (retryCount == 0)
+        queryExecuted();
 
-    if (!query.lastError().isValid())
-        return true;
+    forever {
+        query.exec();
 
-    switch (query.lastError().number()) {
-    case 5: // SQLITE_BUSY         5   /* The database file is locked */
-    case 6: // SQLITE_LOCKED       6   /* A table in the database is locked */
-        if (retryCount < _maxRetryCount)
-            return safeExec(query, retryCount + 1);
-    default:
-        return false;
+        if (!query.lastError().isValid())
+            return true;
+
+        switch (query.lastError().number()) {
+        case 5: // SQLITE_BUSY         5   /* The database file is locked */
+        case 6: // SQLITE_LOCKED       6   /* A table in the database is locked */
+            if (retryCount < _maxRetryCount) {
+                backoff(retryCount++);
+                continue;
+            }
+        default:
+            return false;
+        }
     }
 }
 
@@ -1958,6 +2416,43 @@ bool SqliteMigrationReader::readMo(BacklogMO &backlog)
 }
 
 
+bool SqliteMigrationReader::readBacklogChunk(const MsgId &after, int limit, QList<BacklogMO> &chunk)
+{
+    QSqlQuery query(logDb());
+    query.prepare(queryString("migrate_read_backlog_chunk"));
+    query.bindValue(":after", after.toInt());
+    query.bindValue(":limit", limit);
+    query.exec();
+    if (!watchQuery(query))
+        return false;
+
+    BacklogMO backlog;
+    while (query.next()) {
+        backlog.messageid = query.value(0).toInt();
+        backlog.time = QDateTime::fromTime_t(query.value(1).toInt()).toUTC();
+        backlog.bufferid = query.value(2).toInt();
+        backlog.type = query.value(3).toInt();
+        backlog.flags = query.value(4).toInt();
+        backlog.senderid = query.value(5).toInt();
+        backlog.message = query.value(6).toString();
+        chunk << backlog;
+    }
+    return true;
+}
+
+
+qint64 SqliteMigrationReader::backlogCount(const MsgId &after)
+{
+    QSqlQuery query(logDb());
+    query.prepare("SELECT count(*) FROM backlog WHERE messageid > :after");
+    query.bindValue(":after", after.toInt());
+    query.exec();
+    if (!watchQuery(query) || !query.first())
+        return 0;
+    return query.value(0).toLongLong();
+}
+
+
 bool SqliteMigrationReader::readMo(IrcServerMO &ircserver)
 {
     if (!next())
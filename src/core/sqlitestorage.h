@@ -24,6 +24,8 @@
 #include "abstractsqlstorage.h"
 
 #include <QSqlDatabase>
+#include <QThreadStorage>
+#include <QTimer>
 
 class QSqlQuery;
 
@@ -40,6 +42,7 @@ public:
 public slots:
     /* General */
 
+    virtual State init(const QVariantMap &settings = QVariantMap());
     bool isAvailable() const;
     QString displayName() const;
     virtual inline QStringList setupKeys() const { return QStringList(); }
@@ -93,8 +96,10 @@ public slots:
     virtual bool renameBuffer(const UserId &user, const BufferId &bufferId, const QString &newName);
     virtual bool mergeBuffersPermanently(const UserId &user, const BufferId &bufferId1, const BufferId &bufferId2);
     virtual void setBufferLastSeenMsg(UserId user, const BufferId &bufferId, const MsgId &msgId);
+    virtual void setBufferLastSeenMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds);
     virtual QHash<BufferId, MsgId> bufferLastSeenMsgIds(UserId user);
     virtual void setBufferMarkerLineMsg(UserId user, const BufferId &bufferId, const MsgId &msgId);
+    virtual void setBufferMarkerLineMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds);
     virtual QHash<BufferId, MsgId> bufferMarkerLineMsgIds(UserId user);
 
     /* Message handling */
@@ -102,6 +107,14 @@ public slots:
     virtual bool logMessages(MessageList &msgs);
     virtual QList<Message> requestMsgs(UserId user, BufferId bufferId, MsgId first = -1, MsgId last = -1, int limit = -1);
     virtual QList<Message> requestAllMsgs(UserId user, MsgId first = -1, MsgId last = -1, int limit = -1);
+    virtual QList<Message> searchMsgs(UserId user, const QString &query, const QList<BufferId> &buffers, const QDateTime &start, const QDateTime &end, int limit = -1, MsgId last = -1);
+
+    /* Backlog retention */
+    virtual QList<BufferInfo> allBuffers();
+    virtual MsgId retentionBoundary(const BufferId &bufferId, const QDateTime &keepSince, int keepCount);
+    virtual bool requestExpiredMsgs(const BufferInfo &bufferInfo, const MsgId &before, int limit, QList<Message> &messages);
+    virtual int pruneMsgs(const BufferId &bufferId, const MsgId &before, int limit);
+    virtual qint64 compactBacklog(const MsgId &prunedBefore);
 
 protected:
     inline virtual void setConnectionProperties(const QVariantMap & /* properties */) {}
@@ -110,18 +123,35 @@ protected:
     virtual int installedSchemaVersion();
     virtual bool updateSchemaVersion(int newVersion);
     virtual bool setupSchemaVersion(int version);
+    virtual bool initSearchIndex();
+    virtual bool initDbSession(QSqlDatabase &db);
     bool safeExec(QSqlQuery &query, int retryCount = 0);
 
+private slots:
+    void checkpoint();
+
 private:
     static QString backlogFile();
     void bindNetworkInfo(QSqlQuery &query, const NetworkInfo &info);
     void bindServerInfo(QSqlQuery &query, const Network::Server &server);
 
-    inline void lockForRead() { _dbLock.lockForRead(); }
-    inline void lockForWrite() { _dbLock.lockForWrite(); }
-    inline void unlock() { _dbLock.unlock(); }
+    // In WAL mode, readers work on a snapshot of the database and don't need to be locked out while a
+    // connection writes. SQLite still only allows a single writer, so _dbLock then only serializes writers.
+    inline void lockForRead() { if (!_walMode) _dbLock.lockForRead(); }
+    void lockForWrite();
+    void unlock();
     QReadWriteLock _dbLock;
+    bool _walMode;
+    QThreadStorage<bool> _holdsWriteLock;
+    QTimer _checkpointTimer;
+
     static int _maxRetryCount;
+    static const int _busyTimeout = 5000; // ms SQLite waits for a lock before failing with SQLITE_BUSY
+    static const int _checkpointInterval = 60; // seconds
+    static const int _vacuumStepPages = 1024; // pages returned to the file system per write lock
+
+    // FTS5 is an optional SQLite module; without it, searches have to scan the backlog
+    bool _searchIndexAvailable;
 };
 
 
@@ -145,6 +175,10 @@ public:
     virtual bool readMo(IrcServerMO &ircserver);
     virtual bool readMo(UserSettingMO &userSetting);
 
+    virtual bool readBacklogChunk(const MsgId &after, int limit, QList<BacklogMO> &chunk);
+    virtual qint64 backlogCount(const MsgId &after);
+    inline virtual void backlogReaderFinished() { releaseConnection(); }
+
     virtual bool prepareQuery(MigrationObject mo);
 
     inline int stepSize() { return 50000; }
@@ -94,6 +94,12 @@ public slots:
      */
     virtual void sync() = 0;
 
+    //! Called once this backend has become the core's active storage
+    /** init() is also run on backends that are only set up, or written to by a migration, so long
+     *  running maintenance has to be started here. The default implementation does nothing.
+     */
+    inline virtual void activate() {}
+
     // TODO: Add functions for configuring the backlog handling, i.e. defining auto-cleanup settings etc
 
     /* User handling */
@@ -347,6 +353,13 @@ public slots:
      */
     virtual void setBufferLastSeenMsg(UserId user, const BufferId &bufferId, const MsgId &msgId) = 0;
 
+    //! Update the LastSeenDate for several Buffers at once
+    /** Stores all given ids within a single transaction.
+     * \param user      The Owner of the Buffers
+     * \param msgIds    The Message id of the message that has been just seen, by buffer id
+     */
+    virtual void setBufferLastSeenMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds) = 0;
+
     //! Get a Hash of all last seen message ids
     /** This Method is called when the Quassel Core is started to restore the lastSeenMsgIds
      * \param user      The Owner of the buffers
@@ -363,6 +376,15 @@ public slots:
      */
     virtual void setBufferMarkerLineMsg(UserId user, const BufferId &bufferId, const MsgId &msgId) = 0;
 
+    //! Update the MarkerLineMsgId for several Buffers at once
+    /** Stores all given ids within a single transaction.
+     *  \note This method is threadsafe.
+     *
+     * \param user      The Owner of the Buffers
+     * \param msgIds    The Message id where the marker line should be placed, by buffer id
+     */
+    virtual void setBufferMarkerLineMsgs(UserId user, const QHash<BufferId, MsgId> &msgIds) = 0;
+
     //! Get a Hash of all marker line message ids
     /** This Method is called when the Quassel Core is started to restore the MarkerLineMsgIds
      *  \note This method is threadsafe.
@@ -402,6 +424,61 @@ public slots:
      */
     virtual QList<Message> requestAllMsgs(UserId user, MsgId first = -1, MsgId last = -1, int limit = -1) = 0;
 
+    //! Search the backlog for messages containing the given words
+    /** A message matches if it contains all of the words as whole words, ignoring case. Backends
+     *  without a full-text index (SQLite without FTS5) fall back to a substring match of the query.
+     *  \param user     The owner of the buffers
+     *  \param query    The words to search for
+     *  \param buffers  The buffers to search, or an empty list to search all buffers of the user
+     *  \param start    if valid, return only messages sent at or after this time
+     *  \param end      if valid, return only messages sent before this time
+     *  \param limit    if != -1 limit the returned list to a max of \limit entries
+     *  \param last     if != -1 return only messages with a MsgId < last. Pass the oldest MsgId of the
+     *                  previous results here to get the next results.
+     *  \return The matching messages, newest first
+     */
+    virtual QList<Message> searchMsgs(UserId user, const QString &query, const QList<BufferId> &buffers, const QDateTime &start, const QDateTime &end, int limit = -1, MsgId last = -1) = 0;
+
+    /* Backlog retention */
+
+    //! Request a list of the buffers of all users
+    /** Used for core-wide maintenance like pruning old backlog. The group id is unused. */
+    virtual QList<BufferInfo> allBuffers() = 0;
+
+    //! Determine which messages of a buffer are expired
+    /** A message is kept only if it satisfies all given rules.
+     *  \param bufferId   The buffer to check
+     *  \param keepSince  if valid, messages sent before this time are expired
+     *  \param keepCount  if > 0, messages older than the keepCount newest ones are expired
+     *  \return All messages with an id less than the returned one are expired. Invalid if none are.
+     */
+    virtual MsgId retentionBoundary(const BufferId &bufferId, const QDateTime &keepSince, int keepCount) = 0;
+
+    //! Request the oldest expired messages of a buffer
+    /** \param bufferInfo The buffer to look at
+     *  \param before     Only return messages with a MsgId < before
+     *  \param limit      The maximum number of messages to return
+     *  \param messages   Receives the messages, oldest first
+     *  \return false on error, as opposed to there being no such messages
+     */
+    virtual bool requestExpiredMsgs(const BufferInfo &bufferInfo, const MsgId &before, int limit, QList<Message> &messages) = 0;
+
+    //! Delete the oldest expired messages of a buffer
+    /** \param bufferId   The buffer to prune
+     *  \param before     Only delete messages with a MsgId < before
+     *  \param limit      The maximum number of messages to delete
+     *  \return The number of deleted messages, or -1 on error
+     */
+    virtual int pruneMsgs(const BufferId &bufferId, const MsgId &before, int limit) = 0;
+
+    //! Reclaim the space freed by pruned messages and update the statistics of the query planner
+    /** This is called on a low priority thread of its own, so it may take a while, but it must not keep the
+     *  sessions from writing for long. Resources bound to the thread have to be released before returning.
+     *  \param prunedBefore Messages with a MsgId < prunedBefore may have been deleted
+     *  \return The number of bytes reclaimed, as far as the backend can tell
+     */
+    virtual qint64 compactBacklog(const MsgId &prunedBefore) = 0;
+
 signals:
     //! Sent when a new BufferInfo is created, or an existing one changed somehow.
     void bufferInfoUpdated(UserId user, const BufferInfo &);
@@ -402,18 +402,24 @@ QList<QRectF> ChatItem::findWords(const QString &searchWord, Qt::CaseSensitivity
     }
 
     foreach(int idx, indexList) {
-        QTextLine line = layout()->lineForTextPosition(idx);
-        qreal x = line.cursorToX(idx);
-        qreal width = line.cursorToX(idx + searchWord.count()) - x;
-        qreal height = line.height();
-        qreal y = height * line.lineNumber();
-        resultList << QRectF(x, y, width, height);
+        resultList << wordRect(idx, searchWord.count());
     }
 
     return resultList;
 }
 
 
+QRectF ChatItem::wordRect(int start, int length) const
+{
+    QTextLine line = layout()->lineForTextPosition(start);
+    qreal x = line.cursorToX(start);
+    qreal width = line.cursorToX(start + length) - x;
+    qreal height = line.height();
+    qreal y = height * line.lineNumber();
+    return QRectF(x, y, width, height);
+}
+
+
 void ChatItem::handleClick(const QPointF &pos, ChatScene::ClickMode clickMode)
 {
     // single clicks are already handled by the scene (for clearing the selection)
@@ -589,7 +595,7 @@ ContentsChatItemPrivate *ContentsChatItem::privateData() const
 {
     if (!_data) {
         ContentsChatItem *that = const_cast<ContentsChatItem *>(this);
-        that->_data = new ContentsChatItemPrivate(ClickableList::fromString(data(ChatLineModel::DisplayRole).toString()), that);
+        that->_data = new ContentsChatItemPrivate(data(ChatLineModel::ClickablesRole).value<ClickableList>(), that);
     }
     return _data;
 }
@@ -80,6 +80,8 @@ public:
     bool isPosOverSelection(const QPointF &pos) const;
 
     QList<QRectF> findWords(const QString &searchWord, Qt::CaseSensitivity caseSensitive);
+    //! The rect (relative to this item) covering the given range of the item's plain text
+    QRectF wordRect(int start, int length) const;
 
     virtual void addActionsToMenu(QMenu *menu, const QPointF &itemPos);
     virtual void handleClick(const QPointF &pos, ChatScene::ClickMode);
@@ -174,6 +174,36 @@ void ChatLine::setGeometryByWidth(const qreal &width, const qreal &contentsWidth
 }
 
 
+void ChatLine::recycle(int row,
+    const qreal &width,
+    const qreal &timestampWidth, const qreal &senderWidth, const qreal &contentsWidth,
+    const QPointF &senderPos, const QPointF &contentsPos)
+{
+    _row = row;
+    _mouseGrabberItem = 0;
+    _hoverItem = 0;
+    _selection = 0;
+    for (int i = 0; i <= ChatLineModel::ContentsColumn; i++)
+        item((ChatLineModel::ColumnType)i)->clearSelection();
+    clearCache();
+
+    _contentsItem.setPos(contentsPos);
+    qreal height = _contentsItem.setGeometryByWidth(contentsWidth);
+    _timestampItem.setGeometry(timestampWidth, height);
+    _senderItem.setGeometry(senderWidth, height);
+    _senderItem.setPos(senderPos);
+
+    if (height != _height || width != _width) {
+        prepareGeometryChange();
+        _height = height;
+        _width = width;
+    }
+
+    QModelIndex index = _model->index(row, ChatLineModel::ContentsColumn);
+    setHighlighted(index.data(MessageModel::FlagsRole).toInt() & Message::Highlight);
+}
+
+
 void ChatLine::setSelected(bool selected, ChatLineModel::ColumnType minColumn)
 {
     if (selected) {
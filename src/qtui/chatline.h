@@ -71,6 +71,15 @@ public:
     void setSecondColumn(const qreal &senderWidth, const qreal &contentsWidth, const QPointF &contentsPos, qreal &linePos);
     void setGeometryByWidth(const qreal &width, const qreal &contentsWidth, qreal &linePos);
 
+    //! Reuse this ChatLine for a different row
+    /** This resets all per-row state (selection, caches, hover and mouse grabber items) and lays out
+     *  the line for the given row. Used by the ChatScene to recycle ChatLines in virtualized mode.
+     */
+    void recycle(int row,
+        const qreal &width,
+        const qreal &timestampWidth, const qreal &senderWidth, const qreal &contentsWidth,
+        const QPointF &senderPos, const QPointF &contentsPos);
+
     void setSelected(bool selected, ChatLineModel::ColumnType minColumn = ChatLineModel::ContentsColumn);
     void setHighlighted(bool highlighted);
 
@@ -0,0 +1,245 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "chatlineheightindex.h"
+
+ChatLineHeightIndex::ChatLineHeightIndex()
+    : _root(-1),
+    _seed(0x9e3779b9)
+{
+}
+
+
+qreal ChatLineHeightIndex::height(int row) const
+{
+    Q_ASSERT(row >= 0 && row < count());
+    int node = _root;
+    forever {
+        const Node &n = _nodes.at(node);
+        int leftSize = size(n.left);
+        if (row < leftSize)
+            node = n.left;
+        else if (row == leftSize)
+            return n.height;
+        else {
+            row -= leftSize + 1;
+            node = n.right;
+        }
+    }
+}
+
+
+void ChatLineHeightIndex::setHeight(int row, qreal height)
+{
+    qreal delta = height - this->height(row);
+    if (delta == 0)
+        return;
+
+    // all subtrees on the path to the row grow by delta
+    int node = _root;
+    forever {
+        Node &n = _nodes[node];
+        n.sum += delta;
+        int leftSize = size(n.left);
+        if (row < leftSize)
+            node = n.left;
+        else if (row == leftSize) {
+            n.height = height;
+            return;
+        }
+        else {
+            row -= leftSize + 1;
+            node = n.right;
+        }
+    }
+}
+
+
+qreal ChatLineHeightIndex::offset(int row) const
+{
+    Q_ASSERT(row >= 0 && row <= count());
+    qreal result = 0;
+    int node = _root;
+    while (node >= 0) {
+        const Node &n = _nodes.at(node);
+        int leftSize = size(n.left);
+        if (row < leftSize) {
+            node = n.left;
+            continue;
+        }
+        result += sum(n.left);
+        if (row == leftSize)
+            break;
+        result += n.height;
+        row -= leftSize + 1;
+        node = n.right;
+    }
+    return result;
+}
+
+
+int ChatLineHeightIndex::rowAt(qreal offset) const
+{
+    if (offset < 0)
+        return 0;
+
+    int row = 0;
+    int node = _root;
+    while (node >= 0) {
+        const Node &n = _nodes.at(node);
+        qreal leftSum = sum(n.left);
+        if (offset < leftSum)
+            node = n.left;
+        else if (offset < leftSum + n.height)
+            return row + size(n.left);
+        else {
+            offset -= leftSum + n.height;
+            row += size(n.left) + 1;
+            node = n.right;
+        }
+    }
+    return row;
+}
+
+
+void ChatLineHeightIndex::insertRows(int start, const QVector<qreal> &heights)
+{
+    Q_ASSERT(start >= 0 && start <= count());
+    if (heights.isEmpty())
+        return;
+
+    int inserted = -1;
+    foreach(qreal height, heights)
+        inserted = merge(inserted, createNode(height));
+
+    int left, right;
+    split(_root, start, left, right);
+    _root = merge(merge(left, inserted), right);
+}
+
+
+void ChatLineHeightIndex::removeRows(int start, int end)
+{
+    Q_ASSERT(start >= 0 && end < count() && start <= end);
+    int left, middle, right;
+    split(_root, start, left, right);
+    split(right, end - start + 1, middle, right);
+    freeSubtree(middle);
+    _root = merge(left, right);
+}
+
+
+void ChatLineHeightIndex::clear()
+{
+    _nodes.clear();
+    _freeNodes.clear();
+    _root = -1;
+}
+
+
+int ChatLineHeightIndex::createNode(qreal height)
+{
+    // xorshift is plenty random for balancing the tree
+    _seed ^= _seed << 13;
+    _seed ^= _seed >> 17;
+    _seed ^= _seed << 5;
+
+    Node n;
+    n.height = height;
+    n.sum = height;
+    n.size = 1;
+    n.priority = _seed;
+    n.left = n.right = -1;
+
+    if (!_freeNodes.isEmpty()) {
+        int node = _freeNodes.last();
+        _freeNodes.remove(_freeNodes.count() - 1);
+        _nodes[node] = n;
+        return node;
+    }
+    _nodes.append(n);
+    return _nodes.count() - 1;
+}
+
+
+void ChatLineHeightIndex::freeSubtree(int node)
+{
+    if (node < 0)
+        return;
+    freeSubtree(_nodes.at(node).left);
+    freeSubtree(_nodes.at(node).right);
+    _freeNodes.append(node);
+}
+
+
+void ChatLineHeightIndex::update(int node)
+{
+    Node &n = _nodes[node];
+    n.size = size(n.left) + size(n.right) + 1;
+    n.sum = sum(n.left) + sum(n.right) + n.height;
+}
+
+
+void ChatLineHeightIndex::split(int node, int count, int &left, int &right)
+{
+    if (node < 0) {
+        left = right = -1;
+        return;
+    }
+
+    int leftSize = size(_nodes.at(node).left);
+    if (count <= leftSize) {
+        int subLeft, subRight;
+        split(_nodes.at(node).left, count, subLeft, subRight);
+        _nodes[node].left = subRight;
+        right = node;
+        left = subLeft;
+    }
+    else {
+        int subLeft, subRight;
+        split(_nodes.at(node).right, count - leftSize - 1, subLeft, subRight);
+        _nodes[node].right = subLeft;
+        left = node;
+        right = subRight;
+    }
+    update(node);
+}
+
+
+int ChatLineHeightIndex::merge(int left, int right)
+{
+    if (left < 0)
+        return right;
+    if (right < 0)
+        return left;
+
+    if (_nodes.at(left).priority > _nodes.at(right).priority) {
+        int merged = merge(_nodes.at(left).right, right);
+        _nodes[left].right = merged;
+        update(left);
+        return left;
+    }
+    else {
+        int merged = merge(left, _nodes.at(right).left);
+        _nodes[right].left = merged;
+        update(right);
+        return right;
+    }
+}
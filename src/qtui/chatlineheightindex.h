@@ -0,0 +1,84 @@
+/***************************************************************************
+ *   Copyright (C) 2005-2015 by the Quassel Project                        *
+ *   devel@quassel-irc.org                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CHATLINEHEIGHTINDEX_H_
+#define CHATLINEHEIGHTINDEX_H_
+
+#include <QVector>
+
+//! Keeps track of the heights of all rows in a ChatScene
+/** The index is an offset tree: a balanced binary tree (a treap with implicit keys) over the rows,
+ *  where every node knows the number of rows and the total height of its subtree. This allows
+ *  inserting and removing rows at any position, changing the height of a row, and mapping between rows
+ *  and vertical offsets in O(log n). The ChatScene uses it to derive the positions of its ChatLines,
+ *  rather than moving every line whenever something above or below changes.
+ */
+class ChatLineHeightIndex
+{
+public:
+    ChatLineHeightIndex();
+
+    inline int count() const { return size(_root); }
+    inline bool isEmpty() const { return _root < 0; }
+
+    qreal height(int row) const;
+    void setHeight(int row, qreal height);
+
+    //! Returns the sum of the heights of all rows above the given row
+    /** \param row The row; may be count() to get the total height
+     */
+    qreal offset(int row) const;
+    inline qreal totalHeight() const { return sum(_root); }
+
+    //! Returns the row that contains the given offset
+    /** \param offset Vertical offset relative to the top of the first row
+     *  \return The row containing offset; 0 if offset is negative, count() if offset is beyond the last row
+     */
+    int rowAt(qreal offset) const;
+
+    void insertRows(int start, const QVector<qreal> &heights);
+    void removeRows(int start, int end);
+    void clear();
+
+private:
+    struct Node {
+        qreal height;
+        qreal sum;   // total height of this subtree
+        int size;    // number of rows in this subtree
+        quint32 priority;
+        int left, right;
+    };
+
+    inline int size(int node) const { return node >= 0 ? _nodes.at(node).size : 0; }
+    inline qreal sum(int node) const { return node >= 0 ? _nodes.at(node).sum : 0; }
+
+    int createNode(qreal height);
+    void freeSubtree(int node);
+    void update(int node);
+    void split(int node, int count, int &left, int &right);
+    int merge(int left, int right);
+
+    QVector<Node> _nodes;
+    QVector<int> _freeNodes;
+    int _root;
+    quint32 _seed;
+};
+
+#endif
@@ -45,6 +45,7 @@ int ChatLineModelItem::TextBoundaryFinderBufferSize = 512 * (sizeof(HB_CharAttri
 // ****************************************
 ChatLineModelItem::ChatLineModelItem(const Message &msg)
     : MessageModelItem(),
+    _clickablesValid(false),
     _styledMsg(msg)
 {
     if (!msg.sender().contains('!'))
@@ -144,6 +145,13 @@ QVariant ChatLineModelItem::contentsData(int role) const
         if (_wrapList.isEmpty())
             computeWrapList();
         return QVariant::fromValue<ChatLineModel::WrapList>(_wrapList);
+    case ChatLineModel::ClickablesRole:
+        // clickables only depend on the plain contents, so we compute them once per message
+        if (!_clickablesValid) {
+            _clickables = ClickableList::fromString(_styledMsg.plainContents());
+            _clickablesValid = true;
+        }
+        return QVariant::fromValue<ClickableList>(_clickables);
     }
     return QVariant();
 }
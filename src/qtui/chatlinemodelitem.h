@@ -23,6 +23,7 @@
 
 #include "messagemodel.h"
 
+#include "clickable.h"
 #include "uistyle.h"
 
 class ChatLineModelItem : public MessageModelItem
@@ -63,6 +64,8 @@ private:
     void computeWrapList() const;
 
     mutable WrapList _wrapList;
+    mutable ClickableList _clickables;
+    mutable bool _clickablesValid;
     UiStyle::StyledMessage _styledMsg;
 
     static unsigned char *TextBoundaryFinderBuffer;
@@ -65,6 +65,12 @@ ChatScene::ChatScene(QAbstractItemModel *model, const QString &idString, qreal w
     _idString(idString),
     _model(model),
     _singleBufferId(BufferId()),
+    _virtualized(false),
+    _updatingMaterializedLines(false),
+    _measureLine(0),
+    _layoutBottom(0),
+    _visibleTop(0),
+    _visibleBottom(0),
     _sceneRect(0, 0, width, 0),
     _firstLineRow(-1),
     _viewportHeight(0),
@@ -89,6 +95,7 @@ ChatScene::ChatScene(QAbstractItemModel *model, const QString &idString, qreal w
     connect(this, SIGNAL(sceneRectChanged(const QRectF &)), _markerLine, SLOT(sceneRectChanged(const QRectF &)));
 
     ChatViewSettings defaultSettings;
+    _virtualized = defaultSettings.virtualizedScene();
     _defaultFirstColHandlePos = defaultSettings.value("FirstColumnHandlePos", 80).toInt();
     _defaultSecondColHandlePos = defaultSettings.value("SecondColumnHandlePos", 200).toInt();
 
@@ -171,22 +178,41 @@ void ChatScene::resetColumnWidths()
     _secondColHandle->setXPos(secondColHandlePos);
 }
 
+ChatLine *ChatScene::chatLine(int row) const
+{
+    if (row < 0 || row >= _lines.count())
+        return 0;
+
+    ChatLine *line = _lines.at(row);
+    if (!line || !_materializedLines.contains(line))
+        line = const_cast<ChatScene *>(this)->materializeLine(row);
+    return line;
+}
+
+
 ChatLine *ChatScene::chatLine(MsgId msgId, bool matchExact, bool ignoreDayChange) const
+{
+    return chatLine(rowByMsgId(msgId, matchExact, ignoreDayChange));
+}
+
+
+int ChatScene::rowByMsgId(MsgId msgId, bool matchExact, bool ignoreDayChange) const
 {
     if (!_lines.count())
-        return 0;
+        return -1;
 
-    QList<ChatLine *>::ConstIterator start = _lines.begin();
-    QList<ChatLine *>::ConstIterator end = _lines.end();
-    QList<ChatLine *>::ConstIterator middle;
+    // We bisect the model rather than our lines, since in virtualized mode most rows are not materialized
+    int start = 0;
+    int end = _lines.count();
+    int middle;
 
-    int n = int(end - start);
+    int n = end - start;
     int half;
 
     while (n > 0) {
         half = n >> 1;
         middle = start + half;
-        if ((*middle)->msgId() < msgId) {
+        if (model()->index(middle, 0).data(MessageModel::MsgIdRole).value<MsgId>() < msgId) {
             start = middle + 1;
             n -= half + 1;
         }
@@ -195,38 +221,39 @@ ChatLine *ChatScene::chatLine(MsgId msgId, bool matchExact, bool ignoreDayChange
         }
     }
 
-    if (start != end && (*start)->msgId() == msgId && (ignoreDayChange ? (*start)->msgType() != Message::DayChange : true))
-        return *start;
+    if (start != end && model()->index(start, 0).data(MessageModel::MsgIdRole).value<MsgId>() == msgId
+        && (ignoreDayChange ? msgTypeAt(start) != Message::DayChange : true))
+        return start;
 
     if (matchExact)
-        return 0;
+        return -1;
 
-    if (start == _lines.begin()) // not (yet?) in our scene
-        return 0;
+    if (start == 0) // not (yet?) in our scene
+        return -1;
 
     // if we didn't find the exact msgId, take the next-lower one (this makes sense for lastSeen)
 
     if (start == end) { // higher than last element
         if (!ignoreDayChange)
-            return _lines.last();
+            return end - 1;
 
-        for (int i = _lines.count() -1; i >= 0; i--) {
-            if (_lines.at(i)->msgType() != Message::DayChange)
-                return _lines.at(i);
+        for (int i = end - 1; i >= 0; i--) {
+            if (msgTypeAt(i) != Message::DayChange)
+                return i;
         }
-        return 0;
+        return -1;
     }
 
     // return the next-lower line
     if (!ignoreDayChange)
-        return *(--start);
+        return start - 1;
 
     do {
-        if ((*(--start))->msgType() != Message::DayChange)
-            return *start;
+        if (msgTypeAt(--start) != Message::DayChange)
+            return start;
     }
-    while (start != _lines.begin());
-    return 0;
+    while (start > 0);
+    return -1;
 }
 
 
@@ -270,12 +297,12 @@ void ChatScene::setMarkerLine(MsgId msgId)
         msgId = Client::markerLine(singleBufferId());
 
     if (msgId.isValid()) {
-        ChatLine *line = chatLine(msgId, false, true);
-        if (line) {
-            markerLine()->setChatLine(line);
+        int row = rowByMsgId(msgId, false, true);
+        if (row >= 0) {
+            markerLine()->setChatLine(chatLine(row));
             // if this was the last line, we won't see it because it's outside the sceneRect
             // .. which is exactly what we want :)
-            markerLine()->setPos(line->pos() + QPointF(0, line->height()));
+            markerLine()->setPos(0, rowScenePos(row) + rowHeight(row));
 
             // DayChange messages might have been hidden outside the scene rect, don't make the markerline visible then!
             if (markerLine()->pos().y() >= sceneRect().y()) {
@@ -345,52 +372,58 @@ void ChatScene::rowsInserted(const QModelIndex &index, int start, int end)
 //   }
 
     qreal h = 0;
-    qreal y = 0;
     qreal width = _sceneRect.width();
     bool atBottom = (start == _lines.count());
-    bool atTop = !atBottom && (start == 0);
 
-    if (start < _lines.count()) {
-        y = _lines.value(start)->y();
-    }
-    else if (atBottom && !_lines.isEmpty()) {
-        y = _lines.last()->y() + _lines.last()->height();
-    }
-
-    qreal contentsWidth = width - secondColumnHandle()->sceneRight();
-    qreal senderWidth = secondColumnHandle()->sceneLeft() - firstColumnHandle()->sceneRight();
-    qreal timestampWidth = firstColumnHandle()->sceneLeft();
-    QPointF contentsPos(secondColumnHandle()->sceneRight(), 0);
-    QPointF senderPos(firstColumnHandle()->sceneRight(), 0);
-
-    if (atTop) {
-        for (int i = end; i >= start; i--) {
-            ChatLine *line = new ChatLine(i, model(),
-                width,
-                timestampWidth, senderWidth, contentsWidth,
-                senderPos, contentsPos);
-            h += line->height();
-            line->setPos(0, y-h);
-            _lines.insert(start, line);
-            addItem(line);
+    if (_virtualized) {
+        // we only need the heights of the new rows; ChatLines are created once they become visible
+        for (int i = start; i <= end; i++)
+            _lines.insert(i, 0);
+        foreach(ChatLine *line, _materializedLines) {
+            if (line->row() >= start)
+                line->setRow(line->row() + end - start + 1);
         }
+
+        // Laying out every new row would defeat the purpose for large backlog fetches, so we only estimate
+        // their heights here. Rows get their real height once they are materialized near the viewport.
+        qreal estimate = _heightIndex.isEmpty() ? measureRow(start) : _heightIndex.totalHeight() / _heightIndex.count();
+        QVector<qreal> heights(end - start + 1, estimate);
+        h = estimate * heights.count();
+        _heightIndex.insertRows(start, heights);
+        if (atBottom)
+            _layoutBottom += h;
+        repositionLines();
     }
     else {
+        qreal contentsWidth = width - secondColumnHandle()->sceneRight();
+        qreal senderWidth = secondColumnHandle()->sceneLeft() - firstColumnHandle()->sceneRight();
+        qreal timestampWidth = firstColumnHandle()->sceneLeft();
+        QPointF contentsPos(secondColumnHandle()->sceneRight(), 0);
+        QPointF senderPos(firstColumnHandle()->sceneRight(), 0);
+
+        // New lines start out hidden and are positioned from the height index once they come near the
+        // visible area, so inserting rows doesn't move every line above or below them.
+        QVector<qreal> heights(end - start + 1);
         for (int i = start; i <= end; i++) {
             ChatLine *line = new ChatLine(i, model(),
                 width,
                 timestampWidth, senderWidth, contentsWidth,
                 senderPos, contentsPos);
-            line->setPos(0, y+h);
+            line->hide();
             h += line->height();
+            heights[i - start] = line->height();
             _lines.insert(i, line);
             addItem(line);
         }
-    }
+        _heightIndex.insertRows(start, heights);
+        if (atBottom)
+            _layoutBottom += h;
 
-    // update existing items
-    for (int i = end+1; i < _lines.count(); i++) {
-        _lines[i]->setRow(i);
+        // update existing items
+        for (int i = end+1; i < _lines.count(); i++) {
+            _lines[i]->setRow(i);
+        }
+        repositionLines();
     }
 
     // update selection
@@ -401,59 +434,33 @@ void ChatScene::rowsInserted(const QModelIndex &index, int start, int end)
             _selectionStart += offset;
         if (_selectionEnd >= start) {
             _selectionEnd += offset;
-            if (_selectionStart == oldStart)
-                for (int i = start; i < start + offset; i++)
-                    _lines[i]->setSelected(true);
+            if (_selectionStart == oldStart) {
+                for (int i = start; i < start + offset; i++) {
+                    if (_lines.at(i))
+                        _lines.at(i)->setSelected(true);
+                }
+            }
         }
         if (_firstSelectionRow >= start)
             _firstSelectionRow += offset;
     }
 
-    // neither pre- or append means we have to do dirty work: move items...
-    if (!(atTop || atBottom)) {
-        ChatLine *line = 0;
-        for (int i = 0; i <= end; i++) {
-            line = _lines.at(i);
-            line->setPos(0, line->pos().y() - h);
-            if (line == markerLine()->chatLine())
-                markerLine()->setPos(line->pos() + QPointF(0, line->height()));
-        }
-    }
-
-    // check if all went right
-    Q_ASSERT(start == 0 || _lines.at(start - 1)->pos().y() + _lines.at(start - 1)->height() == _lines.at(start)->pos().y());
-//   if(start != 0) {
-//     if(_lines.at(start - 1)->pos().y() + _lines.at(start - 1)->height() != _lines.at(start)->pos().y()) {
-//       qDebug() << "lines:" << _lines.count() << "start:" << start << "end:" << end;
-//       qDebug() << "line[start - 1]:" << _lines.at(start - 1)->pos().y() << "+" << _lines.at(start - 1)->height() << "=" << _lines.at(start - 1)->pos().y() + _lines.at(start - 1)->height();
-//       qDebug() << "line[start]" << _lines.at(start)->pos().y();
-//       qDebug() << "needed moving:" << !(atTop || atBottom) << moveTop << moveStart << moveEnd << offset;
-//       Q_ASSERT(false)
-//     }
-//   }
-    Q_ASSERT(end + 1 == _lines.count() || _lines.at(end)->pos().y() + _lines.at(end)->height() == _lines.at(end + 1)->pos().y());
-//   if(end + 1 < _lines.count()) {
-//     if(_lines.at(end)->pos().y() + _lines.at(end)->height() != _lines.at(end + 1)->pos().y()) {
-//       qDebug() << "lines:" << _lines.count() << "start:" << start << "end:" << end;
-//       qDebug() << "line[end]:" << _lines.at(end)->pos().y() << "+" << _lines.at(end)->height() << "=" << _lines.at(end)->pos().y() + _lines.at(end)->height();
-//       qDebug() << "line[end+1]" << _lines.at(end + 1)->pos().y();
-//       qDebug() << "needed moving:" << !(atTop || atBottom) << moveTop << moveStart << moveEnd << offset;
-//       Q_ASSERT(false);
-//     }
-//   }
-
     if (!atBottom) {
         if (start < _firstLineRow) {
             int prevFirstLineRow = _firstLineRow + (end - start + 1);
             for (int i = end + 1; i < prevFirstLineRow; i++) {
-                _lines.at(i)->show();
+                if (_lines.at(i) && _materializedLines.contains(_lines.at(i)))
+                    _lines.at(i)->show();
             }
         }
         // force new search for first proper line
         _firstLineRow = -1;
     }
     updateSceneRect();
+    updateMaterializedLines();
     if (atBottom) {
+        if (_virtualized) // the estimated heights of the new rows were corrected while materializing them
+            h = _heightIndex.totalHeight() - _heightIndex.offset(start);
         emit lastLineChanged(_lines.last(), h);
     }
 
@@ -483,17 +490,29 @@ void ChatScene::rowsAboutToBeRemoved(const QModelIndex &parent, int start, int e
     QList<ChatLine *>::iterator lineIter = _lines.begin() + start;
     int lineCount = start;
     while (lineIter != _lines.end() && lineCount <= end) {
-        if ((*lineIter) == markerLine()->chatLine())
+        ChatLine *line = *lineIter;
+        h += _heightIndex.height(lineCount);
+        if (line)
+            _materializedLines.remove(line);
+        if (line && line == markerLine()->chatLine())
             markerLine()->setChatLine(0);
-        h += (*lineIter)->height();
-        delete *lineIter;
+        delete line;
         lineIter = _lines.erase(lineIter);
         lineCount++;
     }
 
     // update rows of remaining chatlines
-    for (int i = start; i < _lines.count(); i++) {
-        _lines.at(i)->setRow(i);
+    _heightIndex.removeRows(start, end);
+    if (_virtualized) {
+        foreach(ChatLine *line, _materializedLines) {
+            if (line->row() > end)
+                line->setRow(line->row() - (end - start + 1));
+        }
+    }
+    else {
+        for (int i = start; i < _lines.count(); i++) {
+            _lines.at(i)->setRow(i);
+        }
     }
 
     // update selection
@@ -512,28 +531,12 @@ void ChatScene::rowsAboutToBeRemoved(const QModelIndex &parent, int start, int e
         }
     }
 
-    // neither removing at bottom or top means we have to move items...
-    if (!(atTop || atBottom)) {
-        qreal offset = h;
-        int moveStart = 0;
-        int moveEnd = _lines.count() - 1;
-        if (start < _lines.count() - start) {
-            // move top part
-            moveEnd = start - 1;
-        }
-        else {
-            // move bottom part
-            moveStart = start;
-            offset = -offset;
-        }
-        ChatLine *line = 0;
-        for (int i = moveStart; i <= moveEnd; i++) {
-            line = _lines.at(i);
-            line->setPos(0, line->pos().y() + offset);
-        }
-    }
+    // The layout is anchored at its bottom, so the rows above the removed ones move down. Without
+    // virtualization, we rather close the gap with the smaller part of the scene, as we always did.
+    if (atBottom || (!_virtualized && !atTop && start >= _lines.count() - start))
+        _layoutBottom -= h;
 
-    Q_ASSERT(start == 0 || start >= _lines.count() || _lines.at(start - 1)->pos().y() + _lines.at(start - 1)->height() == _lines.at(start)->pos().y());
+    repositionLines();
 
     // update sceneRect
     // when searching for the first non-date-line we have to take into account that our
@@ -562,6 +565,7 @@ void ChatScene::rowsRemoved()
 {
     // move the marker line if necessary
     setMarkerLine();
+    updateMaterializedLines();
 }
 
 
@@ -594,25 +598,28 @@ void ChatScene::layout(int start, int end, qreal width)
     // 2 to 10 times faster!
     //setItemIndexMethod(QGraphicsScene::NoIndex);
 
-    if (end >= 0) {
-        int row = end;
-        qreal linePos = _lines.at(row)->scenePos().y() + _lines.at(row)->height();
+    if (_virtualized) {
+        // only lay out materialized lines; the others get their new geometry once they become visible
+        qreal linePos = 0;
         qreal contentsWidth = width - secondColumnHandle()->sceneRight();
-        while (row >= start) {
-            _lines.at(row--)->setGeometryByWidth(width, contentsWidth, linePos);
+        foreach(ChatLine *line, _materializedLines) {
+            if (line->row() >= start && line->row() <= end) {
+                line->setGeometryByWidth(width, contentsWidth, linePos);
+                setRowHeight(line->row(), line->height());
+            }
         }
-
-        if (row >= 0) {
-            // remaining items don't need geometry changes, but maybe repositioning?
+        repositionLines();
+    }
+    else if (end >= 0) {
+        // all lines need their new geometry, but only the shown ones need to be positioned
+        qreal linePos = 0;
+        qreal contentsWidth = width - secondColumnHandle()->sceneRight();
+        for (int row = start; row <= end; row++) {
             ChatLine *line = _lines.at(row);
-            qreal offset = linePos - (line->scenePos().y() + line->height());
-            if (offset != 0) {
-                while (row >= 0) {
-                    line = _lines.at(row--);
-                    line->setPos(0, line->scenePos().y() + offset);
-                }
-            }
+            line->setGeometryByWidth(width, contentsWidth, linePos);
+            _heightIndex.setHeight(row, line->height());
         }
+        repositionLines();
     }
 
     //setItemIndexMethod(QGraphicsScene::BspTreeIndex);
@@ -620,6 +627,7 @@ void ChatScene::layout(int start, int end, qreal width)
     updateSceneRect(width);
     setHandleXLimits();
     setMarkerLine();
+    updateMaterializedLines();
     emit layoutChanged();
 
 //   clock_t endT = clock();
@@ -650,9 +658,16 @@ void ChatScene::firstHandlePositionChanged(qreal xpos)
     qreal senderWidth = secondColumnHandle()->sceneLeft() - firstColumnHandle()->sceneRight();
     QPointF senderPos(firstColumnHandle()->sceneRight(), 0);
 
-    while (lineIter != lineIterBegin) {
-        --lineIter;
-        (*lineIter)->setFirstColumn(timestampWidth, senderWidth, senderPos);
+    if (_virtualized) {
+        // the first column doesn't affect line heights, so only the materialized lines need an update
+        foreach(ChatLine *line, _materializedLines)
+            line->setFirstColumn(timestampWidth, senderWidth, senderPos);
+    }
+    else {
+        while (lineIter != lineIterBegin) {
+            --lineIter;
+            (*lineIter)->setFirstColumn(timestampWidth, senderWidth, senderPos);
+        }
     }
     //setItemIndexMethod(QGraphicsScene::BspTreeIndex);
 
@@ -682,18 +697,29 @@ void ChatScene::secondHandlePositionChanged(qreal xpos)
 
     QList<ChatLine *>::iterator lineIter = _lines.end();
     QList<ChatLine *>::iterator lineIterBegin = _lines.begin();
-    qreal linePos = _sceneRect.y() + _sceneRect.height();
+    qreal linePos = _layoutBottom;
     qreal senderWidth = secondColumnHandle()->sceneLeft() - firstColumnHandle()->sceneRight();
     qreal contentsWidth = _sceneRect.width() - secondColumnHandle()->sceneRight();
     QPointF contentsPos(secondColumnHandle()->sceneRight(), 0);
-    while (lineIter != lineIterBegin) {
-        --lineIter;
-        (*lineIter)->setSecondColumn(senderWidth, contentsWidth, contentsPos, linePos);
+    if (_virtualized) {
+        foreach(ChatLine *line, _materializedLines) {
+            line->setSecondColumn(senderWidth, contentsWidth, contentsPos, linePos);
+            setRowHeight(line->row(), line->height());
+        }
+        repositionLines();
+    }
+    else {
+        while (lineIter != lineIterBegin) {
+            --lineIter;
+            (*lineIter)->setSecondColumn(senderWidth, contentsWidth, contentsPos, linePos);
+            _heightIndex.setHeight((*lineIter)->row(), (*lineIter)->height());
+        }
     }
     //setItemIndexMethod(QGraphicsScene::BspTreeIndex);
 
     updateSceneRect();
     setHandleXLimits();
+    updateMaterializedLines();
     emit layoutChanged();
 
 //   clock_t endT = clock();
@@ -721,7 +747,7 @@ void ChatScene::startGlobalSelection(ChatItem *item, const QPointF &itemPos)
     _selectionStart = _selectionEnd = _firstSelectionRow = item->row();
     _selectionStartCol = _selectionMinCol = item->column();
     _isSelecting = true;
-    _lines[_selectionStart]->setSelected(true, (ChatLineModel::ColumnType)_selectionMinCol);
+    chatLine(_selectionStart)->setSelected(true, (ChatLineModel::ColumnType)_selectionMinCol);
     updateSelection(item->mapToScene(itemPos));
 }
 
@@ -735,26 +761,36 @@ void ChatScene::updateSelection(const QPointF &pos)
     if (minColumn != _selectionMinCol) {
         _selectionMinCol = minColumn;
         for (int l = qMin(_selectionStart, _selectionEnd); l <= qMax(_selectionStart, _selectionEnd); l++) {
-            _lines[l]->setSelected(true, minColumn);
+            if (_lines.at(l))
+                _lines.at(l)->setSelected(true, minColumn);
         }
     }
     int newstart = qMin(curRow, _firstSelectionRow);
     int newend = qMax(curRow, _firstSelectionRow);
+    // in virtualized mode, lines that are not materialized get their selection state once they are materialized
     if (newstart < _selectionStart) {
-        for (int l = newstart; l < _selectionStart; l++)
-            _lines[l]->setSelected(true, minColumn);
+        for (int l = newstart; l < _selectionStart; l++) {
+            if (_lines.at(l))
+                _lines.at(l)->setSelected(true, minColumn);
+        }
     }
     if (newstart > _selectionStart) {
-        for (int l = _selectionStart; l < newstart; l++)
-            _lines[l]->setSelected(false);
+        for (int l = _selectionStart; l < newstart; l++) {
+            if (_lines.at(l))
+                _lines.at(l)->setSelected(false);
+        }
     }
     if (newend > _selectionEnd) {
-        for (int l = _selectionEnd+1; l <= newend; l++)
-            _lines[l]->setSelected(true, minColumn);
+        for (int l = _selectionEnd+1; l <= newend; l++) {
+            if (_lines.at(l))
+                _lines.at(l)->setSelected(true, minColumn);
+        }
     }
     if (newend < _selectionEnd) {
-        for (int l = newend+1; l <= _selectionEnd; l++)
-            _lines[l]->setSelected(false);
+        for (int l = newend+1; l <= _selectionEnd; l++) {
+            if (_lines.at(l))
+                _lines.at(l)->setSelected(false);
+        }
     }
 
     _selectionStart = newstart;
@@ -765,7 +801,7 @@ void ChatScene::updateSelection(const QPointF &pos)
             // _selectingItem has been removed already
             return;
         }
-        _lines[curRow]->setSelected(false);
+        chatLine(curRow)->setSelected(false);
         _isSelecting = false;
         _selectionStart = -1;
         _selectingItem->continueSelecting(_selectingItem->mapFromScene(pos));
@@ -1021,12 +1057,13 @@ QString ChatScene::selection() const
             return QString();
         }
         QString result;
+        // use the model directly, so we don't need to materialize lines in virtualized mode
         for (int l = start; l <= end; l++) {
             if (_selectionMinCol == ChatLineModel::TimestampColumn)
-                result += _lines[l]->item(ChatLineModel::TimestampColumn)->data(MessageModel::DisplayRole).toString() + " ";
+                result += model()->index(l, ChatLineModel::TimestampColumn).data(MessageModel::DisplayRole).toString() + " ";
             if (_selectionMinCol <= ChatLineModel::SenderColumn)
-                result += _lines[l]->item(ChatLineModel::SenderColumn)->data(MessageModel::DisplayRole).toString() + " ";
-            result += _lines[l]->item(ChatLineModel::ContentsColumn)->data(MessageModel::DisplayRole).toString() + "\n";
+                result += model()->index(l, ChatLineModel::SenderColumn).data(MessageModel::DisplayRole).toString() + " ";
+            result += model()->index(l, ChatLineModel::ContentsColumn).data(MessageModel::DisplayRole).toString() + "\n";
         }
         return result;
     }
@@ -1057,8 +1094,10 @@ bool ChatScene::isGloballySelecting() const
 void ChatScene::clearGlobalSelection()
 {
     if (hasGlobalSelection()) {
-        for (int l = qMin(_selectionStart, _selectionEnd); l <= qMax(_selectionStart, _selectionEnd); l++)
-            _lines[l]->setSelected(false);
+        for (int l = qMin(_selectionStart, _selectionEnd); l <= qMax(_selectionStart, _selectionEnd); l++) {
+            if (_lines.at(l))
+                _lines.at(l)->setSelected(false);
+        }
         _isSelecting = false;
         _selectionStart = -1;
     }
@@ -1112,15 +1151,11 @@ ChatLineModel::ColumnType ChatScene::columnByScenePos(qreal x) const
 
 int ChatScene::rowByScenePos(qreal y) const
 {
-    QList<QGraphicsItem *> itemList = items(QPointF(0, y));
-
-    // ChatLine should be at the bottom of the list
-    for (int i = itemList.count()-1; i >= 0; i--) {
-        ChatLine *line = qgraphicsitem_cast<ChatLine *>(itemList.at(i));
-        if (line)
-            return line->row();
-    }
-    return -1;
+    qreal top = _layoutBottom - _heightIndex.totalHeight();
+    if (y < top)
+        return -1;
+    int row = _heightIndex.rowAt(y - top);
+    return row < _heightIndex.count() ? row : -1;
 }
 
 
@@ -1144,16 +1179,16 @@ void ChatScene::updateSceneRect(qreal width)
             firstLineIdx = model()->index(_firstLineRow, 0);
             if ((Message::Type)(model()->data(firstLineIdx, MessageModel::TypeRole).toInt()) != Message::DayChange)
                 break;
-            _lines.at(_firstLineRow)->hide();
+            if (_lines.at(_firstLineRow))
+                _lines.at(_firstLineRow)->hide();
             _firstLineRow++;
         }
     }
 
     // the following call should be safe. If it crashes something went wrong during insert/remove
     if (_firstLineRow < _lines.count()) {
-        ChatLine *firstLine = _lines.at(_firstLineRow);
-        ChatLine *lastLine = _lines.last();
-        updateSceneRect(QRectF(0, firstLine->pos().y(), width, lastLine->pos().y() + lastLine->height() - firstLine->pos().y()));
+        qreal top = rowScenePos(_firstLineRow);
+        updateSceneRect(QRectF(0, top, width, _layoutBottom - top));
     }
     else {
         // empty scene rect
@@ -1170,6 +1205,195 @@ void ChatScene::updateSceneRect(const QRectF &rect)
 }
 
 
+// Positions are derived from the height index. The layout is anchored at its bottom edge (_layoutBottom),
+// i.e. inserting or growing rows moves the rows above, unless they are appended to the scene.
+qreal ChatScene::rowScenePos(int row) const
+{
+    return _layoutBottom - _heightIndex.totalHeight() + _heightIndex.offset(row);
+}
+
+
+/******** MATERIALIZED LINES *********************************************************************/
+
+void ChatScene::setVisibleSceneRange(qreal top, qreal bottom)
+{
+    _visibleTop = top;
+    _visibleBottom = bottom;
+    updateMaterializedLines();
+    emit visibleSceneRangeChanged(top, bottom);
+}
+
+
+qreal ChatScene::measureRow(int row)
+{
+    qreal width = _sceneRect.width();
+    qreal contentsWidth = width - secondColumnHandle()->sceneRight();
+    qreal senderWidth = secondColumnHandle()->sceneLeft() - firstColumnHandle()->sceneRight();
+    qreal timestampWidth = firstColumnHandle()->sceneLeft();
+    QPointF contentsPos(secondColumnHandle()->sceneRight(), 0);
+    QPointF senderPos(firstColumnHandle()->sceneRight(), 0);
+
+    // we use a dedicated, hidden ChatLine for measuring rows that are not materialized
+    if (!_measureLine) {
+        _measureLine = new ChatLine(row, model(),
+            width,
+            timestampWidth, senderWidth, contentsWidth,
+            senderPos, contentsPos);
+        _measureLine->hide();
+        addItem(_measureLine);
+    }
+    else {
+        _measureLine->recycle(row,
+            width,
+            timestampWidth, senderWidth, contentsWidth,
+            senderPos, contentsPos);
+    }
+    return _measureLine->height();
+}
+
+
+void ChatScene::setRowHeight(int row, qreal height)
+{
+    qreal delta = height - _heightIndex.height(row);
+    if (delta == 0)
+        return;
+
+    // Rows below the visible area grow downwards, all others upwards. This way, refreshing
+    // stale heights while scrolling doesn't move the lines currently shown.
+    if (rowScenePos(row) >= _visibleBottom)
+        _layoutBottom += delta;
+    _heightIndex.setHeight(row, height);
+}
+
+
+ChatLine *ChatScene::materializeLine(int row)
+{
+    ChatLine *line = _lines.at(row);
+    Q_ASSERT(!line || !_materializedLines.contains(line));
+
+    qreal width = _sceneRect.width();
+    qreal contentsWidth = width - secondColumnHandle()->sceneRight();
+    qreal senderWidth = secondColumnHandle()->sceneLeft() - firstColumnHandle()->sceneRight();
+    qreal timestampWidth = firstColumnHandle()->sceneLeft();
+    QPointF contentsPos(secondColumnHandle()->sceneRight(), 0);
+    QPointF senderPos(firstColumnHandle()->sceneRight(), 0);
+
+    if (line) {
+        // without virtualization, all lines exist, but only those around the visible area are shown
+        line->show();
+    }
+    else if (!_linePool.isEmpty()) {
+        line = _linePool.takeLast();
+        line->recycle(row,
+            width,
+            timestampWidth, senderWidth, contentsWidth,
+            senderPos, contentsPos);
+        line->show();
+    }
+    else {
+        line = new ChatLine(row, model(),
+            width,
+            timestampWidth, senderWidth, contentsWidth,
+            senderPos, contentsPos);
+        addItem(line);
+    }
+    _lines[row] = line;
+    _materializedLines.insert(line);
+
+    // the stored height may be stale, e.g. after a column resize
+    bool heightChanged = (line->height() != _heightIndex.height(row));
+    setRowHeight(row, line->height());
+
+    if (hasGlobalSelection() && row >= qMin(_selectionStart, _selectionEnd) && row <= qMax(_selectionStart, _selectionEnd))
+        line->setSelected(true, (ChatLineModel::ColumnType)_selectionMinCol);
+    if (_firstLineRow > row)
+        line->hide();
+
+    if (heightChanged && !_updatingMaterializedLines)
+        repositionLines();
+    else
+        line->setPos(0, rowScenePos(row));
+
+    return line;
+}
+
+
+bool ChatScene::releaseLine(ChatLine *line)
+{
+    // Lines that are referenced from elsewhere stay around until they are no longer needed
+    if (!line->childItems().isEmpty() // e.g. search highlights
+        || line == markerLine()->chatLine()
+        || (_selectingItem && _selectingItem->chatLine() == line)
+        || line == mouseGrabberItem())
+        return false;
+#ifdef HAVE_WEBKIT
+    if (webPreview.parentItem && webPreview.parentItem->chatLine() == line)
+        return false;
+#endif
+
+    _materializedLines.remove(line);
+    chatView()->setHasCache(line, false);
+    line->clearCache();
+
+    if (!_virtualized) {
+        // hidden lines aren't positioned anymore until they are materialized again
+        line->hide();
+        return true;
+    }
+
+    _lines[line->row()] = 0;
+    if (_linePool.count() < _maxLinePoolSize) {
+        line->hide();
+        _linePool.append(line);
+    }
+    else {
+        delete line;
+    }
+    return true;
+}
+
+
+void ChatScene::repositionLines()
+{
+    foreach(ChatLine *line, _materializedLines)
+        line->setPos(0, rowScenePos(line->row()));
+
+    ChatLine *markerChatLine = markerLine()->chatLine();
+    if (markerChatLine)
+        markerLine()->setPos(0, rowScenePos(markerChatLine->row()) + rowHeight(markerChatLine->row()));
+}
+
+
+void ChatScene::updateMaterializedLines()
+{
+    if (_updatingMaterializedLines || _lines.count() != model()->rowCount())
+        return;
+
+    _updatingMaterializedLines = true;
+
+    if (!_lines.isEmpty()) {
+        // keep one viewport height worth of lines above and below the visible area around
+        qreal margin = qMax(_viewportHeight, (qreal)100);
+        qreal top = _layoutBottom - _heightIndex.totalHeight();
+        int first = qMin(_heightIndex.rowAt(_visibleTop - margin - top), _lines.count() - 1);
+        int last = qMin(_heightIndex.rowAt(_visibleBottom + margin - top), _lines.count() - 1);
+
+        foreach(ChatLine *line, _materializedLines.toList()) {
+            if (line->row() < first || line->row() > last)
+                releaseLine(line);
+        }
+        for (int row = first; row <= last; row++) {
+            if (!_lines.at(row))
+                materializeLine(row);
+        }
+        repositionLines();
+    }
+
+    updateSceneRect();
+    _updatingMaterializedLines = false;
+}
+
+
 // ========================================
 //  Webkit Only stuff
 // ========================================
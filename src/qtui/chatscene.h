@@ -29,6 +29,7 @@
 #include <QTimer>
 #include <QUrl>
 
+#include "chatlineheightindex.h"
 #include "chatlinemodel.h"
 #include "messagefilter.h"
 
@@ -79,6 +80,9 @@ public:
     inline MessageFilter *filter() const { return qobject_cast<MessageFilter *>(_model); }
     inline QString idString() const { return _idString; }
 
+    //! Find the row at the given vertical scene position in O(log n)
+    /** \return The row at y, or -1 if y is outside the scene's lines
+     */
     int rowByScenePos(qreal y) const;
     inline int rowByScenePos(const QPointF &pos) const { return rowByScenePos(pos.y()); }
     ChatLineModel::ColumnType columnByScenePos(qreal x) const;
@@ -86,8 +90,12 @@ public:
 
     ChatView *chatView() const;
     ChatItem *chatItemAt(const QPointF &pos) const;
-    inline ChatLine *chatLine(int row) const { return (row < _lines.count()) ? _lines.value(row) : 0; }
-    inline ChatLine *chatLine(const QModelIndex &index) const { return _lines.value(index.row()); }
+    //! Return the ChatLine for the given row
+    /** This materializes the ChatLine if needed, i.e. positions and shows it (creating it first in virtualized
+     *  mode). Such lines will be released again once they are outside of the visible area.
+     */
+    ChatLine *chatLine(int row) const;
+    inline ChatLine *chatLine(const QModelIndex &index) const { return chatLine(index.row()); }
 
     //! Find the ChatLine belonging to a MsgId
     /** Searches for the ChatLine belonging to a MsgId. If there are more than one ChatLine with the same msgId,
@@ -102,7 +110,20 @@ public:
      */
     ChatLine *chatLine(MsgId msgId, bool matchExact = true, bool ignoreDayChange = true) const;
 
-    inline ChatLine *lastLine() const { return _lines.count() ? _lines.last() : 0; }
+    //! Find the row belonging to a MsgId
+    /** Same as chatLine(MsgId, bool, bool), but doesn't need a ChatLine for the result. Together with
+     *  rowScenePos(), this maps a MsgId to its scene position in O(log n).
+     *  \return The row corresponding to the given MsgId, or -1 if there is none
+     */
+    int rowByMsgId(MsgId msgId, bool matchExact = true, bool ignoreDayChange = true) const;
+
+    //! The vertical scene position of a row's top edge, computed in O(log n)
+    /** Unlike ChatLine::pos(), this also works for rows that are not materialized.
+     */
+    qreal rowScenePos(int row) const;
+    inline qreal rowHeight(int row) const { return _heightIndex.height(row); }
+
+    inline ChatLine *lastLine() const { return _lines.count() ? chatLine(_lines.count() - 1) : 0; }
 
     inline MarkerLineItem *markerLine() const { return _markerLine; }
 
@@ -125,8 +146,26 @@ public:
 
     bool isScrollingAllowed() const;
 
+    //! Whether this scene only keeps ChatLines for the visible area around
+    /** In virtualized mode, the scene only keeps a ChatLineHeightIndex for all rows and materializes
+     *  ChatLines for the visible area (plus a margin) on demand. Lines scrolled out of view are recycled.
+     *  New rows are inserted with an estimated height. Geometry changes such as column resizes only lay
+     *  out the materialized lines; the stored heights of all other rows are refreshed lazily once they
+     *  are materialized again.
+     *  Without virtualization, ChatLines exist for all rows, but only the materialized ones are shown and
+     *  positioned; all others are hidden. This way, inserting or removing rows never moves more than the
+     *  lines around the visible area.
+     */
+    inline bool isVirtualized() const { return _virtualized; }
+
+    //! The part of the scene currently shown in the view, as last reported by setVisibleSceneRange()
+    inline qreal visibleSceneTop() const { return _visibleTop; }
+    inline qreal visibleSceneBottom() const { return _visibleBottom; }
+
 public slots:
     void updateForViewport(qreal width, qreal height);
+    //! Tell the scene which part of it is currently visible in the view
+    void setVisibleSceneRange(qreal top, qreal bottom);
     void setWidth(qreal width);
     void layout(int start, int end, qreal width);
 
@@ -157,6 +196,7 @@ public slots:
 signals:
     void lastLineChanged(QGraphicsItem *item, qreal offset);
     void layoutChanged(); // indicates changes to the scenerect due to resizing of the contentsitems
+    void visibleSceneRangeChanged(qreal top, qreal bottom);
     void mouseMoveWhileSelecting(const QPointF &scenePos);
 
 protected:
@@ -188,12 +228,32 @@ private:
     void setHandleXLimits();
     void updateSelection(const QPointF &pos);
 
+    inline Message::Type msgTypeAt(int row) const { return (Message::Type)model()->index(row, 0).data(MessageModel::TypeRole).toInt(); }
+
+    // lines around the visible area
+    qreal measureRow(int row);
+    void setRowHeight(int row, qreal height);
+    ChatLine *materializeLine(int row);
+    bool releaseLine(ChatLine *line);
+    void repositionLines();
+    void updateMaterializedLines();
+
     ChatView *_chatView;
     QString _idString;
     QAbstractItemModel *_model;
-    QList<ChatLine *> _lines;
+    QList<ChatLine *> _lines; // in virtualized mode, rows that are not materialized are 0
     BufferId _singleBufferId;
 
+    bool _virtualized;
+    bool _updatingMaterializedLines;
+    ChatLineHeightIndex _heightIndex; // maintained in both modes; lines are positioned from it
+    QSet<ChatLine *> _materializedLines; // shown and positioned from _heightIndex
+    QList<ChatLine *> _linePool;
+    ChatLine *_measureLine;
+    qreal _layoutBottom;
+    qreal _visibleTop, _visibleBottom;
+    static const int _maxLinePoolSize = 128;
+
     // calls to QChatScene::sceneRect() are very expensive. As we manage the scenerect ourselves
     // we store the size in a member variable.
     QRectF _sceneRect;
@@ -160,6 +160,17 @@ void ChatView::adjustSceneRect()
     // by some hopefully large enough value to avoid this problem.
 
     setSceneRect(scene()->sceneRect().adjusted(0, 0, -25, 0));
+    updateVisibleSceneRange();
+}
+
+
+void ChatView::updateVisibleSceneRange()
+{
+    // virtualized scenes create ChatLines for the visible area on demand, and the search
+    // controller only creates highlight items for the visible matches
+    qreal top = mapToScene(viewport()->rect().topLeft()).y();
+    qreal bottom = mapToScene(viewport()->rect().bottomRight()).y();
+    scene()->setVisibleSceneRange(top, bottom);
 }
 
 
@@ -386,6 +397,7 @@ void ChatView::invalidateFilter()
 void ChatView::scrollContentsBy(int dx, int dy)
 {
     QGraphicsView::scrollContentsBy(dx, dy);
+    updateVisibleSceneRange();
     checkChatLineCaches();
 }
 
@@ -108,6 +108,7 @@ private slots:
 
 private:
     void init(MessageFilter *filter);
+    void updateVisibleSceneRange();
 
     AbstractBufferContainer *_bufferContainer;
     ChatScene *_scene;
@@ -21,6 +21,7 @@
 #include "chatviewsearchcontroller.h"
 
 #include <QAbstractItemModel>
+#include <QElapsedTimer>
 #include <QPainter>
 
 #include "chatitem.h"
@@ -32,12 +33,22 @@
 ChatViewSearchController::ChatViewSearchController(QObject *parent)
     : QObject(parent),
     _scene(0),
-    _currentHighlight(0),
+    _currentHit(0),
+    _hasAnchor(false),
+    _scanRow(-1),
     _caseSensitive(false),
     _searchSenders(false),
     _searchMsgs(true),
     _searchOnlyRegularMsgs(true)
 {
+    _searchTimer.setSingleShot(true);
+    connect(&_searchTimer, SIGNAL(timeout()), this, SLOT(continueSearch()));
+}
+
+
+ChatViewSearchController::~ChatViewSearchController()
+{
+    clearHits();
 }
 
 
@@ -66,9 +77,11 @@ void ChatViewSearchController::setScene(ChatScene *scene)
 
     if (_scene) {
         disconnect(_scene, 0, this, 0);
-        disconnect(Client::messageModel(), 0, this, 0);
-        qDeleteAll(_highlightItems);
-        _highlightItems.clear();
+        disconnect(_scene->model(), 0, this, 0);
+        clearHits();
+        _pendingMsgIds.clear();
+        _scanRow = -1;
+        _searchTimer.stop();
     }
 
     _scene = scene;
@@ -77,42 +90,41 @@ void ChatViewSearchController::setScene(ChatScene *scene)
 
     connect(_scene, SIGNAL(destroyed()), this, SLOT(sceneDestroyed()));
     connect(_scene, SIGNAL(layoutChanged()), this, SLOT(repositionHighlights()));
-    connect(Client::messageModel(), SIGNAL(finishedBacklogFetch(BufferId)), this, SLOT(updateHighlights()));
+    connect(_scene, SIGNAL(visibleSceneRangeChanged(qreal, qreal)), this, SLOT(updateHighlightItems()));
+    connect(_scene->model(), SIGNAL(rowsInserted(const QModelIndex &, int, int)),
+        this, SLOT(rowsInserted(const QModelIndex &, int, int)));
+    connect(_scene->model(), SIGNAL(rowsAboutToBeRemoved(const QModelIndex &, int, int)),
+        this, SLOT(rowsAboutToBeRemoved(const QModelIndex &, int, int)));
     updateHighlights();
 }
 
 
 void ChatViewSearchController::highlightNext()
 {
-    if (_highlightItems.isEmpty())
+    if (_hits.isEmpty())
         return;
 
-    if (_currentHighlight < _highlightItems.count()) {
-        _highlightItems.at(_currentHighlight)->setHighlighted(false);
-    }
-
-    _currentHighlight++;
-    if (_currentHighlight >= _highlightItems.count())
-        _currentHighlight = 0;
-    _highlightItems.at(_currentHighlight)->setHighlighted(true);
-    emit newCurrentHighlight(_highlightItems.at(_currentHighlight));
+    int index = _currentHit ? hitIndex(_currentHit) + 1 : 0;
+    if (index >= _hits.count())
+        index = 0;
+    setCurrentHit(_hits.at(index));
 }
 
 
 void ChatViewSearchController::highlightPrev()
 {
-    if (_highlightItems.isEmpty())
+    if (_hits.isEmpty())
         return;
 
-    if (_currentHighlight < _highlightItems.count()) {
-        _highlightItems.at(_currentHighlight)->setHighlighted(false);
+    int index = _currentHit ? hitIndex(_currentHit) - 1 : _hits.count() - 1;
+    if (index < 0) {
+        // we've passed the oldest match we have, so continue the search in the backlog
+        // stored in the core. Matches in there show up as soon as it has arrived.
+        if (_scene)
+            _scene->requestBacklog();
+        index = _hits.count() - 1;
     }
-
-    _currentHighlight--;
-    if (_currentHighlight < 0)
-        _currentHighlight = _highlightItems.count() - 1;
-    _highlightItems.at(_currentHighlight)->setHighlighted(true);
-    emit newCurrentHighlight(_highlightItems.at(_currentHighlight));
+    setCurrentHit(_hits.at(index));
 }
 
 
@@ -121,212 +133,380 @@ void ChatViewSearchController::updateHighlights(bool reuse)
     if (!_scene)
         return;
 
+    // try to stay close to the current match
+    _hasAnchor = _currentHit != 0;
+    if (_currentHit)
+        _anchor = SearchHit(_currentHit->msgId, _currentHit->column, _currentHit->start);
+
+    QList<MsgId> candidates;
     if (reuse) {
-        QSet<ChatLine *> chatLines;
-        foreach(SearchHighlightItem *highlightItem, _highlightItems) {
-            ChatLine *line = qgraphicsitem_cast<ChatLine *>(highlightItem->parentItem());
-            if (line)
-                chatLines << line;
-        }
-        foreach(ChatLine *line, QList<ChatLine *>(chatLines.toList())) {
-            updateHighlights(line);
+        // only messages that matched before (or are still pending) can match the restricted search
+        candidates = _pendingMsgIds;
+        foreach(SearchHit *hit, _hits) {
+            if (candidates.isEmpty() || candidates.last() != hit->msgId)
+                candidates << hit->msgId;
         }
+        qSort(candidates);
+    }
+
+    clearHits();
+    _pendingMsgIds.clear();
+
+    if (searchString().isEmpty() || !(_searchSenders || _searchMsgs)) {
+        _scanRow = -1;
+        _searchTimer.stop();
+        return;
+    }
+
+    if (reuse) {
+        // rows that weren't scanned yet by a previous search still have to be scanned as a whole
+        _pendingMsgIds = candidates;
     }
     else {
-        QPointF oldHighlightPos;
-        if (!_highlightItems.isEmpty() && _currentHighlight < _highlightItems.count()) {
-            oldHighlightPos = _highlightItems[_currentHighlight]->scenePos();
+        _scanRow = _scene->model()->rowCount() - 1;
+    }
+
+    // the first slice covers the bottom of the scene, which is what the user is most likely looking at
+    continueSearch();
+}
+
+
+void ChatViewSearchController::continueSearch()
+{
+    if (!_scene)
+        return;
+
+    QList<SearchHit *> hits;
+    QElapsedTimer timer;
+    timer.start();
+    int checkedRows = 0;
+    while (!_pendingMsgIds.isEmpty() || _scanRow >= 0) {
+        // _pendingMsgIds are all below the rows that remain to be scanned
+        if (!_pendingMsgIds.isEmpty()) {
+            int row = _scene->rowByMsgId(_pendingMsgIds.takeLast());
+            if (row >= 0)
+                searchRow(row, hits);
         }
-        qDeleteAll(_highlightItems);
-        _highlightItems.clear();
-        Q_ASSERT(_highlightItems.isEmpty());
-
-        if (searchString().isEmpty() || !(_searchSenders || _searchMsgs))
-            return;
-
-        checkMessagesForHighlight();
-
-        if (!_highlightItems.isEmpty()) {
-            if (!oldHighlightPos.isNull()) {
-                int start = 0; int end = _highlightItems.count() - 1;
-                QPointF startPos;
-                QPointF endPos;
-                while (1) {
-                    startPos = _highlightItems[start]->scenePos();
-                    endPos = _highlightItems[end]->scenePos();
-                    if (startPos == oldHighlightPos) {
-                        _currentHighlight = start;
-                        break;
-                    }
-                    if (endPos == oldHighlightPos) {
-                        _currentHighlight = end;
-                        break;
-                    }
-                    if (end - start == 1) {
-                        _currentHighlight = start;
-                        break;
-                    }
-                    int pivot = (end + start) / 2;
-                    QPointF pivotPos = _highlightItems[pivot]->scenePos();
-                    if (startPos.y() == endPos.y()) {
-                        if (oldHighlightPos.x() <= pivotPos.x())
-                            end = pivot;
-                        else
-                            start = pivot;
-                    }
-                    else {
-                        if (oldHighlightPos.y() <= pivotPos.y())
-                            end = pivot;
-                        else
-                            start = pivot;
-                    }
-                }
-            }
-            else {
-                _currentHighlight = _highlightItems.count() - 1;
-            }
-            _highlightItems[_currentHighlight]->setHighlighted(true);
-            emit newCurrentHighlight(_highlightItems[_currentHighlight]);
+        else {
+            searchRow(_scanRow--, hits);
         }
+
+        if (++checkedRows % 64 == 0 && timer.elapsed() >= _searchTimeSlice)
+            break;
     }
+
+    insertHits(hits);
+    if (!_currentHit)
+        updateCurrentHit();
+    updateHighlightItems();
+
+    if (!_pendingMsgIds.isEmpty() || _scanRow >= 0)
+        _searchTimer.start(0);
 }
 
 
-void ChatViewSearchController::checkMessagesForHighlight(int start, int end)
+void ChatViewSearchController::searchRow(int row, QList<SearchHit *> &hits) const
 {
     QAbstractItemModel *model = _scene->model();
     Q_ASSERT(model);
 
-    if (end == -1) {
-        end = model->rowCount() - 1;
-        if (end == -1)
-            return;
-    }
+    QModelIndex index = model->index(row, 0);
+    Message::Type type = (Message::Type)index.data(MessageModel::TypeRole).toInt();
+    // day change messages share their msgId with the preceding message
+    if (type == Message::DayChange || (_searchOnlyRegularMsgs && !checkType(type)))
+        return;
 
-    QModelIndex index;
-    for (int row = start; row <= end; row++) {
-        if (_searchOnlyRegularMsgs) {
-            index = model->index(row, 0);
-            if (!checkType((Message::Type)index.data(MessageModel::TypeRole).toInt()))
-                continue;
+    MsgId msgId = index.data(MessageModel::MsgIdRole).value<MsgId>();
+    for (int column = ChatLineModel::SenderColumn; column <= ChatLineModel::ContentsColumn; column++) {
+        if ((column == ChatLineModel::SenderColumn && !_searchSenders) || (column == ChatLineModel::ContentsColumn && !_searchMsgs))
+            continue;
+
+        QString plainText = model->index(row, column).data(MessageModel::DisplayRole).toString();
+        int searchIdx = plainText.indexOf(searchString(), 0, caseSensitive());
+        while (searchIdx != -1) {
+            hits << new SearchHit(msgId, (ChatLineModel::ColumnType)column, searchIdx);
+            searchIdx = plainText.indexOf(searchString(), searchIdx + 1, caseSensitive());
         }
-        highlightLine(_scene->chatLine(row));
     }
 }
 
 
-void ChatViewSearchController::updateHighlights(ChatLine *line)
+bool ChatViewSearchController::hitLessThan(const SearchHit *hit1, const SearchHit *hit2)
 {
-    QList<ChatItem *> checkItems;
-    if (_searchSenders)
-        checkItems << line->item(MessageModel::SenderColumn);
+    if (hit1->msgId != hit2->msgId)
+        return hit1->msgId < hit2->msgId;
+    if (hit1->column != hit2->column)
+        return hit1->column < hit2->column;
+    return hit1->start < hit2->start;
+}
+
+
+int ChatViewSearchController::hitIndex(const SearchHit *hit) const
+{
+    return qLowerBound(_hits.constBegin(), _hits.constEnd(), hit, hitLessThan) - _hits.constBegin();
+}
 
-    if (_searchMsgs)
-        checkItems << line->item(MessageModel::ContentsColumn);
 
-    QHash<quint64, QHash<quint64, QRectF> > wordRects;
-    foreach(ChatItem *item, checkItems) {
-        foreach(QRectF wordRect, item->findWords(searchString(), caseSensitive())) {
-            wordRects[(quint64)(wordRect.x() + item->x())][(quint64)(wordRect.y())] = wordRect;
+int ChatViewSearchController::firstHitIndex(MsgId msgId) const
+{
+    int start = 0;
+    int n = _hits.count();
+    while (n > 0) {
+        int half = n >> 1;
+        if (_hits.at(start + half)->msgId < msgId) {
+            start += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
         }
     }
+    return start;
+}
 
-    bool deleteAll = false;
-    QAbstractItemModel *model = _scene->model();
-    Q_ASSERT(model);
-    if (_searchOnlyRegularMsgs) {
-        QModelIndex index = model->index(line->row(), 0);
-        if (!checkType((Message::Type)index.data(MessageModel::TypeRole).toInt()))
-            deleteAll = true;
+
+void ChatViewSearchController::insertHits(const QList<SearchHit *> &hits)
+{
+    // new hits mostly end up at the top, where inserting into a QList is cheap
+    foreach(SearchHit *hit, hits) {
+        _hits.insert(qLowerBound(_hits.begin(), _hits.end(), hit, hitLessThan), hit);
     }
+}
 
-    foreach(QGraphicsItem *child, line->childItems()) {
-        SearchHighlightItem *highlightItem = qgraphicsitem_cast<SearchHighlightItem *>(child);
-        if (!highlightItem)
-            continue;
 
-        if (!deleteAll && wordRects.contains((quint64)(highlightItem->pos().x())) && wordRects[(quint64)(highlightItem->pos().x())].contains((quint64)(highlightItem->pos().y()))) {
-            QRectF &wordRect = wordRects[(quint64)(highlightItem->pos().x())][(quint64)(highlightItem->pos().y())];
-            highlightItem->updateGeometry(wordRect.width(), wordRect.height());
+void ChatViewSearchController::removeHits(const QSet<MsgId> &msgIds)
+{
+    int currentIndex = -1;
+    for (int i = 0; i < _hits.count(); ) {
+        SearchHit *hit = _hits.at(i);
+        if (!msgIds.contains(hit->msgId)) {
+            i++;
+            continue;
         }
-        else {
-            int pos = _highlightItems.indexOf(highlightItem);
-            if (pos == _currentHighlight) {
-                highlightPrev();
-            }
-            else if (pos < _currentHighlight) {
-                _currentHighlight--;
-            }
-
-            _highlightItems.removeAt(pos);
-            delete highlightItem;
+        if (hit == _currentHit) {
+            currentIndex = i;
+            _currentHit = 0;
         }
+        deleteHighlightItem(hit);
+        delete _hits.takeAt(i);
+    }
+
+    if (currentIndex != -1 && !_hits.isEmpty()) {
+        // don't jump around just because some lines went away
+        _currentHit = _hits.at(qMin(currentIndex, _hits.count() - 1));
+        if (_currentHit->item)
+            _currentHit->item->setHighlighted(true);
     }
 }
 
 
-void ChatViewSearchController::highlightLine(ChatLine *line)
+void ChatViewSearchController::clearHits()
 {
-    QList<ChatItem *> checkItems;
-    if (_searchSenders)
-        checkItems << line->item(MessageModel::SenderColumn);
+    foreach(SearchHit *hit, _itemHits) {
+        delete hit->item;
+    }
+    _itemHits.clear();
+    qDeleteAll(_hits);
+    _hits.clear();
+    _currentHit = 0;
+}
 
-    if (_searchMsgs)
-        checkItems << line->item(MessageModel::ContentsColumn);
 
-    foreach(ChatItem *item, checkItems) {
-        foreach(QRectF wordRect, item->findWords(searchString(), caseSensitive())) {
-            _highlightItems << new SearchHighlightItem(wordRect.adjusted(item->x(), 0, item->x(), 0), line);
-        }
+void ChatViewSearchController::updateCurrentHit()
+{
+    if (_hits.isEmpty())
+        return;
+
+    SearchHit *hit = 0;
+    if (!_hasAnchor) {
+        hit = _hits.last();
+    }
+    else {
+        // the search runs bottom up, so the closest match at or above the anchor is final once we have it
+        QList<SearchHit *>::const_iterator iter = qUpperBound(_hits.constBegin(), _hits.constEnd(), &_anchor, hitLessThan);
+        if (iter != _hits.constBegin())
+            hit = *(iter - 1);
+        else if (_pendingMsgIds.isEmpty() && _scanRow < 0)
+            hit = _hits.first();
     }
+
+    if (hit)
+        setCurrentHit(hit);
 }
 
 
-void ChatViewSearchController::repositionHighlights()
+void ChatViewSearchController::setCurrentHit(SearchHit *hit)
 {
-    QSet<ChatLine *> chatLines;
-    foreach(SearchHighlightItem *item, _highlightItems) {
-        ChatLine *line = qgraphicsitem_cast<ChatLine *>(item->parentItem());
-        if (line)
-            chatLines << line;
+    if (_currentHit && _currentHit->item)
+        _currentHit->item->setHighlighted(false);
+
+    _currentHit = hit;
+    if (!hit)
+        return;
+
+    if (!hit->item && !createHighlightItem(hit))
+        return;
+
+    hit->item->setHighlighted(true);
+    emit newCurrentHighlight(hit->item);
+}
+
+
+bool ChatViewSearchController::createHighlightItem(SearchHit *hit)
+{
+    Q_ASSERT(!hit->item);
+    int row = _scene->rowByMsgId(hit->msgId);
+    if (row < 0)
+        return false;
+
+    ChatLine *line = _scene->chatLine(row);
+    ChatItem *item = line->item(hit->column);
+    hit->item = new SearchHighlightItem(item->wordRect(hit->start, searchString().count()).translated(item->x(), 0), line);
+    _itemHits << hit;
+    return true;
+}
+
+
+void ChatViewSearchController::deleteHighlightItem(SearchHit *hit)
+{
+    delete hit->item;
+    _itemHits.remove(hit);
+}
+
+
+void ChatViewSearchController::positionHighlightItem(SearchHit *hit)
+{
+    ChatLine *line = qgraphicsitem_cast<ChatLine *>(hit->item->parentItem());
+    if (!line)
+        return;
+
+    ChatItem *item = line->item(hit->column);
+    hit->item->setWordRect(item->wordRect(hit->start, searchString().count()).translated(item->x(), 0));
+}
+
+
+void ChatViewSearchController::updateHighlightItems()
+{
+    if (!_scene)
+        return;
+
+    // find the rows currently shown in the view
+    QAbstractItemModel *model = _scene->model();
+    int rowCount = model->rowCount();
+    int firstRow = -1;
+    int lastRow = -1;
+    if (rowCount && !_hits.isEmpty()) {
+        qreal top = _scene->visibleSceneTop();
+        qreal bottom = _scene->visibleSceneBottom();
+        qreal linesTop = _scene->rowScenePos(0);
+        firstRow = top < linesTop ? 0 : _scene->rowByScenePos(top);
+        if (bottom >= linesTop) {
+            lastRow = _scene->rowByScenePos(bottom);
+            if (lastRow < 0)
+                lastRow = rowCount - 1;
+        }
     }
-    QList<ChatLine *> chatLineList(chatLines.toList());
-    foreach(ChatLine *line, chatLineList) {
-        repositionHighlights(line);
+
+    bool visible = firstRow >= 0 && firstRow <= lastRow;
+    MsgId firstMsgId, lastMsgId;
+    if (visible) {
+        firstMsgId = model->index(firstRow, 0).data(MessageModel::MsgIdRole).value<MsgId>();
+        lastMsgId = model->index(lastRow, 0).data(MessageModel::MsgIdRole).value<MsgId>();
+    }
+
+    // drop the items that left the view, except for the current one
+    foreach(SearchHit *hit, _itemHits) {
+        if (!hit->item) {
+            // the ChatLine was deleted along with its children
+            _itemHits.remove(hit);
+            continue;
+        }
+        if (hit == _currentHit)
+            continue;
+        if (!visible || hit->msgId < firstMsgId || hit->msgId > lastMsgId)
+            deleteHighlightItem(hit);
+    }
+
+    if (!visible)
+        return;
+
+    for (int i = firstHitIndex(firstMsgId); i < _hits.count() && _hits.at(i)->msgId <= lastMsgId; i++) {
+        SearchHit *hit = _hits.at(i);
+        if (!hit->item)
+            createHighlightItem(hit);
     }
 }
 
 
-void ChatViewSearchController::repositionHighlights(ChatLine *line)
+void ChatViewSearchController::repositionHighlights()
 {
-    QList<SearchHighlightItem *> searchHighlights;
-    foreach(QGraphicsItem *child, line->childItems()) {
-        SearchHighlightItem *highlightItem = qgraphicsitem_cast<SearchHighlightItem *>(child);
-        if (highlightItem)
-            searchHighlights << highlightItem;
+    foreach(SearchHit *hit, _itemHits) {
+        if (hit->item)
+            positionHighlightItem(hit);
     }
+}
+
 
-    if (searchHighlights.isEmpty())
+void ChatViewSearchController::rowsInserted(const QModelIndex &parent, int start, int end)
+{
+    Q_UNUSED(parent);
+    if (!_scene || searchString().isEmpty() || !(_searchSenders || _searchMsgs))
         return;
 
-    QList<QPointF> wordPos;
-    if (_searchSenders) {
-        foreach(QRectF wordRect, line->senderItem()->findWords(searchString(), caseSensitive())) {
-            wordPos << QPointF(wordRect.x() + line->senderItem()->x(), wordRect.y());
-        }
+    if (start <= _scanRow) {
+        // the new rows are part of the area that still has to be scanned
+        _scanRow += end - start + 1;
+        return;
     }
-    if (_searchMsgs) {
-        foreach(QRectF wordRect, line->contentsItem()->findWords(searchString(), caseSensitive())) {
-            wordPos << QPointF(wordRect.x() + line->contentsItem()->x(), wordRect.y());
+
+    QAbstractItemModel *model = _scene->model();
+    QList<SearchHit *> hits;
+    for (int row = start; row <= end; row++) {
+        QModelIndex index = model->index(row, 0);
+        if ((Message::Type)index.data(MessageModel::TypeRole).toInt() == Message::DayChange)
+            continue;
+
+        MsgId msgId = index.data(MessageModel::MsgIdRole).value<MsgId>();
+        if (!_pendingMsgIds.isEmpty() && msgId < _pendingMsgIds.last()) {
+            // this one will be searched along with the other pending messages
+            _pendingMsgIds.insert(qLowerBound(_pendingMsgIds.begin(), _pendingMsgIds.end(), msgId), msgId);
+            continue;
         }
+        searchRow(row, hits);
     }
 
-    qSort(searchHighlights.begin(), searchHighlights.end(), SearchHighlightItem::firstInLine);
+    if (hits.isEmpty())
+        return;
+
+    insertHits(hits);
+    if (!_currentHit)
+        updateCurrentHit();
+    updateHighlightItems();
+}
 
-    Q_ASSERT(wordPos.count() == searchHighlights.count());
-    for (int i = 0; i < searchHighlights.count(); i++) {
-        searchHighlights.at(i)->setPos(wordPos.at(i));
+
+void ChatViewSearchController::rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end)
+{
+    Q_UNUSED(parent);
+    if (!_scene)
+        return;
+
+    if (end <= _scanRow)
+        _scanRow -= end - start + 1;
+    else if (start <= _scanRow)
+        _scanRow = start - 1;
+
+    if (_hits.isEmpty())
+        return;
+
+    QAbstractItemModel *model = _scene->model();
+    QSet<MsgId> msgIds;
+    for (int row = start; row <= end; row++) {
+        QModelIndex index = model->index(row, 0);
+        if ((Message::Type)index.data(MessageModel::TypeRole).toInt() != Message::DayChange)
+            msgIds << index.data(MessageModel::MsgIdRole).value<MsgId>();
     }
+    removeHits(msgIds);
 }
 
 
@@ -335,8 +515,12 @@ void ChatViewSearchController::sceneDestroyed()
     // WARNING: don't call any methods on scene!
     _scene = 0;
     // the items will be automatically deleted when the scene is destroyed
-    // so we just have to clear the list;
-    _highlightItems.clear();
+    // so we just have to clear the lists
+    _itemHits.clear();
+    clearHits();
+    _pendingMsgIds.clear();
+    _scanRow = -1;
+    _searchTimer.stop();
 }
 
 
@@ -408,6 +592,13 @@ SearchHighlightItem::SearchHighlightItem(QRectF wordRect, QGraphicsItem *parent)
 }
 
 
+void SearchHighlightItem::setWordRect(const QRectF &wordRect)
+{
+    setPos(wordRect.x(), wordRect.y());
+    updateGeometry(wordRect.width(), wordRect.height());
+}
+
+
 void SearchHighlightItem::setHighlighted(bool highlighted)
 {
     _highlighted = highlighted;
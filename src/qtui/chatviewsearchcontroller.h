@@ -24,8 +24,10 @@
 #include <QGraphicsItem>
 #include <QHash>
 #include <QPointer>
+#include <QSet>
 #include <QString>
 #include <QTimeLine>
+#include <QTimer>
 
 #include "chatscene.h"
 #include "message.h"
@@ -34,12 +36,24 @@ class QGraphicsItem;
 class ChatLine;
 class SearchHighlightItem;
 
+//! Searches the messages shown in a ChatScene
+/** The matches are kept as plain (MsgId, column, position) data, sorted the same way the scene is.
+ *  SearchHighlightItems are only created for the matches in the visible part of the scene and for
+ *  the current match, so neither the ChatLines nor the highlight items of the whole buffer have to exist.
+ *
+ *  The model can only be accessed from the GUI thread, so the search runs in short time slices from the
+ *  event loop, starting at the bottom of the scene. If the new search string merely extends the previous
+ *  one (or the other search options are a restriction of the previous ones), only messages that matched
+ *  before are searched again. Messages arriving while a search is active are searched as well, which
+ *  also continues the search into backlog fetched from the core.
+ */
 class ChatViewSearchController : public QObject
 {
     Q_OBJECT
 
 public:
     ChatViewSearchController(QObject *parent = 0);
+    ~ChatViewSearchController();
 
     inline const QString &searchString() const { return _searchString; }
 
@@ -58,18 +72,43 @@ public slots:
 private slots:
     void sceneDestroyed();
     void updateHighlights(bool reuse = false);
+    void continueSearch();
+    void updateHighlightItems();
 
     void repositionHighlights();
-    void repositionHighlights(ChatLine *line);
+
+    void rowsInserted(const QModelIndex &parent, int start, int end);
+    void rowsAboutToBeRemoved(const QModelIndex &parent, int start, int end);
 
 signals:
     void newCurrentHighlight(QGraphicsItem *highlightItem);
 
 private:
+    struct SearchHit {
+        MsgId msgId;
+        ChatLineModel::ColumnType column;
+        int start;
+        QPointer<SearchHighlightItem> item;
+
+        SearchHit(MsgId msgId_ = MsgId(), ChatLineModel::ColumnType column_ = ChatLineModel::ContentsColumn, int start_ = 0)
+            : msgId(msgId_), column(column_), start(start_) {}
+    };
+
     QString _searchString;
     ChatScene *_scene;
-    QList<SearchHighlightItem *> _highlightItems;
-    int _currentHighlight;
+    QList<SearchHit *> _hits; // sorted by position in the scene
+    QSet<SearchHit *> _itemHits; // hits that currently have a highlight item
+    SearchHit *_currentHit;
+
+    // the search keeps close to the match that was current before it was started
+    SearchHit _anchor;
+    bool _hasAnchor;
+
+    // pending work; everything in _pendingMsgIds lies below the rows still to be scanned
+    QList<MsgId> _pendingMsgIds; // messages that matched a previous search, sorted
+    int _scanRow; // rows up to and including this one haven't been searched yet
+    QTimer _searchTimer;
+    static const int _searchTimeSlice = 10; // ms spent searching before returning to the event loop
 
     bool _caseSensitive;
     bool _searchSenders;
@@ -80,9 +119,19 @@ private:
 
     inline bool checkType(Message::Type type) const { return type & (Message::Plain | Message::Notice | Message::Action); }
 
-    void checkMessagesForHighlight(int start = 0, int end = -1);
-    void highlightLine(ChatLine *line);
-    void updateHighlights(ChatLine *line);
+    static bool hitLessThan(const SearchHit *hit1, const SearchHit *hit2);
+    int hitIndex(const SearchHit *hit) const;
+    int firstHitIndex(MsgId msgId) const;
+
+    void clearHits();
+    void searchRow(int row, QList<SearchHit *> &hits) const;
+    void insertHits(const QList<SearchHit *> &hits);
+    void removeHits(const QSet<MsgId> &msgIds);
+    void updateCurrentHit();
+    void setCurrentHit(SearchHit *hit);
+    bool createHighlightItem(SearchHit *hit);
+    void deleteHighlightItem(SearchHit *hit);
+    void positionHighlightItem(SearchHit *hit);
 };
 
 
@@ -105,6 +154,7 @@ public :
     virtual inline int type() const { return Type; }
 
     void setHighlighted(bool highlighted);
+    void setWordRect(const QRectF &wordRect);
 
     static bool firstInLine(QGraphicsItem *item1, QGraphicsItem *item2);
 
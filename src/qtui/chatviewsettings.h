@@ -48,6 +48,9 @@ public:
     inline QString timestampFormatString() { return localValue("TimestampFormat", "[hh:mm:ss]").toString(); }
     inline void setTimestampFormatString(const QString &format) { setLocalValue("TimestampFormat", format); }
 
+    inline bool virtualizedScene() { return localValue("VirtualizedScene", false).toBool(); }
+    inline void setVirtualizedScene(bool enabled) { setLocalValue("VirtualizedScene", enabled); }
+
     inline QString webSearchUrlFormatString() { return localValue("WebSearchUrlFormat", "https://www.google.com/search?q=%s").toString(); }
     inline void setWebSearchUrlFormatString(const QString &format) { setLocalValue("WebSearchUrlFormat", format); }
 };
@@ -48,72 +48,304 @@ void Clickable::activate(NetworkId networkId, const QString &text) const
 }
 
 
-// NOTE: This method is not threadsafe and not reentrant!
-//       (RegExps are not constant while matching, and they are static here for efficiency)
-ClickableList ClickableList::fromString(const QString &str)
+namespace {
+
+// Helpers for the scanner below. They mirror the character classes of the regular expressions we used to match
+// URLs and channel names with; \w in QRegExp matches letters, numbers, marks and the underscore.
+inline bool isWordChar(QChar c)
 {
-    // For matching URLs
-    static QString scheme("(?:(?:mailto:|(?:[+.-]?\\w)+://)|www(?=\\.\\S+\\.))");
-    static QString authority("(?:(?:[,.;@:]?[-\\w]+)+\\.?|\\[[0-9a-f:.]+\\])(?::\\d+)?");
-    static QString urlChars("(?:[,.;:]*[\\w~@/?&=+$()!%#*-])");
-    static QString urlEnd("(?:>|[,.;:\"]*\\s|\\b|$)");
+    return c.isLetterOrNumber() || c.isMark() || c == '_';
+}
 
-    static QRegExp regExp[] = {
-        // URL
-        // QRegExp(QString("((?:https?://|s?ftp://|irc://|mailto:|www\\.)%1+|%1+\\.[a-z]{2,4}(?:?=/%1+|\\b))%2").arg(urlChars, urlEnd)),
-        QRegExp(QString("\\b(%1%2(?:/%3*)?)%4").arg(scheme, authority, urlChars, urlEnd), Qt::CaseInsensitive),
 
-        // Channel name
-        // We don't match for channel names starting with + or &, because that gives us a lot of false positives.
-        QRegExp("((?:#|![A-Z0-9]{5})[^,:\\s]+(?::[^,:\\s]+)?)\\b", Qt::CaseInsensitive)
+inline bool isWordBoundary(const QChar *s, int len, int pos)
+{
+    bool before = pos > 0 && isWordChar(s[pos-1]);
+    bool after = pos < len && isWordChar(s[pos]);
+    return before != after;
+}
 
-        // TODO: Nicks, we'll need a filtering for only matching known nicknames further down if we do this
-    };
 
-    static const int regExpCount = 2; // number of regexps in the array above
+inline bool matchesCaseInsensitive(const QChar *s, int len, int pos, const char *literal)
+{
+    for (; *literal; ++literal, ++pos) {
+        if (pos >= len || s[pos].toLower() != QLatin1Char(*literal))
+            return false;
+    }
+    return true;
+}
 
-    qint16 matches[] = { 0, 0, 0 };
-    qint16 matchEnd[] = { 0, 0, 0 };
 
-    ClickableList result;
-    //QString str = data(ChatLineModel::DisplayRole).toString();
-
-    qint16 idx = 0;
-    qint16 minidx;
-    int type = -1;
-
-    do {
-        type = -1;
-        minidx = str.length();
-        for (int i = 0; i < regExpCount; i++) {
-            if (matches[i] < 0 || matchEnd[i] > str.length()) continue;
-            if (idx >= matchEnd[i]) {
-                matches[i] = regExp[i].indexIn(str, qMax(matchEnd[i], idx));
-                if (matches[i] >= 0) matchEnd[i] = matches[i] + regExp[i].cap(1).length();
+// characters that may separate the parts of an authority: [,.;@:]
+inline bool isAuthoritySeparator(QChar c)
+{
+    return c == ',' || c == '.' || c == ';' || c == '@' || c == ':';
+}
+
+
+// characters a URL may contain, but not end with: [,.;:]
+inline bool isUrlInnerPunct(QChar c)
+{
+    return c == ',' || c == '.' || c == ';' || c == ':';
+}
+
+
+// characters a URL path may end with: [\w~@/?&=+$()!%#*-]
+inline bool isUrlChar(QChar c)
+{
+    if (isWordChar(c))
+        return true;
+    switch (c.unicode()) {
+    case '~': case '@': case '/': case '?': case '&': case '=': case '+':
+    case '$': case '(': case ')': case '!': case '%': case '#': case '*': case '-':
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+// characters that may trail a URL before whitespace: [,.;:"]
+inline bool isUrlTrailingPunct(QChar c)
+{
+    return isUrlInnerPunct(c) || c == '"';
+}
+
+
+inline bool isChannelChar(QChar c)
+{
+    return c != ',' && c != ':' && !c.isSpace();
+}
+
+
+inline bool isHexAddressChar(QChar c)
+{
+    ushort u = c.toLower().unicode();
+    return (u >= '0' && u <= '9') || (u >= 'a' && u <= 'f') || u == ':' || u == '.';
+}
+
+
+/* Tries to match a URL starting at the word start pos. Returns the end of the match, or -1.
+ * schemeFail and wwwFail remember the end of word runs that are already known not to contain a scheme, so that we
+ * don't scan them again for every word start inside the run.
+ */
+int scanUrl(const QChar *s, int len, int pos, int &schemeFail, int &wwwFail)
+{
+    int p = -1;
+
+    // scheme: mailto: | (?:[+.-]?\w)+:// | www(?=\.\S+\.)
+    if (matchesCaseInsensitive(s, len, pos, "mailto:"))
+        p = pos + 7;
+
+    if (p < 0 && pos >= schemeFail) {
+        int k = pos;
+        while (k < len) {
+            if (isWordChar(s[k]))
+                ++k;
+            else if ((s[k] == '+' || s[k] == '.' || s[k] == '-') && k + 1 < len && isWordChar(s[k+1]))
+                k += 2;
+            else
+                break;
+        }
+        if (k + 2 < len && s[k] == ':' && s[k+1] == '/' && s[k+2] == '/')
+            p = k + 3;
+        else
+            schemeFail = k;
+    }
+
+    if (p < 0 && pos >= wwwFail && matchesCaseInsensitive(s, len, pos, "www.")) {
+        int k = pos + 4;
+        while (k < len && !s[k].isSpace()) {
+            if (s[k] == '.' && k > pos + 4) {
+                p = pos + 3;
+                break;
             }
-            if (matches[i] >= 0 && matches[i] < minidx) {
-                minidx = matches[i];
-                type = i;
+            ++k;
+        }
+        if (p < 0)
+            wwwFail = k;
+    }
+
+    if (p < 0)
+        return -1;
+
+    // authority: (?:(?:[,.;@:]?[-\w]+)+\.?|\[[0-9a-f:.]+\])(?::\d+)?
+    int authorityStart = p;
+    if (p < len && s[p] == '[') {
+        int k = p + 1;
+        while (k < len && isHexAddressChar(s[k]))
+            ++k;
+        if (k == p + 1 || k >= len || s[k] != ']')
+            return -1;
+        p = k + 1;
+    }
+    else {
+        int k = p;
+        forever {
+            int q = k;
+            if (q < len && isAuthoritySeparator(s[q]))
+                ++q;
+            int r = q;
+            while (r < len && (isWordChar(s[r]) || s[r] == '-'))
+                ++r;
+            if (r == q)
+                break;
+            k = r;
+        }
+        if (k == p)
+            return -1;
+        if (k < len && s[k] == '.')
+            ++k;
+        p = k;
+    }
+    if (p + 1 < len && s[p] == ':' && s[p+1].isDigit()) {
+        p += 2;
+        while (p < len && s[p].isDigit())
+            ++p;
+    }
+
+    // path: (?:/(?:[,.;:]*[\w~@/?&=+$()!%#*-])*)?
+    if (p < len && s[p] == '/') {
+        ++p;
+        forever {
+            int q = p;
+            while (q < len && isUrlInnerPunct(s[q]))
+                ++q;
+            if (q >= len || !isUrlChar(s[q]))
+                break;
+            p = q + 1;
+        }
+    }
+
+    // end: (?:>|[,.;:"]*\s|\b|$), backing off one character at a time like the regexp would.
+    // runEnd caches the end of the trailing punctuation run, which stays valid while we walk backwards.
+    int end = p;
+    int runEnd = -1;
+    while (end > authorityStart) {
+        if (end == len)
+            break;
+        QChar c = s[end];
+        if (c == '>')
+            break;
+        if (!isUrlTrailingPunct(c))
+            runEnd = end;
+        else if (runEnd < 0) {
+            runEnd = end;
+            while (runEnd < len && isUrlTrailingPunct(s[runEnd]))
+                ++runEnd;
+        }
+        if (runEnd < len && s[runEnd].isSpace())
+            break;
+        if (isWordBoundary(s, len, end))
+            break;
+        --end;
+    }
+    if (end <= authorityStart)
+        return -1;
+
+    // special case: closing paren only matches if we had an open one
+    if (s[end-1] == ')') {
+        bool hasOpenParen = false;
+        for (int k = pos; k < end - 1; ++k) {
+            if (s[k] == '(') {
+                hasOpenParen = true;
+                break;
             }
         }
-        if (type >= 0) {
-            idx = matchEnd[type];
-            QString match = str.mid(matches[type], matchEnd[type] - matches[type]);
-            if (type == Clickable::Url && str.at(idx-1) == ')') { // special case: closing paren only matches if we had an open one
-                if (!match.contains('(')) {
-                    matchEnd[type]--;
-                    match.chop(1);
-                }
+        if (!hasOpenParen)
+            --end;
+    }
+    return end;
+}
+
+
+/* Tries to match a channel name starting at pos, i.e. ((?:#|![A-Z0-9]{5})[^,:\s]+(?::[^,:\s]+)?)\b
+ * Returns the end of the match, or -1.
+ * We don't match for channel names starting with + or &, because that gives us a lot of false positives.
+ */
+int scanChannel(const QChar *s, int len, int pos)
+{
+    int p;
+    if (s[pos] == '#')
+        p = pos + 1;
+    else {
+        if (pos + 6 > len)
+            return -1;
+        for (int k = pos + 1; k < pos + 6; ++k) {
+            if (s[k].unicode() >= 128 || !s[k].isLetterOrNumber())
+                return -1;
+        }
+        p = pos + 6;
+    }
+
+    int k = p;
+    while (k < len && isChannelChar(s[k]))
+        ++k;
+    if (k == p)
+        return -1;
+    if (k + 1 < len && s[k] == ':' && isChannelChar(s[k+1])) {
+        k += 2;
+        while (k < len && isChannelChar(s[k]))
+            ++k;
+    }
+
+    for (int end = k; end > p; --end) {
+        if (s[end-1] != ':' && isWordBoundary(s, len, end))
+            return end;
+    }
+    return -1;
+}
+
+
+bool isChannelNumber(const QChar *s, int start, int end)
+{
+    if (s[start] != '#')
+        return false;
+    for (int k = start + 1; k < end; ++k) {
+        if (!s[k].isDigit())
+            return false;
+    }
+    return true;
+}
+
+
+}
+
+
+// This is a hand-written single pass over the string; every candidate start position is looked at once, and
+// runs that were already scanned are remembered. This used to be done with QRegExp, whose backtracking made some
+// (long) lines extremely expensive to render.
+ClickableList ClickableList::fromString(const QString &str)
+{
+    ClickableList result;
+    const QChar *s = str.unicode();
+    const int len = str.length();
+    int schemeFail = 0;
+    int wwwFail = 0;
+
+    int idx = 0;
+    while (idx < len) {
+        QChar c = s[idx];
+        if (isWordChar(c) && (idx == 0 || !isWordChar(s[idx-1]))) {
+            int end = scanUrl(s, len, idx, schemeFail, wwwFail);
+            if (end > idx) {
+                result.append(Clickable(Clickable::Url, idx, end - idx));
+                idx = end;
+                continue;
             }
-            if (type == Clickable::Channel) {
+        }
+        else if (c == '#' || c == '!') {
+            int end = scanChannel(s, len, idx);
+            if (end > idx) {
                 // don't make clickable if it could be a #number
-                if (QRegExp("^#\\d+$").exactMatch(match))
-                    continue;
+                if (!isChannelNumber(s, idx, end))
+                    result.append(Clickable(Clickable::Channel, idx, end - idx));
+                idx = end;
+                continue;
             }
-            result.append(Clickable((Clickable::Type)type, matches[type], matchEnd[type] - matches[type]));
         }
+        ++idx;
     }
-    while (type >= 0);
     return result;
 }
 
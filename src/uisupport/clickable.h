@@ -21,6 +21,7 @@
 #ifndef CLICKABLE_H_
 #define CLICKABLE_H_
 
+#include <QMetaType>
 #include <QStackedWidget>
 
 #include "types.h"
@@ -66,4 +67,7 @@ public:
 };
 
 
+Q_DECLARE_METATYPE(ClickableList)
+
+
 #endif // CLICKABLE_H_